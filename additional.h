@@ -1,42 +1,21 @@
-#define nFlows 4
+#include "fq_ring.h"
+#include "fq_uapi.h"
 
 #define barrierNumber 10000
 
-#define timeInterval 10000
+#define timeInterval 10000 /* ns, barrier hold before any rate sample */
 
 #define plimit 17
 
+#define nMembers FQ_COFLOW_MEMBERS /* co-flow members, coord members[] */
 
-int pCount_enq = 0;
-
-int pCount_deq = 0;
-
-int pCount = 0;
-
-int barriercounter_flow[2] = {0};
-
-int dcounter = 0;
-
-u32 pFlowid[2] = {-1, -1};
-
-int firstflag = 0;
-
-int barrier[barrierNumber] = {0};
-
-struct fq_flow *flowmapper[2];
-
-char *bitmap[nFlows];
-
-unsigned long pCoflow[nFlows];
-
-unsigned long time_first, time_nw, time_elapsed;
 
 struct fq_skb_cb {
   u64 time_to_send;
 };
 
 /*This function is used to check if a flow belongs to a co-flow set, all the
- * flows are identified by the f->socket_hash */
+ * flows are identified by f->key */
 
 static inline struct fq_skb_cb *fq_skb_cb(struct sk_buff *skb) {
   qdisc_cb_private_validate(skb, sizeof(struct fq_skb_cb));
@@ -63,19 +42,126 @@ struct fq_flow {
 
   /* Second cache line, used in fq_dequeue() */
   int credit;
-  /* 32bit hole on 64bit arches */
+  u8 list; /* FQ_LIST_*, valid while on a RR list */
+  /* 24bit hole on 64bit arches */
 
   struct fq_flow *next; /* next pointer in RR lists */
 
   struct rb_node rate_node; /* anchor in q->delayed tree */
   u64 time_next_packet;
+  u64 key; /* co-flow key, FQ_COFLOW_KEY_* */
 } ____cacheline_aligned_in_smp;
 
 struct fq_flow_head {
   struct fq_flow *first;
   struct fq_flow *last;
+  u8 list; /* FQ_LIST_* */
 };
 
+/*
+ * Co-flow barrier state shared by every fq instance of a device : under mq
+ * each TX queue runs its own fq, while members of a co-flow hash to
+ * different queues. epoch[i] counts the packets member i enqueued, so
+ * member i has reached barrier k once epoch[i] > k, and an instance can
+ * tell barrier k is complete by reading the epochs, without taking the
+ * other queues' locks.
+ *
+ * The member keys live here too, so slot i names the same flow on every
+ * queue. They are written under lock (class ops, learning, inference) and
+ * read without it; members_gen moves whenever a new set replaces them.
+ */
+struct fq_coflow_coord {
+  struct list_head node; /* on fq_coords */
+  struct net_device *dev;
+  refcount_t refcnt;
+  atomic64_t epoch[nMembers];
+  atomic64_t release; /* ns, EDT release time of the current window */
+
+  spinlock_t lock;
+  u64 members[nMembers]; /* FQ_COFLOW_KEY_* */
+  u8 configured;         /* members set through tc, no learning */
+  atomic_t members_gen;
+
+  /* written by the queue dequeuing member i only */
+  u64 last_dequeue[nMembers];
+  unsigned long gap_ns[nMembers]; /* EWMA of the member dequeue interval */
+};
+
+/*
+ * Class view of the co-flow. A co-flow starts with the first member packet
+ * enqueued while none was queued and completes when the last one leaves,
+ * its completion time (CCT) is the time in between.
+ */
+struct fq_coflow_class {
+  struct gnet_stats_basic_packed bstats;
+  struct gnet_stats_queue qstats; /* backlog, drops */
+  u32 qlen;
+  u64 start;
+  u64 start_bytes;   /* bstats at start */
+  u64 start_packets;
+  u64 timed_out;     /* 1 + last barrier reported as timed out */
+  u64 last_cct_ns;
+  u64 completions;
+  u64 cct_sum_ns;
+  u64 cct_hist[FQ_CCT_BUCKETS]; /* fq_uapi.h, log2 us */
+};
+
+/*
+ * Co-flow configuration, immutable once published. fq_change() builds a
+ * new one and swaps q->coflow_cfg under RTNL; the datapath notices the new
+ * generation with rcu_dereference_bh() and copies it into its own state,
+ * so a push of co-flow parameters alone never takes the qdisc lock nor
+ * waits for it (fq_change_locked()). The members are not part of it, they
+ * are shared by the device (struct fq_coflow_coord).
+ */
+struct fq_coflow_cfg {
+  u32 gen;
+  u32 hold_min;          /* ns */
+  u32 hold_max;          /* ns */
+  u32 release_grid;      /* ns, 0 : members are held, not released */
+  u32 max_rate;          /* bytes/s per member flow, ~0U : unlimited */
+  u8 tag;                /* FQ_COFLOW_TAG_* read on orphan traffic */
+  u32 tag_stamp;         /* written on member packets, 0 : none */
+  u32 infer_window;      /* ns, 0 : no inference */
+  u8 infer_port_shift;
+  struct rcu_head rcu;
+  u32 nrules;
+  struct tc_fq_coflow_rule rules[]; /* orphan co-flow table */
+};
+
+/*
+ * Co-flow inference (CODA style) for applications that cannot tag : a
+ * socket flow starting within infer_window of the latest flow of a group
+ * joins it if it also shares the group's cgroup or destination port range.
+ * The table is bounded, a new group replaces the one idle the longest.
+ */
+#define FQ_INFER_GROUPS 16
+#define FQ_INFER_ELECT 60 /* confidence a group needs to become the co-flow */
+
+struct fq_infer_group {
+  u64 cgroup;         /* cgroup id of the first flow, 0 : none */
+  u64 last_ns;        /* start of the latest flow */
+  u64 keys[nMembers]; /* first flows */
+  u32 confidence;     /* 0..100, mean over the joins */
+  u16 dport;          /* destination port >> port shift */
+  u16 nflows;
+};
+
+#ifdef FQ_STAGING
+/*
+ * Per cpu enqueue staging (make FLAGS=-DFQ_STAGING).
+ * fq_enqueue() only pushes the skb on the local cpu list, the cpu running
+ * fq_dequeue() drains every list and classifies the batch.
+ */
+#define FQ_STAGE_LIMIT 1024 /* max skbs staged on one cpu */
+
+struct fq_stage {
+  struct llist_head skbs;
+  u32 staged; /* written by the enqueueing cpu */
+  u32 merged; /* written by the dequeueing cpu */
+} ____cacheline_aligned_in_smp;
+#endif
+
 struct fq_sched_data {
   struct fq_flow_head new_flows;
 
@@ -118,21 +204,49 @@ struct fq_sched_data {
 
   u32 timer_slack; /* hrtimer slack in ns */
   struct qdisc_watchdog watchdog;
+
+  struct fq_coflow_cfg __rcu *coflow_cfg;
+  u32 coflow_cfg_gen; /* of the configuration applied below */
+  u32 coflow_members_gen; /* of the coord members coflow_cl counts */
+  struct fq_coflow_class coflow_cl;
+  struct fq_coflow_coord *coord;
+  u64 dcounter; /* barriers this instance consumed */
+  u32 coflow_hold_min; /* ns */
+  u32 coflow_hold_max; /* ns */
+  unsigned long coflow_hold_ns; /* last hold given to a member packet */
+  u32 coflow_release_grid;      /* ns, EDT release mode when non zero */
+  unsigned long coflow_max_rate; /* bytes/s, applies to member flows */
+  u8 coflow_tag;
+  u32 coflow_tag_stamp;
+  u64 coflow_release_windows;   /* opened by this queue */
+  u32 coflow_infer_window; /* ns, 0 : members learnt, not inferred */
+  u8 coflow_infer_port_shift;
+  struct fq_infer_group infer[FQ_INFER_GROUPS];
+  struct fq_infer_group *infer_elected; /* holds the members */
+  u64 infer_joins;
+  u64 infer_hits;
+  u64 infer_misses;
+  u8 coflow_trim; /* fq_change() drops through fq_dequeue() */
+  struct dentry *debugfs;
+
+  struct fq_ring_hdr *ring;     /* NULL while dequeue logging is off */
+  struct fq_ring_hdr *ring_mem; /* vmalloc_user(), kept until destroy */
+  u8 ring_log;
+  struct dentry *debugfs_ring;
+
+#ifdef FQ_STAGING
+  struct fq_stage __percpu *stage;
+  cpumask_var_t stage_mask; /* cpus whose list went non empty */
+#endif
 };
 
 
 
 int valuePresentInArray(unsigned val, unsigned arr[], int lengthOfarray) {
-  printk("value to be searched is %u\n", val);
-
   int i;
 
   for (i = 0; i < lengthOfarray; i++) {
-    printk("In Array Present function Array Value is  %u\n", arr[i]);
-    if (arr[i] == val) {
-      printk("In Array Present function match occured value present index value " "of %d\n", i);
-      return i;
-    }
+    if (arr[i] == val) return i;
   }
   return -1;
 }
@@ -145,6 +259,21 @@ static void resetFlowid(unsigned arr[], int lengthOfarray) {
   }
 }
 
+/* Index of the member named @key, -1 if none */
+static inline int fq_coflow_member(const u64 members[], int n, u64 key) {
+  int i;
+
+  for (i = 0; i < n; i++)
+    if (READ_ONCE(members[i]) == key) return i;
+  return -1;
+}
+
+static inline void fq_coflow_members_reset(u64 members[], int n) {
+  int i;
+
+  for (i = 0; i < n; i++) members[i] = FQ_COFLOW_KEY_NONE;
+}
+
 static void fq_flow_add_tail(struct fq_flow_head *head, struct fq_flow *flow) {
   if (head->first)
     head->last->next = flow;
@@ -152,16 +281,13 @@ static void fq_flow_add_tail(struct fq_flow_head *head, struct fq_flow *flow) {
     head->first = flow;
   head->last = flow;
   flow->next = NULL;
+  flow->list = head->list;
 }
 
 
 int Promotecoflows(struct fq_flow_head *oldFlow, struct fq_flow_head *newFlow,
                    struct fq_flow_head *coflowhead, struct fq_flow *flow,
-                   struct fq_flow *coflow, unsigned arr[], int lengthOfarray) {
-  printk("In Promotecoflows \n");
-
-  printk("size of array %d\n", lengthOfarray);
-
+                   struct fq_flow *coflow, u64 arr[], int lengthOfarray) {
   struct fq_flow_head *head;
 
   struct fq_flow *prev, *newflowhead, *oldflowhead;
@@ -184,19 +310,10 @@ loop:
     if (!flow) {
 
     loop3:
-      printk("promotion completed \n");
       return 1;
     }
   }
 
-  /*if(newFlow->first->socket_hash)
-  printk("value of newflows head is %u\n", newFlow->first->socket_hash);
-
-  if(oldFlow->first->socket_hash)
-  printk("value of oldflows head is  %u\n", oldFlow->first->socket_hash);
-
-  printk("value of flag is  %d\n", flag);*/
-
   if (!flag) {
     flow = head->first;
     flag = 1;
@@ -204,7 +321,7 @@ loop:
 
   int arraylength = lengthOfarray;
 
-  int rValue = valuePresentInArray(flow->socket_hash, arr, arraylength);
+  int rValue = fq_coflow_member(arr, arraylength, flow->key);
 
   if (rValue != -1) {
 
@@ -0,0 +1,129 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * fq_coflow_trace.h Co-flow tracepoints of sch_fq
+ *
+ *  fq_coflow:fq_coflow_enqueue  member packet enqueued, with its hold
+ *  fq_coflow:fq_coflow_dequeue  member packet dequeued
+ *  (both carry the flow key, FQ_COFLOW_KEY_*, as the member table does)
+ *  fq_coflow:fq_coflow_event    admit, promote, timeout, complete (the
+ *                               generic netlink events)
+ *
+ *  Consumed by tools/fq_top as raw tracepoints : keep the TP_PROTO stable.
+ */
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM fq_coflow
+
+#if !defined(_FQ_COFLOW_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _FQ_COFLOW_TRACE_H
+
+#include <linux/tracepoint.h>
+#include <net/sch_generic.h>
+
+TRACE_EVENT(fq_coflow_enqueue,
+
+  TP_PROTO(const struct Qdisc *sch, u64 key, int member, unsigned int len,
+           u64 hold_ns, u32 qlen),
+
+  TP_ARGS(sch, key, member, len, hold_ns, qlen),
+
+  TP_STRUCT__entry(
+    __field(int, ifindex)
+    __field(u32, handle)
+    __field(u64, key)
+    __field(int, member)
+    __field(unsigned int, len)
+    __field(u64, hold_ns)
+    __field(u32, qlen)
+  ),
+
+  TP_fast_assign(
+    __entry->ifindex = qdisc_dev(sch)->ifindex;
+    __entry->handle = sch->handle;
+    __entry->key = key;
+    __entry->member = member;
+    __entry->len = len;
+    __entry->hold_ns = hold_ns;
+    __entry->qlen = qlen;
+  ),
+
+  TP_printk("dev=%d handle=0x%x key=%016llx member=%d len=%u hold_ns=%llu "
+            "qlen=%u",
+            __entry->ifindex, __entry->handle, __entry->key,
+            __entry->member, __entry->len, __entry->hold_ns, __entry->qlen)
+);
+
+TRACE_EVENT(fq_coflow_dequeue,
+
+  TP_PROTO(const struct Qdisc *sch, u64 key, int member, unsigned int len,
+           u32 qlen),
+
+  TP_ARGS(sch, key, member, len, qlen),
+
+  TP_STRUCT__entry(
+    __field(int, ifindex)
+    __field(u32, handle)
+    __field(u64, key)
+    __field(int, member)
+    __field(unsigned int, len)
+    __field(u32, qlen)
+  ),
+
+  TP_fast_assign(
+    __entry->ifindex = qdisc_dev(sch)->ifindex;
+    __entry->handle = sch->handle;
+    __entry->key = key;
+    __entry->member = member;
+    __entry->len = len;
+    __entry->qlen = qlen;
+  ),
+
+  TP_printk("dev=%d handle=0x%x key=%016llx member=%d len=%u qlen=%u",
+            __entry->ifindex, __entry->handle, __entry->key,
+            __entry->member, __entry->len, __entry->qlen)
+);
+
+TRACE_EVENT(fq_coflow_event,
+
+  TP_PROTO(const struct Qdisc *sch, u8 event, u64 bytes, u64 packets,
+           u64 cct_ns, u64 barrier),
+
+  TP_ARGS(sch, event, bytes, packets, cct_ns, barrier),
+
+  TP_STRUCT__entry(
+    __field(int, ifindex)
+    __field(u32, handle)
+    __field(u8, event)
+    __field(u64, bytes)
+    __field(u64, packets)
+    __field(u64, cct_ns)
+    __field(u64, barrier)
+  ),
+
+  TP_fast_assign(
+    __entry->ifindex = qdisc_dev(sch)->ifindex;
+    __entry->handle = sch->handle;
+    __entry->event = event;
+    __entry->bytes = bytes;
+    __entry->packets = packets;
+    __entry->cct_ns = cct_ns;
+    __entry->barrier = barrier;
+  ),
+
+  /* FQ_COFLOW_CMD_* */
+  TP_printk("dev=%d handle=0x%x %s bytes=%llu packets=%llu cct_ns=%llu "
+            "barrier=%llu",
+            __entry->ifindex, __entry->handle,
+            __print_symbolic(__entry->event, { 1, "admit" },
+                             { 2, "promote" }, { 3, "timeout" },
+                             { 4, "complete" }),
+            __entry->bytes, __entry->packets, __entry->cct_ns,
+            __entry->barrier)
+);
+
+#endif /* _FQ_COFLOW_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE fq_coflow_trace
+#include <trace/define_trace.h>
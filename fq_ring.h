@@ -0,0 +1,58 @@
+/*
+ * fq_ring.h Dequeue event ring, shared by sch_fq and tools/fq_ring
+ *
+ *  Enabled per qdisc with TCA_FQ_COFLOW_RING_LOG (log2 of the number of
+ *  entries, 0 stops logging) and mapped read only from debugfs
+ *  sch_fq/<dev>-<handle>.ring : a struct fq_ring_hdr followed by
+ *  hdr.size struct fq_ring_ev.
+ *
+ *  fq_dequeue() is the only writer. It fills ev[head & (size - 1)] then
+ *  publishes head + 1 with a release store, and never waits for readers :
+ *  a reader more than size entries behind lost the oldest ones, and must
+ *  check head again after copying to know which entries it copied intact.
+ */
+#ifndef FQ_RING_H
+#define FQ_RING_H
+
+#include <linux/types.h>
+
+#define FQ_RING_MAGIC 0x66717267 /* "fqrg" */
+#define FQ_RING_VERSION 2 /* 2 : flow key instead of sk_hash */
+#define FQ_RING_LOG_MAX 22
+
+/* Queue a packet was served from */
+enum { FQ_LIST_NEW, FQ_LIST_OLD, FQ_LIST_CO, FQ_LIST_INTERNAL };
+
+struct fq_ring_hdr {
+  __u32 magic;
+  __u32 version;
+  __u32 size;    /* entries, a power of 2 */
+  __u32 ev_size; /* sizeof(struct fq_ring_ev) */
+  __u64 head;    /* entries written so far */
+  __u8 pad[40];  /* events start on their own cache line */
+};
+
+struct fq_ring_ev {
+  __u64 tstamp; /* ktime_get_ns() at dequeue */
+  __u64 key;    /* flow key, FQ_COFLOW_KEY_* (fq_uapi.h) : the member name */
+  __u32 len;    /* qdisc_pkt_len(), entries lost for FQ_RING_LOST */
+  __u32 qlen;   /* packets left in the qdisc */
+  __s8 member;  /* co-flow member index, -1 if none */
+  __u8 list;    /* FQ_LIST_* */
+  __u8 pad[6];
+};
+
+/* ev.list of a loss record, inserted by the reader in its stream */
+#define FQ_RING_LOST 0xff
+
+/* Stream file written by tools/fq_ring : this header then fq_ring_ev */
+#define FQ_RING_FILE_MAGIC 0x76657166 /* "fqev" */
+
+struct fq_ring_file {
+  __u32 magic;
+  __u32 version;
+  __u32 ev_size;
+  __u32 pad;
+};
+
+#endif /* FQ_RING_H */
@@ -0,0 +1,168 @@
+/*
+ * fq_uapi.h Netlink interface of the co-flow sch_fq, shared with tools/
+ *
+ *  Attributes, stats and events on top of <linux/pkt_sched.h>. Only ever
+ *  append : old tools read the leading part of the stats structures.
+ */
+#ifndef FQ_UAPI_H
+#define FQ_UAPI_H
+
+#include <linux/pkt_sched.h>
+#include <linux/types.h>
+
+#define FQ_COFLOW_MEMBERS 2
+#define FQ_CCT_BUCKETS 32
+
+/*
+ * Co-flow members are named by a 64 bit key : the socket cookie of a
+ * connected socket (SO_COOKIE, "sk:" in ss -e), or FQ_COFLOW_KEY_ORPHAN
+ * ORed with skb hash & orphan_mask for unconnected and orphaned traffic.
+ */
+#define FQ_COFLOW_KEY_ORPHAN (1ULL << 63)
+#define FQ_COFLOW_KEY_NONE (~0ULL) /* unused member slot */
+
+/*
+ * Co-flow tags carried in packet headers (TCA_FQ_COFLOW_TAG) : the 6 DSCP
+ * bits or the 20 bit IPv6 flow label of unconnected, orphaned and
+ * forwarded packets. A non zero tag names their flow FQ_COFLOW_KEY_TAG |
+ * tag, so hosts and routers running the qdisc agree on the members
+ * without a controller. Orphan co-flow rules take precedence.
+ */
+enum {
+  FQ_COFLOW_TAG_NONE,
+  FQ_COFLOW_TAG_DSCP,
+  FQ_COFLOW_TAG_FLOWLABEL, /* IPv6 only */
+};
+
+#define FQ_COFLOW_KEY_TAG (FQ_COFLOW_KEY_ORPHAN | 1ULL << 62)
+
+/*
+ * Co-flow attributes. Fixed numbers, clear of the stock TCA_FQ_* ones :
+ * TCA_FQ_MAX differs between the kernel the module is built against (it
+ * has port attributes of its own) and the uapi headers tools/ use, so
+ * numbering after it would make both sides disagree. The module checks at
+ * build time that its TCA_FQ_MAX stays below.
+ */
+enum {
+  TCA_FQ_COFLOW_HOLD_MIN = 32,             /* u32, ns */
+  TCA_FQ_COFLOW_HOLD_MAX,                  /* u32, ns */
+  TCA_FQ_COFLOW_RING_LOG,                  /* u32, fq_ring.h */
+  TCA_FQ_COFLOW_RULES,                     /* struct tc_fq_coflow_rule[] */
+  TCA_FQ_COFLOW_RELEASE_GRID,              /* u32, ns, 0 : hold mode */
+  TCA_FQ_COFLOW_MAX_RATE,                  /* u32, bytes/s per member flow */
+  TCA_FQ_COFLOW_TAG,                       /* u32, FQ_COFLOW_TAG_* */
+  TCA_FQ_COFLOW_TAG_STAMP,                 /* u32, tag of member packets */
+  TCA_FQ_COFLOW_INFER_WINDOW,              /* u32, ns, 0 : no inference */
+  TCA_FQ_COFLOW_INFER_PORT_SHIFT,          /* u32, dport >> shift groups */
+  __TCA_FQ_COFLOW_MAX
+};
+
+#define TCA_FQ_COFLOW_MAX (__TCA_FQ_COFLOW_MAX - 1)
+
+/*
+ * Orphan co-flow rules : unconnected (UDP, QUIC) and orphaned traffic has
+ * no socket cookie, a packet matching a rule is queued on a flow of its
+ * own named rule.key (FQ_COFLOW_KEY_ORPHAN set by convention), instead of
+ * the skb hash & orphan_mask bucket. Every non zero field must match : the
+ * mark under mark_mask, then proto, ports and, when family is set, the
+ * addresses (IPv4 in saddr[0]/daddr[0]). The first matching rule wins.
+ * TCA_FQ_COFLOW_RULES replaces the whole table, empty clears it.
+ */
+#define FQ_COFLOW_RULES_MAX 64
+
+struct tc_fq_coflow_rule {
+  __u64 key;
+  __u32 mark;
+  __u32 mark_mask;
+  __u8 family; /* AF_INET, AF_INET6 or 0 : any address */
+  __u8 proto;  /* IPPROTO_*, 0 : any */
+  __be16 sport;
+  __be16 dport;
+  __u16 pad;
+  __be32 saddr[4];
+  __be32 daddr[4];
+};
+
+/* tc_fq_qd_stats followed by the co-flow counters, a stock tc only reads
+ * the leading part.
+ */
+struct tc_fq_coflow_qd_stats {
+  struct tc_fq_qd_stats fq;
+  __u64 coflow_hold_ns; /* current barrier hold interval */
+  __u64 coflow_bytes;   /* member packets dequeued */
+  __u64 coflow_packets;
+  __u64 coflow_drops;
+  __u32 coflow_qlen;
+  __u32 coflow_backlog;
+  __u64 coflow_completions;
+  __u64 coflow_cct_sum_ns;
+  /* completion times : [0] below 1 us, [b] in [2^(b-1), 2^b) us, the
+   * last bucket also counts longer ones
+   */
+  __u64 coflow_cct_hist[FQ_CCT_BUCKETS];
+  __u64 coflow_release_ns;      /* current common release time, EDT mode */
+  __u64 coflow_release_windows; /* release times issued */
+  /* co-flow inference : flows that joined a group, and how many of those
+   * joins the configured members confirm or contradict
+   */
+  __u64 coflow_infer_joins;
+  __u64 coflow_infer_hits;
+  __u64 coflow_infer_misses;
+  __u32 coflow_infer_groups;     /* groups of two flows or more */
+  __u32 coflow_infer_confidence; /* 0..100, of the inferred co-flow */
+};
+
+/* The co-flow of an instance is tc class <handle>:FQ_COFLOW_MINOR */
+#define FQ_COFLOW_MINOR 1
+
+enum {
+  TCA_FQ_CLASS_UNSPEC,
+  TCA_FQ_CLASS_MEMBERS, /* obsolete u32 sk_hash members, rejected */
+  TCA_FQ_CLASS_KEYS,    /* u64[FQ_COFLOW_MEMBERS], FQ_COFLOW_KEY_* */
+  __TCA_FQ_CLASS_MAX
+};
+
+#define TCA_FQ_CLASS_MAX (__TCA_FQ_CLASS_MAX - 1)
+
+/*
+ * Co-flow lifecycle events, multicast on generic netlink family
+ * FQ_COFLOW_GENL_NAME, group FQ_COFLOW_GENL_MCGRP. The command is the event.
+ */
+#define FQ_COFLOW_GENL_NAME "fq_coflow"
+#define FQ_COFLOW_GENL_VERSION 1
+#define FQ_COFLOW_GENL_MCGRP "events"
+
+enum {
+  FQ_COFLOW_CMD_UNSPEC,
+  FQ_COFLOW_CMD_ADMIT,    /* first member packet of an idle co-flow */
+  FQ_COFLOW_CMD_PROMOTE,  /* barrier complete, members moved to co_flows */
+  FQ_COFLOW_CMD_TIMEOUT,  /* a member hold expired short of the barrier */
+  FQ_COFLOW_CMD_COMPLETE, /* last member packet left */
+  __FQ_COFLOW_CMD_MAX
+};
+
+enum {
+  FQ_COFLOW_A_UNSPEC,
+  FQ_COFLOW_A_PAD,
+  FQ_COFLOW_A_IFINDEX, /* u32 */
+  FQ_COFLOW_A_HANDLE,  /* u32, class handle */
+  FQ_COFLOW_A_TIME,    /* u64, ktime_get_ns() of the event */
+  FQ_COFLOW_A_BYTES,   /* u64, dequeued since admission */
+  FQ_COFLOW_A_PACKETS, /* u64, dequeued since admission */
+  FQ_COFLOW_A_BARRIER, /* u64, barriers this instance consumed */
+  FQ_COFLOW_A_CCT,     /* u64, ns, COMPLETE only */
+  __FQ_COFLOW_A_MAX
+};
+
+#define FQ_COFLOW_A_MAX (__FQ_COFLOW_A_MAX - 1)
+
+/* Class xstats */
+struct tc_fq_coflow_xstats {
+  __u64 last_cct_ns; /* completion time of the last co-flow */
+  __u64 completions; /* co-flows fully drained */
+  __u64 barriers;    /* barriers this instance consumed */
+  __u32 members[FQ_COFLOW_MEMBERS]; /* obsolete, ~0U */
+  __u64 keys[FQ_COFLOW_MEMBERS];
+};
+
+#endif /* FQ_UAPI_H */
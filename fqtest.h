@@ -89,7 +89,7 @@ int retVal;
 
 
 
-int testpromotecoflows(struct Qdisc *sch, struct fq_sched_data *q, unsigned arr[], int lengthOfarray)
+int testpromotecoflows(struct Qdisc *sch, struct fq_sched_data *q, u64 arr[], int lengthOfarray)
 {
 
     struct fq_flow f;
@@ -120,27 +120,27 @@ int testpromotecoflows(struct Qdisc *sch, struct fq_sched_data *q, unsigned arr[
     struct fq_flow_head* oldFlowsheadptr = &(q->co_flows);
     
     
-    f.socket_hash = f.sk +10;
+    f.key = f.sk +10;
     
-    printk("value of f %u\n", f.socket_hash);
+    printk("value of f %llu\n", f.key);
     
-    g.socket_hash = g.sk +10;
+    g.key = g.sk +10;
     
-    printk("value of g %u\n", g.socket_hash);
+    printk("value of g %llu\n", g.key);
     
-    i.socket_hash = i.sk +10;
+    i.key = i.sk +10;
    
-     printk("value of i %u\n", i.socket_hash);
+     printk("value of i %llu\n", i.key);
     
-    h.socket_hash = h.sk +10;
+    h.key = h.sk +10;
     
-    printk("value of h %u\n", h.socket_hash);
+    printk("value of h %llu\n", h.key);
     
-    j.socket_hash = j.sk +10;  
+    j.key = j.sk +10;  
     
-     printk("value of j %u\n", j.socket_hash);
+     printk("value of j %llu\n", j.key);
     
-    coflow.socket_hash = coflow.sk +10;
+    coflow.key = coflow.sk +10;
     
     fq_flow_add_tail(&q->new_flows, &f);
     
@@ -217,7 +217,7 @@ int testpromotecoflows(struct Qdisc *sch, struct fq_sched_data *q, unsigned arr[
    //coflowptr = coflowptr->next;
    
    if(coflowptr)
-   printk("value of coflows next %u\n", coflowptr->socket_hash);
+   printk("value of coflows next %llu\n", coflowptr->key);
 
    if(!coflowptr)
    {
@@ -231,9 +231,9 @@ int testpromotecoflows(struct Qdisc *sch, struct fq_sched_data *q, unsigned arr[
    while(coflowptr)
    {
    
-           printk("value of coflows %u\n", coflowptr->socket_hash);
+           printk("value of coflows %llu\n", coflowptr->key);
            
-         int retVal = valuePresentInArray(coflowptr->socket_hash, arr, lengthOfarray);
+         int retVal = fq_coflow_member(arr, lengthOfarray, coflowptr->key);
            
            if( retVal == -1)
            {
@@ -249,6 +249,443 @@ int testpromotecoflows(struct Qdisc *sch, struct fq_sched_data *q, unsigned arr[
 return 1;
 }
   
+static void fq_coflow_infer(struct fq_sched_data *q, struct sock *sk, u64 key);
+static struct sk_buff *fq_dequeue(struct Qdisc *sch);
+
+/* Members elected by co-flow inference must survive a dequeue : flows
+ * 7921.. of one socket (same cgroup and port) form a group, which is
+ * elected, then the (empty) qdisc is dequeued.
+ */
+int testinferdequeue(struct Qdisc *sch, struct fq_sched_data *q)
+{
+  struct sock *sk;
+  int i, ret = 1;
+
+  sk = kzalloc(sizeof(*sk), GFP_KERNEL);
+  if (!sk) return 0;
+  sk->sk_dport = htons(5001);
+
+  local_bh_disable();
+  fq_dequeue(sch); /* applies the initial configuration */
+  q->coflow_infer_window = NSEC_PER_MSEC;
+  for (i = 0; i < nMembers; i++) fq_coflow_infer(q, sk, 7921 + i);
+  for (i = 0; i < nMembers; i++)
+    if (q->coord->members[i] != 7921 + i) ret = 0;
+
+  fq_dequeue(sch);
+  for (i = 0; i < nMembers; i++)
+    if (q->coord->members[i] != 7921 + i) ret = 0;
+  local_bh_enable();
+
+  q->coflow_infer_window = 0;
+  memset(q->infer, 0, sizeof(q->infer));
+  q->infer_elected = NULL;
+  fq_coflow_members_reset(q->coord->members, nMembers);
+  kfree(sk);
+  return ret;
+}
+
+static unsigned long fq_class_find(struct Qdisc *sch, u32 classid);
+static int fq_class_change(struct Qdisc *sch, u32 classid, u32 parentid,
+                           struct nlattr **tca, unsigned long *arg,
+                           struct netlink_ext_ack *extack);
+static int fq_class_delete(struct Qdisc *sch, unsigned long cl,
+                           struct netlink_ext_ack *extack);
+
+/* The co-flow is class <handle>:1 only : other minors are rejected and
+ * leave the members alone, minor 1 sets them and deleting it clears them.
+ */
+int testclassminor(struct Qdisc *sch, struct fq_sched_data *q)
+{
+  struct {
+    struct nlattr opt;
+    struct nlattr keys;
+    u64 k[nMembers];
+  } msg;
+  struct nlattr *tca[TCA_MAX + 1] = {};
+  unsigned long arg = 0;
+  int i, ret = 1;
+
+  msg.opt.nla_type = TCA_OPTIONS;
+  msg.opt.nla_len = sizeof(msg);
+  msg.keys.nla_type = TCA_FQ_CLASS_KEYS;
+  msg.keys.nla_len = NLA_HDRLEN + sizeof(msg.k);
+  for (i = 0; i < nMembers; i++) msg.k[i] = 7921 + i;
+  tca[TCA_OPTIONS] = &msg.opt;
+
+  if (fq_class_change(sch, TC_H_MAKE(sch->handle, 2), sch->handle, tca, &arg,
+                      NULL) != -EOPNOTSUPP || arg)
+    ret = 0;
+  if (q->coord->members[0] != FQ_COFLOW_KEY_NONE) ret = 0;
+
+  if (fq_class_change(sch, TC_H_MAKE(sch->handle, FQ_COFLOW_MINOR),
+                      sch->handle, tca, &arg, NULL) ||
+      arg != FQ_COFLOW_MINOR)
+    ret = 0;
+  for (i = 0; i < nMembers; i++)
+    if (q->coord->members[i] != 7921 + i) ret = 0;
+  if (fq_class_find(sch, TC_H_MAKE(sch->handle, FQ_COFLOW_MINOR)) !=
+          FQ_COFLOW_MINOR ||
+      fq_class_find(sch, TC_H_MAKE(sch->handle, 2)))
+    ret = 0;
+
+  fq_class_delete(sch, FQ_COFLOW_MINOR, NULL);
+  if (fq_class_find(sch, TC_H_MAKE(sch->handle, FQ_COFLOW_MINOR))) ret = 0;
+
+  q->coord->configured = 0;
+  return ret;
+}
+
+static unsigned int fq_cct_bucket(u64 cct_ns);
+
+/* CCT histogram buckets are log2 us : [0, 1us) is bucket 0, [2^(i-1),
+ * 2^i) us is bucket i, the last one takes everything above.
+ */
+int testcctbucket(void)
+{
+  int i;
+
+  if (fq_cct_bucket(0) || fq_cct_bucket(NSEC_PER_USEC - 1)) return 0;
+  for (i = 1; i < FQ_CCT_BUCKETS - 1; i++) {
+    u64 lo = (u64)NSEC_PER_USEC << (i - 1);
+
+    if (fq_cct_bucket(lo) != i || fq_cct_bucket(2 * lo - 1) != i) return 0;
+  }
+  if (fq_cct_bucket(~0ULL) != FQ_CCT_BUCKETS - 1) return 0;
+  return 1;
+}
+
+/* A socketless UDP packet 192.0.2.1:4000 > 192.0.2.2:dport, or the same
+ * between 2001:db8::1 and 2001:db8::2, network header set.
+ */
+static struct sk_buff *testudpskb(struct Qdisc *sch, bool v6, u16 dport)
+{
+  struct sk_buff *skb = alloc_skb(128, GFP_KERNEL);
+  struct udphdr *uh;
+
+  if (!skb) return NULL;
+  skb->dev = qdisc_dev(sch);
+  skb_reserve(skb, 32);
+  skb_reset_network_header(skb);
+  if (v6) {
+    struct ipv6hdr *ip6h = skb_put_zero(skb, sizeof(*ip6h));
+
+    ip6h->version = 6;
+    ip6h->nexthdr = IPPROTO_UDP;
+    ip6h->hop_limit = 64;
+    ip6h->payload_len = htons(sizeof(*uh));
+    ip6h->saddr.s6_addr32[0] = htonl(0x20010db8);
+    ip6h->saddr.s6_addr[15] = 1;
+    ip6h->daddr.s6_addr32[0] = htonl(0x20010db8);
+    ip6h->daddr.s6_addr[15] = 2;
+    skb->protocol = htons(ETH_P_IPV6);
+  } else {
+    struct iphdr *iph = skb_put_zero(skb, sizeof(*iph));
+
+    iph->version = 4;
+    iph->ihl = 5;
+    iph->ttl = 64;
+    iph->protocol = IPPROTO_UDP;
+    iph->tot_len = htons(sizeof(*iph) + sizeof(*uh));
+    iph->saddr = htonl(0xc0000201);
+    iph->daddr = htonl(0xc0000202);
+    ip_send_check(iph);
+    skb->protocol = htons(ETH_P_IP);
+  }
+  skb_set_transport_header(skb, skb->len);
+  uh = skb_put_zero(skb, sizeof(*uh));
+  uh->source = htons(4000);
+  uh->dest = htons(dport);
+  uh->len = htons(sizeof(*uh));
+  return skb;
+}
+
+static struct fq_coflow_cfg *fq_coflow_cfg_dup(struct fq_sched_data *q,
+                                               int nrules);
+static void fq_coflow_cfg_publish(struct fq_sched_data *q,
+                                  struct fq_coflow_cfg *cfg);
+static struct sock *fq_coflow_orphan(struct fq_sched_data *q,
+                                     const struct sk_buff *skb,
+                                     struct sock *sk, u64 *key);
+
+/* Orphan rules match on the dissected IPv4 and IPv6 tuple : a packet to
+ * 192.0.2.2 or 2001:db8::2 port 5001 gets the synthetic flow of its rule,
+ * port 5002 matches neither and keeps its orphan flow.
+ */
+int testorphanrules(struct Qdisc *sch, struct fq_sched_data *q)
+{
+  struct fq_coflow_cfg *cfg = fq_coflow_cfg_dup(q, 2);
+  struct sock *orphan = (struct sock *)0x11UL, *sk;
+  struct sk_buff *skb[3];
+  u64 key;
+  int i, ret = 1;
+
+  if (!cfg) return 0;
+  memset(cfg->rules, 0, 2 * sizeof(cfg->rules[0]));
+  cfg->rules[0].key = FQ_COFLOW_KEY_ORPHAN | 4;
+  cfg->rules[0].family = AF_INET;
+  cfg->rules[0].proto = IPPROTO_UDP;
+  cfg->rules[0].dport = htons(5001);
+  cfg->rules[0].daddr[0] = htonl(0xc0000202);
+  cfg->rules[1].key = FQ_COFLOW_KEY_ORPHAN | 6;
+  cfg->rules[1].family = AF_INET6;
+  cfg->rules[1].dport = htons(5001);
+  cfg->rules[1].daddr[0] = htonl(0x20010db8);
+  cfg->rules[1].daddr[3] = htonl(2);
+  fq_coflow_cfg_publish(q, cfg);
+
+  skb[0] = testudpskb(sch, false, 5001);
+  skb[1] = testudpskb(sch, true, 5001);
+  skb[2] = testudpskb(sch, false, 5002);
+
+  local_bh_disable();
+  for (i = 0; i < 3; i++) {
+    if (!skb[i]) {
+      ret = 0;
+      continue;
+    }
+    key = FQ_COFLOW_KEY_ORPHAN;
+    sk = fq_coflow_orphan(q, skb[i], orphan, &key);
+    if (i < 2 && (sk != (struct sock *)(~0UL - 2UL * i) ||
+                  key != cfg->rules[i].key))
+      ret = 0;
+    if (i == 2 && (sk != orphan || key != FQ_COFLOW_KEY_ORPHAN)) ret = 0;
+  }
+  local_bh_enable();
+
+  for (i = 0; i < 3; i++) kfree_skb(skb[i]);
+  cfg = fq_coflow_cfg_dup(q, 0);
+  if (cfg) fq_coflow_cfg_publish(q, cfg);
+  return ret;
+}
+
+static void fq_reset(struct Qdisc *sch);
+static void fq_coflow_members_set(struct fq_coflow_coord *c,
+                                  const u64 *members, bool configured);
+static int __fq_enqueue(struct sk_buff *skb, struct Qdisc *sch,
+                        struct sk_buff **to_free);
+static struct fq_flow *fq_classify(struct sk_buff *skb,
+                                   struct fq_sched_data *q);
+static struct sk_buff *fq_peek(struct fq_flow *flow);
+
+/* Member packets of one flow in EDT release mode, EDTs in grid steps of
+ * 10 ms : 3.5, 0.2, 8 (a late one opening a window far ahead), 0.5, 1.5.
+ * The flow must stay ordered on the released times (tail list and t_root
+ * sorted, fq_peek() on the earliest), and no packet may be held more than
+ * one grid step past its own EDT by the late window.
+ */
+int testreleaseorder(struct Qdisc *sch, struct fq_sched_data *q)
+{
+  static const u32 edt_us[] = {35000, 2000, 80000, 5000, 15000};
+  const u64 grid = 10 * NSEC_PER_MSEC;
+  struct sk_buff *skb[ARRAY_SIZE(edt_us)], *probe, *p, *first = NULL;
+  struct sk_buff *to_free = NULL;
+  struct fq_coflow_cfg *cfg;
+  u64 members[nMembers], edt[ARRAY_SIZE(edt_us)], prev, now, late;
+  struct fq_flow *f;
+  struct rb_node *n;
+  int i, ret = 1;
+  u32 rem;
+
+  fq_reset(sch);
+  cfg = fq_coflow_cfg_dup(q, -1);
+  probe = testudpskb(sch, false, 5001);
+  if (!cfg || !probe) {
+    kfree(cfg);
+    kfree_skb(probe);
+    return 0;
+  }
+  cfg->release_grid = grid;
+  fq_coflow_cfg_publish(q, cfg);
+
+  for (i = 0; i < nMembers; i++) members[i] = FQ_COFLOW_KEY_NONE;
+  members[0] = FQ_COFLOW_KEY_ORPHAN | (skb_get_hash(probe) & q->orphan_mask);
+  fq_coflow_members_set(q->coord, members, true);
+  atomic64_set(&q->coord->release, 0);
+
+  local_bh_disable();
+  now = ktime_get_ns();
+  for (i = 0; i < ARRAY_SIZE(edt_us); i++) {
+    skb[i] = testudpskb(sch, false, 5001);
+    if (!skb[i]) {
+      ret = 0;
+      continue;
+    }
+    edt[i] = now + (u64)edt_us[i] * NSEC_PER_USEC;
+    skb[i]->tstamp = edt[i];
+    if (__fq_enqueue(skb[i], sch, &to_free) != NET_XMIT_SUCCESS) {
+      skb[i] = NULL;
+      ret = 0;
+    }
+  }
+
+  f = fq_classify(probe, q);
+  for (p = f->head; p; p = p->next) {
+    if (p != f->head && fq_skb_cb(p)->time_to_send < prev) ret = 0;
+    prev = fq_skb_cb(p)->time_to_send;
+  }
+  for (n = rb_first(&f->t_root); n; n = rb_next(n)) {
+    p = rb_to_skb(n);
+    if (n != rb_first(&f->t_root) && fq_skb_cb(p)->time_to_send < prev)
+      ret = 0;
+    prev = fq_skb_cb(p)->time_to_send;
+  }
+  for (i = 0; i < ARRAY_SIZE(edt_us); i++) {
+    u64 tts;
+
+    if (!skb[i]) continue;
+    tts = fq_skb_cb(skb[i])->time_to_send;
+    div_u64_rem(tts, grid, &rem);
+    if (rem || tts < edt[i] || tts - edt[i] > grid || skb[i]->tstamp != tts)
+      ret = 0;
+    if (!first || tts < fq_skb_cb(first)->time_to_send) first = skb[i];
+  }
+  if (fq_peek(f) != first) ret = 0;
+
+  /* the late packet's window is still the device's */
+  div_u64_rem(edt[2], grid, &rem);
+  late = rem ? edt[2] + grid - rem : edt[2];
+  if (atomic64_read(&q->coord->release) != late) ret = 0;
+  local_bh_enable();
+
+  kfree_skb_list(to_free);
+  kfree_skb(probe);
+  q->coord->configured = 0;
+  fq_reset(sch);
+  atomic64_set(&q->coord->release, 0);
+  cfg = fq_coflow_cfg_dup(q, -1);
+  if (cfg) {
+    cfg->release_grid = 0;
+    fq_coflow_cfg_publish(q, cfg);
+  }
+  return ret;
+}
+
+/* TCA_FQ_COFLOW_MAX_RATE paces member flows only : with 1 MB/s, a
+ * dequeued 1000 byte member packet (EDT, no hold) delays its flow by 1 ms,
+ * the packet of another flow leaves it unpaced.
+ */
+int testmemberrate(struct Qdisc *sch, struct fq_sched_data *q)
+{
+  const struct fq_coflow_cfg *old = rtnl_dereference(q->coflow_cfg);
+  u32 hold_min = old->hold_min, hold_max = old->hold_max;
+  u32 max_rate = old->max_rate;
+  struct sk_buff *skb[2], *probe[2], *to_free = NULL, *p;
+  struct fq_coflow_cfg *cfg;
+  struct fq_flow *f[2];
+  u64 members[nMembers], sent = 0;
+  int i, ret = 1;
+
+  fq_reset(sch);
+  cfg = fq_coflow_cfg_dup(q, -1);
+  if (!cfg) return 0;
+  cfg->hold_min = cfg->hold_max = 0;
+  cfg->max_rate = 1000000;
+  fq_coflow_cfg_publish(q, cfg);
+
+  for (i = 0; i < 2; i++) {
+    skb[i] = testudpskb(sch, false, 5001 + i);
+    probe[i] = testudpskb(sch, false, 5001 + i);
+  }
+  if (!skb[0] || !skb[1] || !probe[0] || !probe[1]) {
+    ret = 0;
+    goto out;
+  }
+  for (i = 0; i < nMembers; i++) members[i] = FQ_COFLOW_KEY_NONE;
+  members[0] = FQ_COFLOW_KEY_ORPHAN |
+               (skb_get_hash(probe[0]) & q->orphan_mask);
+  fq_coflow_members_set(q->coord, members, true);
+
+  local_bh_disable();
+  for (i = 0; i < 2; i++) {
+    qdisc_skb_cb(skb[i])->pkt_len = 1000;
+    skb[i]->tstamp = ktime_get_ns();
+    if (__fq_enqueue(skb[i], sch, &to_free) != NET_XMIT_SUCCESS) ret = 0;
+  }
+  for (i = 0; i < 2; i++) {
+    p = fq_dequeue(sch);
+    if (!p) {
+      ret = 0;
+      break;
+    }
+    if (p == skb[0]) sent = q->ktime_cache;
+    kfree_skb(p);
+  }
+  for (i = 0; i < 2; i++) f[i] = fq_classify(probe[i], q);
+  if (!sent || f[0]->time_next_packet != sent + NSEC_PER_MSEC ||
+      f[1]->time_next_packet)
+    ret = 0;
+  local_bh_enable();
+  skb[0] = skb[1] = NULL;
+
+out:
+  kfree_skb_list(to_free);
+  for (i = 0; i < 2; i++) {
+    kfree_skb(skb[i]);
+    kfree_skb(probe[i]);
+  }
+  q->coord->configured = 0;
+  fq_reset(sch);
+  cfg = fq_coflow_cfg_dup(q, -1);
+  if (cfg) {
+    cfg->hold_min = hold_min;
+    cfg->hold_max = hold_max;
+    cfg->max_rate = max_rate;
+    fq_coflow_cfg_publish(q, cfg);
+  }
+  return ret;
+}
+
+static u32 fq_coflow_tag(const struct sk_buff *skb, u8 mode);
+static void fq_coflow_tag_stamp(struct fq_sched_data *q, struct sk_buff *skb);
+
+/* Stamps a tag on a CHECKSUM_COMPLETE packet and reads it back : the tag
+ * must be there, ECN kept, and skb->csum still the sum of the packet.
+ */
+static int testtagstampone(struct Qdisc *sch, struct fq_sched_data *q,
+                           bool v6, u8 mode, u32 tag)
+{
+  struct sk_buff *skb = testudpskb(sch, v6, 5001);
+  int ret = 1;
+  u8 ecn;
+
+  if (!skb) return 0;
+  if (v6)
+    ipv6_change_dsfield(ipv6_hdr(skb), 0, INET_ECN_ECT_1);
+  else
+    ipv4_change_dsfield(ip_hdr(skb), 0, INET_ECN_ECT_1);
+  skb->ip_summed = CHECKSUM_COMPLETE;
+  skb->csum = skb_checksum(skb, 0, skb->len, 0);
+
+  q->coflow_tag = mode;
+  q->coflow_tag_stamp = tag;
+  fq_coflow_tag_stamp(q, skb);
+
+  if (fq_coflow_tag(skb, mode) != tag) ret = 0;
+  ecn = v6 ? ipv6_get_dsfield(ipv6_hdr(skb)) : ipv4_get_dsfield(ip_hdr(skb));
+  if ((ecn & INET_ECN_MASK) != INET_ECN_ECT_1) ret = 0;
+  if (!v6 && ip_fast_csum(ip_hdr(skb), ip_hdr(skb)->ihl)) ret = 0;
+  if (csum_fold(skb->csum) != csum_fold(skb_checksum(skb, 0, skb->len, 0)))
+    ret = 0;
+  kfree_skb(skb);
+  return ret;
+}
+
+int testtagstamp(struct Qdisc *sch, struct fq_sched_data *q)
+{
+  u8 mode = q->coflow_tag;
+  u32 stamp = q->coflow_tag_stamp;
+  int ret;
+
+  ret = testtagstampone(sch, q, false, FQ_COFLOW_TAG_DSCP, 46) &&
+        testtagstampone(sch, q, true, FQ_COFLOW_TAG_DSCP, 10) &&
+        testtagstampone(sch, q, true, FQ_COFLOW_TAG_FLOWLABEL, 0x12345);
+
+  q->coflow_tag = mode;
+  q->coflow_tag_stamp = stamp;
+  return ret;
+}
+
 static void testfq(struct Qdisc *sch, struct fq_sched_data *q )
 
 {
@@ -259,7 +696,7 @@ int lengthOfarray;
 
 int a;
 
-unsigned testarray1[] = {7923,7921,7922,7924,7925};
+u64 testarray1[] = {7923,7921,7922,7924,7925};
 
 lengthOfarray = 0;
 
@@ -275,7 +712,7 @@ printk("promote flows test  Passed");
 else
 printk("promote flows test  Failed");
 
-unsigned testarray2[] = {7921,7922,7923};
+u64 testarray2[] = {7921,7922,7923};
 
 lengthOfarray = 0;
 
@@ -292,7 +729,7 @@ printk("promote flows test  Passed");
 else
 printk("promote flows test  Failed");
 
-unsigned testarray3[] = {7921}; 
+u64 testarray3[] = {7921}; 
 
 lengthOfarray = 0;
 
@@ -309,7 +746,7 @@ printk("promote flows test  Passed");
 else
 printk("promote flows test  Failed");
 
-unsigned testarray4[] = {7922}; 
+u64 testarray4[] = {7922}; 
 
 lengthOfarray = 0;
 
@@ -326,7 +763,7 @@ printk("promote flows test  Passed");
 else
 printk("promote flows test  Failed");
 
-unsigned testarray5[] = {7925}; 
+u64 testarray5[] = {7925}; 
 
 lengthOfarray = 0;
 
@@ -343,7 +780,7 @@ printk("promote flows test  Passed");
 else
 printk("promote flows test  Failed");
 
-unsigned testarray6[] = {7923}; 
+u64 testarray6[] = {7923}; 
 
 lengthOfarray = 0;
 
@@ -360,7 +797,7 @@ printk("promote flows test  Passed");
 else
 printk("promote flows test  Failed");
 
-unsigned testarray7[] = {7924}; 
+u64 testarray7[] = {7924}; 
 
 lengthOfarray = 0;
 
@@ -377,7 +814,7 @@ printk("promote flows test  Passed");
 else
 printk("promote flows test  Failed");
 
-unsigned testarray8[] = {7926};
+u64 testarray8[] = {7926};
 
 lengthOfarray = 0;
 
@@ -408,6 +845,41 @@ printk("Reset Array test  Passed");
 else
 printk("Reset Arraytest Failed");
 
+if(testinferdequeue(sch, q))
+printk("Infer dequeue test  Passed");
+else
+printk("Infer dequeue test  Failed");
+
+if(testclassminor(sch, q))
+printk("Class minor test  Passed");
+else
+printk("Class minor test  Failed");
+
+if(testcctbucket())
+printk("CCT bucket test  Passed");
+else
+printk("CCT bucket test  Failed");
+
+if(testorphanrules(sch, q))
+printk("Orphan rules test  Passed");
+else
+printk("Orphan rules test  Failed");
+
+if(testreleaseorder(sch, q))
+printk("Release order test  Passed");
+else
+printk("Release order test  Failed");
+
+if(testmemberrate(sch, q))
+printk("Member rate test  Passed");
+else
+printk("Member rate test  Failed");
+
+if(testtagstamp(sch, q))
+printk("Tag stamp test  Passed");
+else
+printk("Tag stamp test  Failed");
+
 }
 
 
@@ -30,20 +30,35 @@
  *  or SLAB cache will reuse socket for another flow)
  */
 
+#include <linux/cgroup.h>
+#include <linux/debugfs.h>
 #include <linux/errno.h>
 #include <linux/hash.h>
+#include <linux/if_vlan.h>
 #include <linux/in.h>
 #include <linux/init.h>
+#include <linux/jump_label.h>
 #include <linux/jiffies.h>
 #include <linux/kernel.h>
+#include <linux/llist.h>
+#include <linux/mm.h>
 #include <linux/module.h>
+#include <linux/percpu.h>
 #include <linux/prefetch.h>
 #include <linux/rbtree.h>
+#include <linux/seq_file.h>
 #include <linux/skbuff.h>
 #include <linux/slab.h>
+#include <linux/sock_diag.h>
 #include <linux/string.h>
+#include <linux/timex.h>
 #include <linux/types.h>
+#include <linux/uaccess.h>
 #include <linux/vmalloc.h>
+#include <net/dsfield.h>
+#include <net/flow_dissector.h>
+#include <net/genetlink.h>
+#include <net/ipv6.h>
 #include <net/netlink.h>
 #include <net/pkt_sched.h>
 #include <net/sock.h>
@@ -51,6 +66,9 @@
 #include <net/tcp_states.h>
 #include "fqtest.h"
 
+#define CREATE_TRACE_POINTS
+#include "fq_coflow_trace.h"
+
 /*
  * f->tail and f->age share the same location.
  * We can use the low order bit to differentiate if this location points
@@ -103,6 +121,435 @@ static void fq_flow_set_throttled(struct fq_sched_data *q, struct fq_flow *f) {
 
 static struct kmem_cache *fq_flow_cachep __read_mostly;
 
+static struct dentry *fq_debugfs_root;
+
+enum {
+  FQ_PHASE_CLASSIFY,
+  FQ_PHASE_QUEUE_ADD,
+  FQ_PHASE_MEMBER, /* co-flow membership, barrier epoch and hold */
+  FQ_PHASE_CHECK_THROTTLED,
+  FQ_PHASE_PROMOTE,
+  FQ_PHASE_MAX
+};
+
+#ifdef FQ_PROFILE
+/*
+ * Per phase cycle histograms (make CONFIG_SCH_FQ_PROFILE=y), off until
+ * enabled through debugfs sch_fq/profile. Bucket b counts the phases that
+ * took [2^(b-1), 2^b) cycles, per cpu and for all fq instances.
+ */
+#define FQ_PROFILE_BUCKETS 32
+
+static const char *const fq_phase_names[FQ_PHASE_MAX] = {
+    [FQ_PHASE_CLASSIFY] = "classify",
+    [FQ_PHASE_QUEUE_ADD] = "queue_add",
+    [FQ_PHASE_MEMBER] = "member",
+    [FQ_PHASE_CHECK_THROTTLED] = "check_throttled",
+    [FQ_PHASE_PROMOTE] = "promote",
+};
+
+struct fq_profile {
+  u64 hist[FQ_PHASE_MAX][FQ_PROFILE_BUCKETS];
+};
+
+static DEFINE_PER_CPU(struct fq_profile, fq_profile);
+static DEFINE_STATIC_KEY_FALSE(fq_profile_on);
+
+static u64 fq_prof_start(void) {
+  return static_branch_unlikely(&fq_profile_on) ? get_cycles() : 0;
+}
+
+static void fq_prof_end(int phase, u64 t0) {
+  if (static_branch_unlikely(&fq_profile_on) && t0) {
+    u64 d = get_cycles() - t0;
+
+    this_cpu_inc(fq_profile.hist[phase][min(fls64(d), FQ_PROFILE_BUCKETS - 1)]);
+  }
+}
+#else
+static u64 fq_prof_start(void) { return 0; }
+
+static void fq_prof_end(int phase, u64 t0) {}
+#endif
+
+/* one fq_coflow_coord per device, shared by its fq instances */
+static LIST_HEAD(fq_coords);
+static DEFINE_SPINLOCK(fq_coords_lock);
+
+static struct fq_coflow_coord *fq_coord_get(struct net_device *dev) {
+  struct fq_coflow_coord *c, *n;
+
+  n = kzalloc(sizeof(*n), GFP_KERNEL);
+
+  spin_lock(&fq_coords_lock);
+  list_for_each_entry(c, &fq_coords, node) {
+    if (c->dev == dev) {
+      refcount_inc(&c->refcnt);
+      spin_unlock(&fq_coords_lock);
+      kfree(n);
+      return c;
+    }
+  }
+  if (n) {
+    n->dev = dev;
+    refcount_set(&n->refcnt, 1);
+    spin_lock_init(&n->lock);
+    fq_coflow_members_reset(n->members, nMembers);
+    list_add(&n->node, &fq_coords);
+  }
+  spin_unlock(&fq_coords_lock);
+  return n;
+}
+
+static void fq_coord_put(struct fq_coflow_coord *c) {
+  if (!c) return;
+
+  spin_lock(&fq_coords_lock);
+  if (refcount_dec_and_test(&c->refcnt)) {
+    list_del(&c->node);
+    kfree(c);
+  }
+  spin_unlock(&fq_coords_lock);
+}
+
+/*
+ * Replaces the members of every queue of the device, NULL for none. Sets
+ * made by the datapath (@configured false) never override tc's.
+ */
+static void fq_coflow_members_set(struct fq_coflow_coord *c,
+                                  const u64 *members, bool configured) {
+  int i;
+
+  spin_lock_bh(&c->lock);
+  if (configured || !c->configured) {
+    for (i = 0; i < nMembers; i++)
+      WRITE_ONCE(c->members[i], members ? members[i] : FQ_COFLOW_KEY_NONE);
+    WRITE_ONCE(c->configured, configured);
+    atomic_inc(&c->members_gen);
+  }
+  spin_unlock_bh(&c->lock);
+}
+
+/* Without tc configured members, the first flows seen on any queue of the
+ * device become the members, in free slots.
+ */
+static void fq_coflow_learn(struct fq_coflow_coord *c, u64 key) {
+  int i;
+
+  if (READ_ONCE(c->members[nMembers - 1]) != FQ_COFLOW_KEY_NONE) return;
+
+  spin_lock(&c->lock);
+  for (i = 0; i < nMembers && !c->configured; i++) {
+    if (c->members[i] == key) break;
+    if (c->members[i] == FQ_COFLOW_KEY_NONE) {
+      WRITE_ONCE(c->members[i], key);
+      break;
+    }
+  }
+  spin_unlock(&c->lock);
+}
+
+static const struct genl_multicast_group fq_coflow_mcgrps[] = {
+    {.name = FQ_COFLOW_GENL_MCGRP},
+};
+
+static struct genl_family fq_coflow_genl_family __ro_after_init = {
+    .name = FQ_COFLOW_GENL_NAME,
+    .version = FQ_COFLOW_GENL_VERSION,
+    .maxattr = FQ_COFLOW_A_MAX,
+    .netnsok = true,
+    .module = THIS_MODULE,
+    .mcgrps = fq_coflow_mcgrps,
+    .n_mcgrps = ARRAY_SIZE(fq_coflow_mcgrps),
+};
+
+/* Barriers every member has passed, on any queue */
+static u64 fq_coflow_barriers(const struct fq_coflow_coord *c) {
+  u64 done = ~0ULL;
+  int i;
+
+  for (i = 0; i < nMembers; i++)
+    done = min_t(u64, done, atomic64_read(&c->epoch[i]));
+  return done;
+}
+
+/* Dequeue of a packet of member @i : update its dequeue interval EWMA,
+ * the same 1/8 weight as unthrottle_latency_ns. Idle gaps are capped to
+ * the max hold so the estimate recovers quickly.
+ */
+static void fq_coflow_sample(struct fq_sched_data *q, int i, u64 now) {
+  struct fq_coflow_coord *c = q->coord;
+  u64 last = c->last_dequeue[i];
+  unsigned long gap, sample;
+
+  c->last_dequeue[i] = now;
+  if (!last) return;
+
+  sample = min_t(u64, now - last, q->coflow_hold_max);
+  gap = READ_ONCE(c->gap_ns[i]);
+  gap -= gap >> 3;
+  gap += sample >> 3;
+  WRITE_ONCE(c->gap_ns[i], gap);
+}
+
+/* Hold for a member packet : long enough for the slowest member to send
+ * its next packet and reach the same barrier.
+ */
+static unsigned long fq_coflow_hold(struct fq_sched_data *q) {
+  unsigned long hold = 0;
+  int i;
+
+  for (i = 0; i < nMembers; i++)
+    hold = max(hold, READ_ONCE(q->coord->gap_ns[i]));
+  if (!hold) hold = timeInterval;
+
+  hold = clamp_t(unsigned long, hold, q->coflow_hold_min, q->coflow_hold_max);
+  q->coflow_hold_ns = hold;
+  return hold;
+}
+
+/*
+ * EDT release mode : instead of a hold from now, a member packet gets the
+ * common release time of the current window, or opens the next window at
+ * the first grid point at or after its own EDT. Members queued in a window
+ * leave back to back at the same instant, and since grid points are
+ * absolute CLOCK_MONOTONIC times, applications pacing with SO_TXTIME on
+ * the same grid line up with the qdisc. skb->tstamp is rewritten so the
+ * aligned EDT also reaches offloads below. The window is the device's :
+ * queues race to open the next one with a cmpxchg, and the loser joins
+ * the winner's window when it is neither earlier than its own EDT nor
+ * more than one grid step later.
+ */
+static u64 fq_coflow_release(struct fq_sched_data *q, struct sk_buff *skb,
+                             u64 now) {
+  atomic64_t *release = &q->coord->release;
+  u64 edt = max_t(u64, fq_skb_cb(skb)->time_to_send, now);
+  u64 rel = atomic64_read(release), next, old;
+  u32 rem;
+
+  while (edt > rel) {
+    div_u64_rem(edt, q->coflow_release_grid, &rem);
+    next = rem ? edt + q->coflow_release_grid - rem : edt;
+    old = atomic64_cmpxchg(release, rel, next);
+    if (old == rel) {
+      q->coflow_release_windows++;
+      rel = next;
+      break;
+    }
+    rel = old;
+  }
+  /* a window opened far ahead (a member EDT up to the horizon) is not
+   * joined : the packet keeps its own EDT, on the grid, and the window
+   * stays as it is
+   */
+  if (rel - edt > q->coflow_release_grid) {
+    div_u64_rem(edt, q->coflow_release_grid, &rem);
+    rel = rem ? edt + q->coflow_release_grid - rem : edt;
+  }
+  q->coflow_hold_ns = rel - now;
+  skb->tstamp = rel;
+  return rel;
+}
+
+/* True (and the barrier is consumed) if all members reached the next
+ * barrier of this instance.
+ */
+static bool fq_coflow_barrier_breach(struct fq_sched_data *q) {
+  if (fq_coflow_barriers(q->coord) <= q->dcounter) return false;
+  q->dcounter++;
+  return true;
+}
+
+/* Called from the datapath, nothing is built without a listener */
+static void fq_coflow_notify(struct Qdisc *sch, u8 cmd, u64 now) {
+  struct fq_sched_data *q = qdisc_priv(sch);
+  struct fq_coflow_class *cl = &q->coflow_cl;
+  struct net *net = dev_net(qdisc_dev(sch));
+  struct sk_buff *msg;
+  void *hdr;
+
+  trace_fq_coflow_event(sch, cmd, cl->bstats.bytes - cl->start_bytes,
+                        cl->bstats.packets - cl->start_packets,
+                        cmd == FQ_COFLOW_CMD_COMPLETE ? cl->last_cct_ns : 0,
+                        q->dcounter);
+  if (!genl_has_listeners(&fq_coflow_genl_family, net, 0)) return;
+
+  msg = genlmsg_new(2 * nla_total_size(sizeof(u32)) +
+                        6 * nla_total_size_64bit(sizeof(u64)),
+                    GFP_ATOMIC);
+  if (!msg) return;
+
+  hdr = genlmsg_put(msg, 0, 0, &fq_coflow_genl_family, 0, cmd);
+  if (!hdr) goto nla_put_failure;
+
+  if (nla_put_u32(msg, FQ_COFLOW_A_IFINDEX, qdisc_dev(sch)->ifindex) ||
+      nla_put_u32(msg, FQ_COFLOW_A_HANDLE,
+                  TC_H_MAKE(sch->handle, FQ_COFLOW_MINOR)) ||
+      nla_put_u64_64bit(msg, FQ_COFLOW_A_TIME, now, FQ_COFLOW_A_PAD) ||
+      nla_put_u64_64bit(msg, FQ_COFLOW_A_BYTES,
+                        cl->bstats.bytes - cl->start_bytes, FQ_COFLOW_A_PAD) ||
+      nla_put_u64_64bit(msg, FQ_COFLOW_A_PACKETS,
+                        cl->bstats.packets - cl->start_packets,
+                        FQ_COFLOW_A_PAD) ||
+      nla_put_u64_64bit(msg, FQ_COFLOW_A_BARRIER, q->dcounter,
+                        FQ_COFLOW_A_PAD))
+    goto nla_put_failure;
+  if (cmd == FQ_COFLOW_CMD_COMPLETE &&
+      nla_put_u64_64bit(msg, FQ_COFLOW_A_CCT, cl->last_cct_ns,
+                        FQ_COFLOW_A_PAD))
+    goto nla_put_failure;
+
+  genlmsg_end(msg, hdr);
+  genlmsg_multicast_netns(&fq_coflow_genl_family, net, msg, 0, 0, GFP_ATOMIC);
+  return;
+
+nla_put_failure:
+  nlmsg_free(msg);
+}
+
+/* log2 of the completion time in us, bucket 0 below 1 us */
+static unsigned int fq_cct_bucket(u64 cct_ns) {
+  return min_t(unsigned int, fls64(div_u64(cct_ns, NSEC_PER_USEC)),
+               FQ_CCT_BUCKETS - 1);
+}
+
+/* Forgets the co-flow in progress, the counters stay */
+static void fq_coflow_class_clear(struct fq_coflow_class *cl) {
+  cl->qstats.backlog = 0;
+  cl->qlen = 0;
+  cl->start = 0;
+  cl->start_bytes = 0;
+  cl->start_packets = 0;
+  cl->timed_out = 0;
+}
+
+/* A queued member packet dropped by fq_change() : neither sent nor part of
+ * a completion time.
+ */
+static void fq_coflow_class_drop(struct fq_coflow_class *cl,
+                                 const struct sk_buff *skb) {
+  if (!cl->qlen) return;
+
+  cl->qstats.drops++;
+  cl->qstats.backlog -= min_t(u32, cl->qstats.backlog, qdisc_pkt_len(skb));
+  if (!--cl->qlen) cl->start = 0;
+}
+
+/* Applies a newly published configuration, datapath only */
+static void fq_coflow_cfg_sync(struct fq_sched_data *q) {
+  const struct fq_coflow_cfg *cfg = rcu_dereference_bh(q->coflow_cfg);
+  u32 members_gen = atomic_read(&q->coord->members_gen);
+
+  if (unlikely(members_gen != q->coflow_members_gen)) {
+    q->coflow_members_gen = members_gen;
+    /* packets of the previous members are no longer the co-flow's */
+    fq_coflow_class_clear(&q->coflow_cl);
+  }
+  if (likely(cfg->gen == q->coflow_cfg_gen)) return;
+
+  q->coflow_cfg_gen = cfg->gen;
+  q->coflow_hold_min = cfg->hold_min;
+  q->coflow_hold_max = cfg->hold_max;
+  q->coflow_release_grid = cfg->release_grid;
+  q->coflow_max_rate = cfg->max_rate == ~0U ? ~0UL : cfg->max_rate;
+  q->coflow_tag = cfg->tag;
+  q->coflow_tag_stamp = cfg->tag_stamp;
+  if (q->coflow_infer_window != cfg->infer_window ||
+      q->coflow_infer_port_shift != cfg->infer_port_shift) {
+    /* groups formed under other rules start over */
+    memset(q->infer, 0, sizeof(q->infer));
+    q->infer_elected = NULL;
+    q->coflow_infer_window = cfg->infer_window;
+    q->coflow_infer_port_shift = cfg->infer_port_shift;
+  }
+}
+
+/* Copy of the current configuration for a writer to change, under RTNL.
+ * nrules < 0 keeps the rules, otherwise the table is sized for nrules and
+ * left for the caller to fill.
+ */
+static struct fq_coflow_cfg *fq_coflow_cfg_dup(struct fq_sched_data *q,
+                                               int nrules) {
+  const struct fq_coflow_cfg *old = rtnl_dereference(q->coflow_cfg);
+  struct fq_coflow_cfg *cfg;
+
+  if (nrules < 0) nrules = old->nrules;
+  cfg = kzalloc(struct_size(cfg, rules, nrules), GFP_KERNEL);
+  if (!cfg) return NULL;
+
+  memcpy(cfg, old, offsetof(struct fq_coflow_cfg, rules));
+  if (nrules == old->nrules)
+    memcpy(cfg->rules, old->rules, nrules * sizeof(cfg->rules[0]));
+  cfg->nrules = nrules;
+  cfg->gen = old->gen + 1;
+  return cfg;
+}
+
+static void fq_coflow_cfg_publish(struct fq_sched_data *q,
+                                  struct fq_coflow_cfg *cfg) {
+  struct fq_coflow_cfg *old = rtnl_dereference(q->coflow_cfg);
+
+  rcu_assign_pointer(q->coflow_cfg, cfg);
+  kfree_rcu(old, rcu);
+}
+
+/* Members as configured, or as learnt by the datapath, for the class ops */
+static const u64 *fq_class_members(struct fq_sched_data *q) {
+  return q->coord->members;
+}
+
+static bool fq_class_present(struct fq_sched_data *q) {
+  const u64 *members = fq_class_members(q);
+  int i;
+
+  for (i = 0; i < nMembers; i++)
+    if (READ_ONCE(members[i]) != FQ_COFLOW_KEY_NONE) return true;
+  return false;
+}
+
+static void fq_coflow_class_enqueue(struct Qdisc *sch,
+                                    const struct sk_buff *skb, u64 now) {
+  struct fq_sched_data *q = qdisc_priv(sch);
+  struct fq_coflow_class *cl = &q->coflow_cl;
+
+  cl->qstats.backlog += qdisc_pkt_len(skb);
+  if (cl->qlen++) return;
+
+  cl->start = now;
+  cl->start_bytes = cl->bstats.bytes;
+  cl->start_packets = cl->bstats.packets;
+  fq_coflow_notify(sch, FQ_COFLOW_CMD_ADMIT, now);
+}
+
+static void fq_coflow_class_dequeue(struct Qdisc *sch, struct sk_buff *skb,
+                                    u64 now) {
+  struct fq_sched_data *q = qdisc_priv(sch);
+  struct fq_coflow_class *cl = &q->coflow_cl;
+
+  bstats_update(&cl->bstats, skb);
+
+  /* hold expired while another member is still short of the barrier,
+   * reported once per barrier
+   */
+  if (fq_coflow_barriers(q->coord) <= q->dcounter &&
+      cl->timed_out != q->dcounter + 1) {
+    cl->timed_out = q->dcounter + 1;
+    fq_coflow_notify(sch, FQ_COFLOW_CMD_TIMEOUT, now);
+  }
+
+  /* members changed under queued packets, they were not counted */
+  if (!cl->qlen) return;
+
+  cl->qstats.backlog -= min_t(u32, cl->qstats.backlog, qdisc_pkt_len(skb));
+  if (--cl->qlen) return;
+
+  cl->last_cct_ns = now - cl->start;
+  cl->completions++;
+  cl->cct_sum_ns += cl->last_cct_ns;
+  cl->cct_hist[fq_cct_bucket(cl->last_cct_ns)]++;
+  fq_coflow_notify(sch, FQ_COFLOW_CMD_COMPLETE, now);
+}
+
 /* limit number of collected flows per round */
 #define FQ_GC_MAX 8
 #define FQ_GC_AGE (3 * HZ)
@@ -150,16 +597,237 @@ static void fq_gc(struct fq_sched_data *q, struct rb_root *root,
   kmem_cache_free_bulk(fq_flow_cachep, fcnt, tofree);
 }
 
+/* Socket cookie, generated on first use : __sock_gen_cookie() is not
+ * exported, sock_diag_save_cookie() wraps it.
+ */
+static u64 fq_sk_cookie(struct sock *sk) {
+  u64 cookie = atomic64_read(&sk->sk_cookie);
+  u32 c[2];
+
+  if (likely(cookie)) return cookie;
+  sock_diag_save_cookie(sk, c);
+  return (u64)c[1] << 32 | c[0];
+}
+
+static bool fq_coflow_rule_match(const struct tc_fq_coflow_rule *r,
+                                  const struct sk_buff *skb,
+                                  struct flow_keys *keys, bool *dissected) {
+  if ((skb->mark ^ r->mark) & r->mark_mask) return false;
+  if (!r->family && !r->proto && !r->sport && !r->dport) return true;
+
+  if (!*dissected) {
+    memset(keys, 0, sizeof(*keys));
+    skb_flow_dissect_flow_keys(skb, keys, 0);
+    *dissected = true;
+  }
+  if (r->proto && r->proto != keys->basic.ip_proto) return false;
+  if (r->sport && r->sport != keys->ports.src) return false;
+  if (r->dport && r->dport != keys->ports.dst) return false;
+
+  switch (r->family) {
+    case AF_INET:
+      if (keys->control.addr_type != FLOW_DISSECTOR_KEY_IPV4_ADDRS)
+        return false;
+      return (!r->saddr[0] || r->saddr[0] == keys->addrs.v4addrs.src) &&
+             (!r->daddr[0] || r->daddr[0] == keys->addrs.v4addrs.dst);
+    case AF_INET6:
+      if (keys->control.addr_type != FLOW_DISSECTOR_KEY_IPV6_ADDRS)
+        return false;
+      return (ipv6_addr_any((const struct in6_addr *)r->saddr) ||
+              !memcmp(r->saddr, &keys->addrs.v6addrs.src, 16)) &&
+             (ipv6_addr_any((const struct in6_addr *)r->daddr) ||
+              !memcmp(r->daddr, &keys->addrs.v6addrs.dst, 16));
+  }
+  return true;
+}
+
+/* Co-flow tag carried by an orphan packet, 0 if none */
+static u32 fq_coflow_tag(const struct sk_buff *skb, u8 mode) {
+  int off = skb_network_offset(skb);
+
+  switch (skb_protocol(skb, true)) {
+    case htons(ETH_P_IP): {
+      const struct iphdr *iph;
+      struct iphdr _iph;
+
+      if (mode != FQ_COFLOW_TAG_DSCP) return 0;
+      iph = skb_header_pointer(skb, off, sizeof(_iph), &_iph);
+      return iph ? ipv4_get_dsfield(iph) >> 2 : 0;
+    }
+    case htons(ETH_P_IPV6): {
+      const struct ipv6hdr *ip6h;
+      struct ipv6hdr _ip6h;
+
+      ip6h = skb_header_pointer(skb, off, sizeof(_ip6h), &_ip6h);
+      if (!ip6h) return 0;
+      if (mode == FQ_COFLOW_TAG_DSCP) return ipv6_get_dsfield(ip6h) >> 2;
+      return be32_to_cpu(ip6_flowlabel(ip6h));
+    }
+  }
+  return 0;
+}
+
+/* Writes the configured tag on a member packet, for the next hops. The
+ * rewritten bytes go out of and back into skb->csum, which a
+ * CHECKSUM_COMPLETE skb (IFB ingress) still carries.
+ */
+static void fq_coflow_tag_stamp(struct fq_sched_data *q, struct sk_buff *skb) {
+  int off = skb_network_offset(skb);
+  u32 tag = q->coflow_tag_stamp;
+  struct iphdr *iph;
+  __be32 *flowinfo;
+
+  switch (skb_protocol(skb, true)) {
+    case htons(ETH_P_IP):
+      if (q->coflow_tag != FQ_COFLOW_TAG_DSCP ||
+          skb_ensure_writable(skb, off + sizeof(struct iphdr)))
+        return;
+      iph = ip_hdr(skb);
+      skb_postpull_rcsum(skb, iph, sizeof(*iph));
+      ipv4_change_dsfield(iph, INET_ECN_MASK, tag << 2);
+      skb_postpush_rcsum(skb, iph, sizeof(*iph));
+      break;
+    case htons(ETH_P_IPV6):
+      if (skb_ensure_writable(skb, off + sizeof(struct ipv6hdr))) return;
+      /* version, DS field and flow label share the first word */
+      flowinfo = (__be32 *)ipv6_hdr(skb);
+      skb_postpull_rcsum(skb, flowinfo, sizeof(*flowinfo));
+      if (q->coflow_tag == FQ_COFLOW_TAG_DSCP)
+        ipv6_change_dsfield(ipv6_hdr(skb), INET_ECN_MASK, tag << 2);
+      else
+        *flowinfo = (*flowinfo & ~IPV6_FLOWLABEL_MASK) | cpu_to_be32(tag);
+      skb_postpush_rcsum(skb, flowinfo, sizeof(*flowinfo));
+      break;
+  }
+}
+
+/*
+ * Orphan co-flow table : a packet without a usable socket matching a rule
+ * goes to the flow of the first rule carrying the same key, whose
+ * synthetic socket is an odd pointer at the top of the address space,
+ * clear of both word aligned sockets and (hash << 1) | 1 orphans. The
+ * table is bounded by FQ_COFLOW_RULES_MAX, whatever orphan_mask is.
+ * Otherwise a tagged packet keeps its orphan flow, named by its tag.
+ */
+static struct sock *fq_coflow_orphan(struct fq_sched_data *q,
+                                     const struct sk_buff *skb,
+                                     struct sock *sk, u64 *key) {
+  const struct fq_coflow_cfg *cfg = rcu_dereference_bh(q->coflow_cfg);
+  struct flow_keys keys;
+  bool dissected = false;
+  int i, j;
+
+  for (i = 0; i < cfg->nrules; i++) {
+    if (!fq_coflow_rule_match(&cfg->rules[i], skb, &keys, &dissected))
+      continue;
+
+    *key = cfg->rules[i].key;
+    for (j = 0; cfg->rules[j].key != *key; j++)
+      ;
+    return (struct sock *)(~0UL - 2UL * j);
+  }
+
+  if (cfg->tag) {
+    u32 tag = fq_coflow_tag(skb, cfg->tag);
+
+    if (tag) *key = FQ_COFLOW_KEY_TAG | tag;
+  }
+  return sk;
+}
+
+/* cgroup v2 id of a socket, 0 when unknown */
+static u64 fq_sk_cgroup(struct sock *sk) {
+#ifdef CONFIG_SOCK_CGROUP_DATA
+  struct cgroup *cgrp;
+
+  if (!sk_fullsock(sk)) return 0;
+  cgrp = sock_cgroup_ptr(&sk->sk_cgrp_data);
+  if (cgrp) return cgroup_id(cgrp);
+#endif
+  return 0;
+}
+
+/* Confidence that a flow starting now belongs to g, 0 if it does not */
+static u32 fq_infer_match(const struct fq_infer_group *g, u64 cgroup,
+                          u16 dport) {
+  u32 conf = 30; /* started within the window */
+
+  if (cgroup && cgroup == g->cgroup) conf += 40;
+  if (dport == g->dport) conf += 30;
+  return conf > 30 ? conf : 0;
+}
+
+/*
+ * Places a new socket flow in the inference table. Without configured
+ * members, the first group of nMembers flows or more reaching
+ * FQ_INFER_ELECT becomes the co-flow, and a more confident group replaces
+ * it while the class is idle. With configured members, the joins are only
+ * scored against them : the joiner and the group's first flow are either
+ * both members (hit) or one is not (miss).
+ */
+static void fq_coflow_infer(struct fq_sched_data *q, struct sock *sk,
+                            u64 key) {
+  u16 dport = ntohs(sk->sk_dport) >> q->coflow_infer_port_shift;
+  u64 now = ktime_get_ns(), cgroup = fq_sk_cgroup(sk);
+  struct fq_infer_group *g, *victim = q->infer;
+  int in, first_in, i;
+  u32 conf = 0;
+
+  for (g = q->infer; g < q->infer + FQ_INFER_GROUPS; g++) {
+    if (g->last_ns < victim->last_ns) victim = g;
+    if (!g->nflows || now - g->last_ns > q->coflow_infer_window) continue;
+    conf = fq_infer_match(g, cgroup, dport);
+    if (conf) break;
+  }
+
+  if (!conf) {
+    g = victim;
+    if (g == q->infer_elected) q->infer_elected = NULL;
+    g->cgroup = cgroup;
+    g->dport = dport;
+    g->last_ns = now;
+    g->confidence = 0;
+    g->nflows = 1;
+    g->keys[0] = key;
+    for (i = 1; i < nMembers; i++) g->keys[i] = FQ_COFLOW_KEY_NONE;
+    return;
+  }
+
+  g->last_ns = now;
+  g->confidence = (g->confidence * (g->nflows - 1) + conf) / g->nflows;
+  if (g->nflows < nMembers) g->keys[g->nflows] = key;
+  if (g->nflows < U16_MAX) g->nflows++;
+  q->infer_joins++;
+
+  if (READ_ONCE(q->coord->configured)) {
+    const u64 *members = q->coord->members;
+
+    in = fq_coflow_member(members, nMembers, key) != -1;
+    first_in = fq_coflow_member(members, nMembers, g->keys[0]) != -1;
+    if (in && first_in)
+      q->infer_hits++;
+    else if (in || first_in)
+      q->infer_misses++;
+    return;
+  }
+
+  if (g->nflows < nMembers || g->confidence < FQ_INFER_ELECT ||
+      g == q->infer_elected || q->coflow_cl.qlen)
+    return;
+  if (q->infer_elected && q->infer_elected->confidence >= g->confidence)
+    return;
+
+  q->infer_elected = g;
+  fq_coflow_members_set(q->coord, g->keys, false);
+}
+
 static struct fq_flow *fq_classify(struct sk_buff *skb,
                                    struct fq_sched_data *q) {
   struct rb_node **p, *parent;
   struct sock *sk = skb->sk;
   struct rb_root *root;
   struct fq_flow *f;
-
-  // printk("In add values address pair is  : %lld \n ", sk->sk_portpair);
-  // printk("In add values destination port is  : %lld \n ", sk->sk_dport);
-  // printk("In add values hash pair is  : %d \n ", skb_get_hash(skb));
+  u64 key = 0;
 
   /* warning: no starvation prevention... */
   if (unlikely((skb->priority & TC_PRIO_MAX) == TC_PRIO_CONTROL))
@@ -181,15 +849,12 @@ static struct fq_flow *fq_classify(struct sk_buff *skb,
      * collide with a local flow (socket pointers are word aligned)
      */
     sk = (struct sock *)((hash << 1) | 1UL);
-
-    // printk("hash value in fq classify  after sk creation : %lu \n ", hash );
-
+    key = FQ_COFLOW_KEY_ORPHAN | hash;
+    sk = fq_coflow_orphan(q, skb, sk, &key);
     skb_orphan(skb);
   } else if (sk->sk_state == TCP_CLOSE) {
     unsigned long hash = skb_get_hash(skb) & q->orphan_mask;
 
-    // printk("hash  value in fq classify in else if  of each flow is  : %lu \n
-    // ",hash );
     /*
      * Sockets in TCP_CLOSE are non connected.
      * Typical use case is UDP sockets, they can send packets
@@ -199,6 +864,8 @@ static struct fq_flow *fq_classify(struct sk_buff *skb,
      * if we care enough.
      */
     sk = (struct sock *)((hash << 1) | 1UL);
+    key = FQ_COFLOW_KEY_ORPHAN | hash;
+    sk = fq_coflow_orphan(q, skb, sk, &key);
   }
 
   root = &q->fq_root[hash_ptr(sk, q->fq_trees_log)];
@@ -214,51 +881,22 @@ static struct fq_flow *fq_classify(struct sk_buff *skb,
     f = rb_entry(parent, struct fq_flow, fq_node);
     if (f->sk == sk) {
       /* socket might have been reallocated, so check
-       * if its sk_hash is the same.
+       * if its cookie is the same (sk_hash can be).
        * It not, we need to refill credit with
        * initial quantum
        */
-      int lengthOfarray = 0;
-
-      int i;
-
-      for (i = 0; i < (sizeof(pFlowid) / sizeof(pFlowid[0])); i++) {
-        lengthOfarray++;
-      }
-      if (unlikely(skb->sk == sk && f->socket_hash != sk->sk_hash)) {
+      if (unlikely(skb->sk == sk && f->key != fq_sk_cookie(sk))) {
         f->credit = q->initial_quantum;
         f->socket_hash = sk->sk_hash;
-        // printk("flow hash in rb tree value of each flow is  : %u \n
-        // ",f->socket_hash );
-        /*if ((pFlowid[0] == -1) && (pFlowid[1] == -1)) {
-          pFlowid[0] = f->socket_hash;
-          printk(
-              "flow pflowid 0 hash in rb tree value of each flow is  : %u \n ",
-              pFlowid[0]);
-          if (pFlowid[0] == 0) {
-            resetFlowid(pFlowid, lengthOfarray);
-          }
-        }
-
-        if ((pFlowid[0] != -1) && (pFlowid[1] == -1)) {
-          int lVal =
-              valuePresentInArray(f->socket_hash, pFlowid, lengthOfarray);
-
-          if (pFlowid[0] != f->socket_hash) pFlowid[1] = f->socket_hash;
-
-          printk(
-              "flow pflowid 1 hash in rb tree value of each flow is  : %u \n ",
-              pFlowid[1]);
-
-          if ((pFlowid[1] == 0)) {
-            resetFlowid(pFlowid, lengthOfarray);
-          }
-        }*/
-
+        f->key = fq_sk_cookie(sk);
+        if (q->coflow_infer_window) fq_coflow_infer(q, sk, f->key);
         if (q->rate_enable)
           smp_store_release(&sk->sk_pacing_status, SK_PACING_FQ);
         if (fq_flow_is_throttled(f)) fq_flow_unset_throttled(q, f);
         f->time_next_packet = 0ULL;
+      } else if (unlikely(skb->sk != sk && f->key != key)) {
+        /* rule table changed under an orphan co-flow */
+        f->key = key;
       }
       return f;
     }
@@ -279,7 +917,11 @@ static struct fq_flow *fq_classify(struct sk_buff *skb,
   f->sk = sk;
   if (skb->sk == sk) {
     f->socket_hash = sk->sk_hash;
+    f->key = fq_sk_cookie(sk);
+    if (q->coflow_infer_window) fq_coflow_infer(q, sk, f->key);
     if (q->rate_enable) smp_store_release(&sk->sk_pacing_status, SK_PACING_FQ);
+  } else {
+    f->key = key;
   }
   f->credit = q->initial_quantum;
 
@@ -288,7 +930,6 @@ static struct fq_flow *fq_classify(struct sk_buff *skb,
 
   q->flows++;
   q->inactive_flows++;
-  // printk("flow hash in after classification  : %u \n ",f->socket_hash );
   return f;
 }
 
@@ -326,6 +967,40 @@ static void fq_dequeue_skb(struct Qdisc *sch, struct fq_flow *flow,
   sch->q.qlen--;
 }
 
+/* Single producer, the qdisc lock (or seqlock) serialises dequeues */
+static void fq_ring_log(struct fq_sched_data *q, const struct fq_flow *f,
+                        const struct sk_buff *skb, u8 list, int member,
+                        u64 now, u32 qlen) {
+  struct fq_ring_hdr *r = q->ring;
+  struct fq_ring_ev *ev;
+  u64 head;
+
+  if (!r) return;
+
+  head = r->head;
+  ev = (struct fq_ring_ev *)(r + 1) + (head & (r->size - 1));
+  ev->tstamp = now;
+  ev->key = f->key;
+  ev->len = qdisc_pkt_len(skb);
+  ev->member = member;
+  ev->list = list;
+  ev->qlen = qlen;
+  smp_store_release(&r->head, head + 1);
+}
+
+static struct fq_ring_hdr *fq_ring_alloc(u32 log) {
+  struct fq_ring_hdr *r;
+
+  r = vmalloc_user(sizeof(*r) + (sizeof(struct fq_ring_ev) << log));
+  if (!r) return NULL;
+
+  r->magic = FQ_RING_MAGIC;
+  r->version = FQ_RING_VERSION;
+  r->size = 1U << log;
+  r->ev_size = sizeof(struct fq_ring_ev);
+  return r;
+}
+
 static void flow_queue_add(struct fq_flow *flow, struct sk_buff *skb) {
   struct rb_node **p, *parent;
   struct sk_buff *head, *aux;
@@ -364,12 +1039,27 @@ static bool fq_packet_beyond_horizon(const struct sk_buff *skb,
   return unlikely((s64)skb->tstamp > (s64)(q->ktime_cache + q->horizon));
 }
 
-static int fq_enqueue(struct sk_buff *skb, struct Qdisc *sch,
-                      struct sk_buff **to_free) {
+/* Staged skbs are accounted per cpu, and tc only reads those counters */
+static int fq_qdisc_drop(struct sk_buff *skb, struct Qdisc *sch,
+                         struct sk_buff **to_free) {
+#ifdef FQ_STAGING
+  return qdisc_drop_cpu(skb, sch, to_free);
+#else
+  return qdisc_drop(skb, sch, to_free);
+#endif
+}
+
+static int __fq_enqueue(struct sk_buff *skb, struct Qdisc *sch,
+                        struct sk_buff **to_free) {
   struct fq_sched_data *q = qdisc_priv(sch);
   struct fq_flow *f;
+  int pValue;
+  u64 t0;
 
-  if (unlikely(sch->q.qlen >= sch->limit)) return qdisc_drop(skb, sch, to_free);
+  fq_coflow_cfg_sync(q);
+
+  if (unlikely(sch->q.qlen >= sch->limit))
+    return fq_qdisc_drop(skb, sch, to_free);
 
   if (!skb->tstamp) {
     fq_skb_cb(skb)->time_to_send = q->ktime_cache = ktime_get_ns();
@@ -385,7 +1075,7 @@ static int fq_enqueue(struct sk_buff *skb, struct Qdisc *sch,
       if (fq_packet_beyond_horizon(skb, q)) {
         if (q->horizon_drop) {
           q->stat_horizon_drops++;
-          return qdisc_drop(skb, sch, to_free);
+          return fq_qdisc_drop(skb, sch, to_free);
         }
         q->stat_horizon_caps++;
         skb->tstamp = q->ktime_cache + q->horizon;
@@ -394,60 +1084,32 @@ static int fq_enqueue(struct sk_buff *skb, struct Qdisc *sch,
     fq_skb_cb(skb)->time_to_send = skb->tstamp;
   }
 
+  t0 = fq_prof_start();
   f = fq_classify(skb, q);
+  fq_prof_end(FQ_PHASE_CLASSIFY, t0);
   if (unlikely(f->qlen >= q->flow_plimit && f != &q->internal)) {
     q->stat_flows_plimit++;
-    return qdisc_drop(skb, sch, to_free);
+    if (fq_coflow_member(q->coord->members, nMembers, f->key) != -1)
+      q->coflow_cl.qstats.drops++;
+    return fq_qdisc_drop(skb, sch, to_free);
   }
 
   f->qlen++;
   qdisc_qstats_backlog_inc(sch, skb);
   if (fq_flow_is_detached(f)) {
     fq_flow_add_tail(&q->new_flows, f);
-    
-    int lengthOfarray = 0;
-
-    int i;
-
-      for (i = 0; i < (sizeof(pFlowid) / sizeof(pFlowid[0])); i++) {
-        lengthOfarray++;
-      }
-      
-         if ((pFlowid[0] == -1) && (pFlowid[1] == -1)) {
-          pFlowid[0] = f->socket_hash;
-          printk(
-              "flow pflowid 0 hash in rb tree value of each flow is  : %u \n ",
-              pFlowid[0]);
-        }
-
-        if ((pFlowid[0] != -1) && (pFlowid[1] == -1)) {
-          int lVal =
-              valuePresentInArray(f->socket_hash, pFlowid, lengthOfarray);
 
-          if (pFlowid[0] != f->socket_hash) pFlowid[1] = f->socket_hash;
-
-          printk(
-              "flow pflowid 1 hash in rb tree value of each flow is  : %u \n ",
-              pFlowid[1]);
-        }
+    /* members set through tc class change are not learnt, inferred
+     * ones come from fq_coflow_infer()
+     */
+    if (!READ_ONCE(q->coord->configured) && !q->coflow_infer_window)
+      fq_coflow_learn(q->coord, f->key);
 
     if (time_after(jiffies, f->age + q->flow_refill_delay))
       f->credit = max_t(u32, f->credit, q->quantum);
     q->inactive_flows--;
   }
 
-  /* Note: this overwrites f->age */
-
-  // printk("hash of flow value : %u \n ", (f->socket_hash & q->orphan_mask) );
-
-  /*printk("skb get hash value  : %u \n ", skb_get_hash(skb));
-
-     unsigned long pHash = skb_get_hash(skb) & q->orphan_mask;
-
-     printk("pHash value  : %lu \n ", pHash); */
-
-  flow_queue_add(f, skb);
-
   /*
 
      setting the barrier bits
@@ -459,23 +1121,32 @@ static int fq_enqueue(struct sk_buff *skb, struct Qdisc *sch,
 
    */
 
-  int lengthOfarray = 0;
-
-  int i;
-
-  for (i = 0; i < (sizeof(pFlowid) / sizeof(pFlowid[0])); i++) {
-    lengthOfarray++;
-  }
-  int pValue = valuePresentInArray(f->socket_hash, pFlowid, lengthOfarray);
+  t0 = fq_prof_start();
+  pValue = fq_coflow_member(q->coord->members, nMembers, f->key);
 
+  /* time_to_send orders the flow's tail list and t_root : it is final
+   * before flow_queue_add()
+   */
   if (pValue != -1) {
-    barrier[barriercounter_flow[pValue]] =
-        barrier[barriercounter_flow[pValue]] | 1 << pValue;
+    u64 now = ktime_get_ns();
 
-    fq_skb_cb(skb)->time_to_send = ktime_get_ns() + timeInterval;
+    atomic64_inc(&q->coord->epoch[pValue]);
 
-    barriercounter_flow[pValue]++;
+    if (q->coflow_release_grid)
+      fq_skb_cb(skb)->time_to_send = fq_coflow_release(q, skb, now);
+    else
+      fq_skb_cb(skb)->time_to_send = now + fq_coflow_hold(q);
+    if (q->coflow_tag_stamp) fq_coflow_tag_stamp(q, skb);
+    fq_coflow_class_enqueue(sch, skb, now);
+    trace_fq_coflow_enqueue(sch, f->key, pValue, qdisc_pkt_len(skb),
+                            q->coflow_hold_ns, q->coflow_cl.qlen);
   }
+  fq_prof_end(FQ_PHASE_MEMBER, t0);
+
+  /* Note: this overwrites f->age */
+  t0 = fq_prof_start();
+  flow_queue_add(f, skb);
+  fq_prof_end(FQ_PHASE_QUEUE_ADD, t0);
 
   if (unlikely(f == &q->internal)) {
     q->stat_internal_packets++;
@@ -485,6 +1156,111 @@ static int fq_enqueue(struct sk_buff *skb, struct Qdisc *sch,
   return NET_XMIT_SUCCESS;
 }
 
+#ifdef FQ_STAGING
+/*
+ * The qdisc runs TCQ_F_NOLOCK : enqueue takes no lock at all, the skb is
+ * pushed on this cpu's llist (skb->next is the first member of sk_buff,
+ * it doubles as the llist_node). Everything else (classification, co-flow
+ * barriers, RR lists) only runs on the dequeue side, under sch->seqlock.
+ * sch->q.qlen and sch->qstats then count merged packets only, tc sees
+ * the per cpu stats.
+ */
+static int fq_enqueue(struct sk_buff *skb, struct Qdisc *sch,
+                      struct sk_buff **to_free) {
+  struct fq_sched_data *q = qdisc_priv(sch);
+  struct fq_stage *s = this_cpu_ptr(q->stage);
+  unsigned int pkt_len = qdisc_pkt_len(skb);
+
+  if (unlikely(s->staged - READ_ONCE(s->merged) >= FQ_STAGE_LIMIT))
+    return qdisc_drop_cpu(skb, sch, to_free);
+
+  s->staged++;
+  if (llist_add((struct llist_node *)skb, &s->skbs))
+    cpumask_set_cpu(smp_processor_id(), q->stage_mask);
+  qdisc_update_stats_at_enqueue(sch, pkt_len);
+  return NET_XMIT_SUCCESS;
+}
+
+/* Drains the staged skbs of every cpu into the scheduler, oldest first */
+static void fq_stage_merge(struct Qdisc *sch) {
+  struct fq_sched_data *q = qdisc_priv(sch);
+  struct sk_buff *to_free = NULL;
+  int cpu;
+
+  for_each_cpu(cpu, q->stage_mask) {
+    struct fq_stage *s = per_cpu_ptr(q->stage, cpu);
+    struct llist_node *batch;
+    u32 n = 0;
+
+    /* clear first : a push that finds the list empty sets it again */
+    cpumask_clear_cpu(cpu, q->stage_mask);
+    smp_mb__after_atomic();
+    batch = llist_reverse_order(llist_del_all(&s->skbs));
+
+    while (batch) {
+      struct sk_buff *skb = (struct sk_buff *)batch;
+
+      batch = batch->next;
+      n++;
+      if (__fq_enqueue(skb, sch, &to_free) != NET_XMIT_SUCCESS) {
+        qdisc_qstats_cpu_backlog_dec(sch, skb);
+        qdisc_qstats_cpu_qlen_dec(sch);
+      }
+    }
+    WRITE_ONCE(s->merged, s->merged + n);
+  }
+  if (to_free) kfree_skb_list(to_free);
+}
+
+static void fq_stage_purge(struct Qdisc *sch) {
+  struct fq_sched_data *q = qdisc_priv(sch);
+  int cpu;
+
+  if (!q->stage) return;
+
+  for_each_possible_cpu(cpu) {
+    struct fq_stage *s = per_cpu_ptr(q->stage, cpu);
+    struct gnet_stats_queue *qs = per_cpu_ptr(sch->cpu_qstats, cpu);
+    struct llist_node *batch = llist_del_all(&s->skbs);
+
+    while (batch) {
+      struct sk_buff *skb = (struct sk_buff *)batch;
+
+      batch = batch->next;
+      rtnl_kfree_skbs(skb, skb);
+    }
+    s->staged = s->merged = 0;
+    qs->backlog = 0;
+    qs->qlen = 0;
+  }
+  cpumask_clear(q->stage_mask);
+}
+
+/* fq_change() and friends must also exclude the (lockless) dequeue side */
+static void fq_tree_lock(struct Qdisc *sch) {
+  sch_tree_lock(sch);
+  spin_lock(&sch->seqlock);
+}
+
+static void fq_tree_unlock(struct Qdisc *sch) {
+  spin_unlock(&sch->seqlock);
+  sch_tree_unlock(sch);
+}
+#else
+static int fq_enqueue(struct sk_buff *skb, struct Qdisc *sch,
+                      struct sk_buff **to_free) {
+  return __fq_enqueue(skb, sch, to_free);
+}
+
+static void fq_stage_merge(struct Qdisc *sch) {}
+
+static void fq_stage_purge(struct Qdisc *sch) {}
+
+static void fq_tree_lock(struct Qdisc *sch) { sch_tree_lock(sch); }
+
+static void fq_tree_unlock(struct Qdisc *sch) { sch_tree_unlock(sch); }
+#endif
+
 static void fq_check_throttled(struct fq_sched_data *q, u64 now) {
   unsigned long sample;
   struct rb_node *p;
@@ -516,28 +1292,32 @@ static struct sk_buff *fq_dequeue(struct Qdisc *sch) {
   struct sk_buff *skb;
   struct fq_flow *f, *coflow;
   unsigned long rate;
-  int dcounter = 0;
+  int rValue;
   u32 plen;
-  u64 now;
-  pFlowid[0] = 3;
-  pFlowid[1] = 5;
+  u64 now, t0;
 
+  fq_coflow_cfg_sync(q);
+  fq_stage_merge(sch);
   if (!sch->q.qlen) return NULL;
 
   skb = fq_peek(&q->internal);
   if (unlikely(skb)) {
     fq_dequeue_skb(sch, &q->internal, skb);
+    if (q->ring)
+      fq_ring_log(q, &q->internal, skb, FQ_LIST_INTERNAL, -1, ktime_get_ns(),
+                  sch->q.qlen);
     goto out;
   }
 
   q->ktime_cache = now = ktime_get_ns();
+  t0 = fq_prof_start();
   fq_check_throttled(q, now);
+  fq_prof_end(FQ_PHASE_CHECK_THROTTLED, t0);
 
   /*dequeuing using barrier process*/
 
 begin:
   head = &q->co_flows;
-  // printk("adding In co-flow \n");
   if (!head->first) {
     head = &q->new_flows;
     if (!head->first) {
@@ -552,34 +1332,17 @@ begin:
   }
 
   f = head->first;
-
-  int lengthOfarray = 0;
-
-  int i;
-
-  for (i = 0; i < (sizeof(pFlowid) / sizeof(pFlowid[0])); i++) {
-    lengthOfarray++;
-  }
-
-  int rValue = valuePresentInArray(f->socket_hash, pFlowid, lengthOfarray);
-
-  //printk("rValue is   : %d \n ", rValue);
-
-  // printk("barrier value  : %d \n ", barrier[dcounter]);
+  rValue = fq_coflow_member(q->coord->members, nMembers, f->key);
 
   // Breach and membership of the flow is checked once it is satisfied all the
   // flows are added to co-flow set at once
-  if ((rValue != -1) && (barrier[dcounter] == 3)) {
-    printk("Breach Occured \n");
-    barrier[dcounter] = 0;
+  if ((rValue != -1) && fq_coflow_barrier_breach(q)) {
     head->first = f->next;
-    printk("adding all co-flows together \n");
+    t0 = fq_prof_start();
     Promotecoflows(&q->old_flows, &q->new_flows, &q->co_flows, f, coflow,
-                   pFlowid, lengthOfarray);
-  }
-
-  if (!barrier[dcounter]) {
-    dcounter++;
+                   q->coord->members, nMembers);
+    fq_prof_end(FQ_PHASE_PROMOTE, t0);
+    fq_coflow_notify(sch, FQ_COFLOW_CMD_PROMOTE, now);
   }
 
   /*demotion is defualt and we need not use any specific function because of how
@@ -590,23 +1353,6 @@ begin:
     f->credit += q->quantum;
     head->first = f->next;
     fq_flow_add_tail(&q->old_flows, f);
-    
-     struct fq_flow_head *checkhead;
-     
-     checkhead = &q->old_flows;
-    
-     struct fq_flow *checkflowvalue;
-     
-     checkflowvalue = checkhead->first;
-     
-     while(checkflowvalue)
-     {
-     
-     printk("This is to check old flows data  socket_hash is %d \n", checkflowvalue->socket_hash);
-     
-     checkflowvalue = checkflowvalue->next; 
-     }
-     
     goto begin;
   }
 
@@ -627,30 +1373,20 @@ begin:
       q->stat_ce_mark++;
     }
     fq_dequeue_skb(sch, f, skb);
+    fq_ring_log(q, f, skb, head->list, rValue, now, sch->q.qlen);
+    if (rValue != -1 && unlikely(q->coflow_trim)) {
+      fq_coflow_class_drop(&q->coflow_cl, skb);
+    } else if (rValue != -1) {
+      fq_coflow_sample(q, rValue, now);
+      fq_coflow_class_dequeue(sch, skb, now);
+      trace_fq_coflow_dequeue(sch, f->key, rValue, qdisc_pkt_len(skb),
+                              q->coflow_cl.qlen);
+    }
   } else {
     head->first = f->next;
     /* force a pass through old_flows to prevent starvation */
     if ((head == &q->new_flows) && q->old_flows.first) {
       fq_flow_add_tail(&q->old_flows, f);
-      
-     struct fq_flow_head *checkhead;
-     
-     checkhead = &q->old_flows;
-    
-     struct fq_flow *checkflowvalue;
-     
-     checkflowvalue = checkhead->first;
-     
-     while(checkflowvalue)
-     {
-     
-     printk("This is to check old flows data  socket_hash is %d \n", checkflowvalue->socket_hash);
-     
-     checkflowvalue = checkflowvalue->next; 
-     }
-     
-
-          
     } else {
       fq_flow_set_detached(f);
       q->inactive_flows++;
@@ -663,6 +1399,10 @@ begin:
   if (!q->rate_enable) goto out;
 
   rate = q->flow_max_rate;
+  /* the only pacing member flows get on ingress (IFB), where there is no
+   * socket pacing rate
+   */
+  if (rValue != -1) rate = min(rate, q->coflow_max_rate);
 
   /* If EDT time was provided for this skb, we need to
    * update f->time_next_packet only if this qdisc enforces
@@ -698,7 +1438,11 @@ begin:
     f->time_next_packet = now + len;
   }
 out:
+#ifdef FQ_STAGING
+  qdisc_update_stats_at_dequeue(sch, skb);
+#else
   qdisc_bstats_update(sch, skb);
+#endif
   return skb;
 }
 
@@ -727,6 +1471,7 @@ static void fq_reset(struct Qdisc *sch) {
   sch->q.qlen = 0;
   sch->qstats.backlog = 0;
 
+  fq_stage_purge(sch);
   fq_flow_purge(&q->internal);
 
   if (!q->fq_root) return;
@@ -749,8 +1494,25 @@ static void fq_reset(struct Qdisc *sch) {
   q->flows = 0;
   q->inactive_flows = 0;
   q->throttled_flows = 0;
+  fq_coflow_class_clear(&q->coflow_cl);
+  /* learnt members went with their flows (for every queue of the device),
+   * tc configured ones stay
+   */
+  if (q->coord && !READ_ONCE(q->coord->configured))
+    fq_coflow_members_set(q->coord, NULL, false);
+  q->coflow_hold_ns = timeInterval;
+  memset(q->infer, 0, sizeof(q->infer));
+  q->infer_elected = NULL;
+  /* rejoin the co-flow at the barrier the other queues reached */
+  if (q->coord) q->dcounter = fq_coflow_barriers(q->coord);
 }
 
+/*
+ * Flows keep their address, so the RR lists, the co_flows list and the
+ * delayed tree stay valid. Only detached flows are collected, and those are
+ * on no list : co-flow membership (by f->key), barrier progress and the
+ * holds already stamped on queued skbs are untouched.
+ */
 static void fq_rehash(struct fq_sched_data *q, struct rb_root *old_array,
                       u32 old_log, struct rb_root *new_array, u32 new_log) {
   struct rb_node *op, **np, *parent;
@@ -796,38 +1558,52 @@ static void fq_rehash(struct fq_sched_data *q, struct rb_root *old_array,
 
 static void fq_free(void *addr) { kvfree(addr); }
 
-static int fq_resize(struct Qdisc *sch, u32 log) {
-  struct fq_sched_data *q = qdisc_priv(sch);
+static struct rb_root *fq_root_alloc(struct Qdisc *sch, u32 log) {
   struct rb_root *array;
-  void *old_fq_root;
   u32 idx;
 
-  if (q->fq_root && log == q->fq_trees_log) return 0;
-
   /* If XPS was setup, we can allocate memory on right NUMA node */
   array = kvmalloc_node(sizeof(struct rb_root) << log,
                         GFP_KERNEL | __GFP_RETRY_MAYFAIL,
                         netdev_queue_numa_node_read(sch->dev_queue));
-  if (!array) return -ENOMEM;
+  if (!array) return NULL;
 
   for (idx = 0; idx < (1U << log); idx++) array[idx] = RB_ROOT;
+  return array;
+}
 
-  sch_tree_lock(sch);
+/* Called under the tree lock, returns the old array for fq_free() */
+static void *fq_root_swap(struct fq_sched_data *q, struct rb_root *array,
+                          u32 log) {
+  void *old_fq_root = q->fq_root;
 
-  old_fq_root = q->fq_root;
   if (old_fq_root) fq_rehash(q, old_fq_root, q->fq_trees_log, array, log);
 
   q->fq_root = array;
   q->fq_trees_log = log;
+  return old_fq_root;
+}
 
-  sch_tree_unlock(sch);
+static int fq_resize(struct Qdisc *sch, u32 log) {
+  struct fq_sched_data *q = qdisc_priv(sch);
+  struct rb_root *array;
+  void *old_fq_root;
+
+  if (q->fq_root && log == q->fq_trees_log) return 0;
+
+  array = fq_root_alloc(sch, log);
+  if (!array) return -ENOMEM;
+
+  fq_tree_lock(sch);
+  old_fq_root = fq_root_swap(q, array, log);
+  fq_tree_unlock(sch);
 
   fq_free(old_fq_root);
 
   return 0;
 }
 
-static const struct nla_policy fq_policy[TCA_FQ_MAX + 1] = {
+static const struct nla_policy fq_policy[TCA_FQ_COFLOW_MAX + 1] = {
     [TCA_FQ_UNSPEC] = {.strict_start_type = TCA_FQ_TIMER_SLACK},
 
     [TCA_FQ_PLIMIT] = {.type = NLA_U32},
@@ -845,49 +1621,187 @@ static const struct nla_policy fq_policy[TCA_FQ_MAX + 1] = {
     [TCA_FQ_TIMER_SLACK] = {.type = NLA_U32},
     [TCA_FQ_HORIZON] = {.type = NLA_U32},
     [TCA_FQ_HORIZON_DROP] = {.type = NLA_U8},
+    [TCA_FQ_COFLOW_HOLD_MIN] = {.type = NLA_U32},
+    [TCA_FQ_COFLOW_HOLD_MAX] = {.type = NLA_U32},
+    [TCA_FQ_COFLOW_RING_LOG] = {.type = NLA_U32},
+    [TCA_FQ_COFLOW_RULES] = {.type = NLA_BINARY,
+                             .len = FQ_COFLOW_RULES_MAX *
+                                    sizeof(struct tc_fq_coflow_rule)},
+    [TCA_FQ_COFLOW_RELEASE_GRID] = {.type = NLA_U32},
+    [TCA_FQ_COFLOW_MAX_RATE] = {.type = NLA_U32},
+    [TCA_FQ_COFLOW_TAG] = NLA_POLICY_MAX(NLA_U32, FQ_COFLOW_TAG_FLOWLABEL),
+    [TCA_FQ_COFLOW_TAG_STAMP] = {.type = NLA_U32},
+    [TCA_FQ_COFLOW_INFER_WINDOW] = {.type = NLA_U32},
+    [TCA_FQ_COFLOW_INFER_PORT_SHIFT] = NLA_POLICY_MAX(NLA_U32, 15),
 };
 
+/* Attributes the datapath reads under the tree lock : all but co-flow ones */
+static bool fq_change_locked(struct nlattr **tb) {
+  int i;
+
+  for (i = TCA_FQ_UNSPEC + 1; i < TCA_FQ_COFLOW_HOLD_MIN; i++)
+    if (tb[i]) return true;
+  return tb[TCA_FQ_COFLOW_RING_LOG];
+}
+
+/*
+ * Everything that can fail is checked or allocated before the tree lock is
+ * taken, then the whole change (bucket resize included) is applied in one
+ * critical section : a rejected change leaves the qdisc untouched, and the
+ * datapath never sees half of one. A change of co-flow parameters only is
+ * one RCU publish and does not take the tree lock at all.
+ */
 static int fq_change(struct Qdisc *sch, struct nlattr *opt,
                      struct netlink_ext_ack *extack) {
   struct fq_sched_data *q = qdisc_priv(sch);
-  struct nlattr *tb[TCA_FQ_MAX + 1];
+  struct nlattr *tb[TCA_FQ_COFLOW_MAX + 1];
+  const struct fq_coflow_cfg *cur = rtnl_dereference(q->coflow_cfg);
+  struct fq_coflow_cfg *cfg = NULL;
+  struct fq_ring_hdr *ring = NULL;
+  struct rb_root *array = NULL;
+  void *old_fq_root = NULL;
   int err, drop_count = 0;
   unsigned drop_len = 0;
-  u32 fq_log;
+  const struct tc_fq_coflow_rule *rules = NULL;
+  u32 fq_log, ring_log = 0, hold_min, hold_max, grid, max_rate, tag, stamp;
+  u32 infer_window, infer_shift;
+  int i, nrules = -1;
 
   if (!opt) return -EINVAL;
 
-  err = nla_parse_nested_deprecated(tb, TCA_FQ_MAX, opt, fq_policy, NULL);
+  err = nla_parse_nested_deprecated(tb, TCA_FQ_COFLOW_MAX, opt, fq_policy,
+                                    NULL);
   if (err < 0) return err;
 
-  sch_tree_lock(sch);
-
   fq_log = q->fq_trees_log;
 
   if (tb[TCA_FQ_BUCKETS_LOG]) {
     u32 nval = nla_get_u32(tb[TCA_FQ_BUCKETS_LOG]);
 
-    if (nval >= 1 && nval <= ilog2(256 * 1024))
-      fq_log = nval;
-    else
-      err = -EINVAL;
+    if (nval < 1 || nval > ilog2(256 * 1024)) {
+      NL_SET_ERR_MSG_MOD(extack, "invalid buckets log");
+      return -EINVAL;
+    }
+    fq_log = nval;
   }
-  if (tb[TCA_FQ_PLIMIT]) sch->limit = nla_get_u32(tb[TCA_FQ_PLIMIT]);
-
-  if (tb[TCA_FQ_FLOW_PLIMIT])
-    q->flow_plimit = nla_get_u32(tb[TCA_FQ_FLOW_PLIMIT]);
 
   if (tb[TCA_FQ_QUANTUM]) {
     u32 quantum = nla_get_u32(tb[TCA_FQ_QUANTUM]);
 
-    if (quantum > 0 && quantum <= (1 << 20)) {
-      q->quantum = quantum;
-    } else {
+    if (quantum == 0 || quantum > (1 << 20)) {
       NL_SET_ERR_MSG_MOD(extack, "invalid quantum");
-      err = -EINVAL;
+      return -EINVAL;
     }
   }
 
+  if (tb[TCA_FQ_RATE_ENABLE] && nla_get_u32(tb[TCA_FQ_RATE_ENABLE]) > 1)
+    return -EINVAL;
+
+  hold_min = tb[TCA_FQ_COFLOW_HOLD_MIN] ?
+                 nla_get_u32(tb[TCA_FQ_COFLOW_HOLD_MIN]) : cur->hold_min;
+  hold_max = tb[TCA_FQ_COFLOW_HOLD_MAX] ?
+                 nla_get_u32(tb[TCA_FQ_COFLOW_HOLD_MAX]) : cur->hold_max;
+  if (hold_min > hold_max) {
+    NL_SET_ERR_MSG_MOD(extack, "coflow hold min above max");
+    return -EINVAL;
+  }
+  grid = tb[TCA_FQ_COFLOW_RELEASE_GRID] ?
+             nla_get_u32(tb[TCA_FQ_COFLOW_RELEASE_GRID]) : cur->release_grid;
+  max_rate = tb[TCA_FQ_COFLOW_MAX_RATE] ?
+                 nla_get_u32(tb[TCA_FQ_COFLOW_MAX_RATE]) : cur->max_rate;
+  tag = tb[TCA_FQ_COFLOW_TAG] ? nla_get_u32(tb[TCA_FQ_COFLOW_TAG]) : cur->tag;
+  stamp = tb[TCA_FQ_COFLOW_TAG_STAMP] ?
+              nla_get_u32(tb[TCA_FQ_COFLOW_TAG_STAMP]) : cur->tag_stamp;
+  if (stamp && (!tag || stamp >= (tag == FQ_COFLOW_TAG_DSCP ? 64 : 1 << 20))) {
+    NL_SET_ERR_MSG_MOD(extack, "coflow tag stamp does not fit the tag mode");
+    return -EINVAL;
+  }
+  infer_window = tb[TCA_FQ_COFLOW_INFER_WINDOW] ?
+                     nla_get_u32(tb[TCA_FQ_COFLOW_INFER_WINDOW]) :
+                     cur->infer_window;
+  infer_shift = tb[TCA_FQ_COFLOW_INFER_PORT_SHIFT] ?
+                    nla_get_u32(tb[TCA_FQ_COFLOW_INFER_PORT_SHIFT]) :
+                    cur->infer_port_shift;
+
+  /* the ring may be mapped, its size is fixed once allocated */
+  if (tb[TCA_FQ_COFLOW_RING_LOG]) {
+    ring_log = nla_get_u32(tb[TCA_FQ_COFLOW_RING_LOG]);
+
+    if (ring_log > FQ_RING_LOG_MAX) {
+      NL_SET_ERR_MSG_MOD(extack, "ring log too large");
+      return -EINVAL;
+    }
+    if (ring_log && q->ring_mem && ring_log != q->ring_log) {
+      NL_SET_ERR_MSG_MOD(extack, "ring already allocated with another size");
+      return -EBUSY;
+    }
+  }
+
+  if (tb[TCA_FQ_COFLOW_RULES]) {
+    const struct nlattr *attr = tb[TCA_FQ_COFLOW_RULES];
+
+    if (nla_len(attr) % sizeof(*rules)) {
+      NL_SET_ERR_MSG_MOD(extack, "truncated coflow rule");
+      return -EINVAL;
+    }
+    rules = nla_data(attr);
+    nrules = nla_len(attr) / sizeof(*rules);
+    for (i = 0; i < nrules; i++) {
+      if ((rules[i].family && rules[i].family != AF_INET &&
+           rules[i].family != AF_INET6) ||
+          rules[i].key == FQ_COFLOW_KEY_NONE) {
+        NL_SET_ERR_MSG_MOD(extack, "invalid coflow rule");
+        return -EINVAL;
+      }
+    }
+  }
+
+  if (!q->fq_root || fq_log != q->fq_trees_log) {
+    array = fq_root_alloc(sch, fq_log);
+    if (!array) return -ENOMEM;
+  }
+  if (ring_log && !q->ring_mem) {
+    ring = fq_ring_alloc(ring_log);
+    if (!ring) goto nomem;
+  }
+  if (hold_min != cur->hold_min || hold_max != cur->hold_max ||
+      grid != cur->release_grid || max_rate != cur->max_rate ||
+      tag != cur->tag || stamp != cur->tag_stamp ||
+      infer_window != cur->infer_window ||
+      infer_shift != cur->infer_port_shift || rules) {
+    cfg = fq_coflow_cfg_dup(q, nrules);
+    if (!cfg) goto nomem;
+    cfg->hold_min = hold_min;
+    cfg->hold_max = hold_max;
+    cfg->release_grid = grid;
+    cfg->max_rate = max_rate;
+    cfg->tag = tag;
+    cfg->tag_stamp = stamp;
+    cfg->infer_window = infer_window;
+    cfg->infer_port_shift = infer_shift;
+    if (rules) memcpy(cfg->rules, rules, nrules * sizeof(*rules));
+  }
+
+  if (!array && !fq_change_locked(tb)) {
+    if (cfg) fq_coflow_cfg_publish(q, cfg);
+    return 0;
+  }
+
+  fq_tree_lock(sch);
+
+  if (ring) {
+    q->ring_mem = ring;
+    q->ring_log = ring_log;
+  }
+  if (tb[TCA_FQ_COFLOW_RING_LOG]) q->ring = ring_log ? q->ring_mem : NULL;
+
+  if (tb[TCA_FQ_PLIMIT]) sch->limit = nla_get_u32(tb[TCA_FQ_PLIMIT]);
+
+  if (tb[TCA_FQ_FLOW_PLIMIT])
+    q->flow_plimit = nla_get_u32(tb[TCA_FQ_FLOW_PLIMIT]);
+
+  if (tb[TCA_FQ_QUANTUM]) q->quantum = nla_get_u32(tb[TCA_FQ_QUANTUM]);
+
   if (tb[TCA_FQ_INITIAL_QUANTUM])
     q->initial_quantum = nla_get_u32(tb[TCA_FQ_INITIAL_QUANTUM]);
 
@@ -903,14 +1817,8 @@ static int fq_change(struct Qdisc *sch, struct nlattr *opt,
   if (tb[TCA_FQ_LOW_RATE_THRESHOLD])
     q->low_rate_threshold = nla_get_u32(tb[TCA_FQ_LOW_RATE_THRESHOLD]);
 
-  if (tb[TCA_FQ_RATE_ENABLE]) {
-    u32 enable = nla_get_u32(tb[TCA_FQ_RATE_ENABLE]);
-
-    if (enable <= 1)
-      q->rate_enable = enable;
-    else
-      err = -EINVAL;
-  }
+  if (tb[TCA_FQ_RATE_ENABLE])
+    q->rate_enable = nla_get_u32(tb[TCA_FQ_RATE_ENABLE]);
 
   if (tb[TCA_FQ_FLOW_REFILL_DELAY]) {
     u32 usecs_delay = nla_get_u32(tb[TCA_FQ_FLOW_REFILL_DELAY]);
@@ -933,11 +1841,14 @@ static int fq_change(struct Qdisc *sch, struct nlattr *opt,
   if (tb[TCA_FQ_HORIZON_DROP])
     q->horizon_drop = nla_get_u8(tb[TCA_FQ_HORIZON_DROP]);
 
-  if (!err) {
-    sch_tree_unlock(sch);
-    err = fq_resize(sch, fq_log);
-    sch_tree_lock(sch);
-  }
+  if (cfg) fq_coflow_cfg_publish(q, cfg);
+
+  if (array) old_fq_root = fq_root_swap(q, array, fq_log);
+
+  /* packets above a lowered limit are dropped, not sent : member ones
+   * count as co-flow drops and end no co-flow
+   */
+  q->coflow_trim = 1;
   while (sch->q.qlen > sch->limit) {
     struct sk_buff *skb = fq_dequeue(sch);
 
@@ -946,23 +1857,353 @@ static int fq_change(struct Qdisc *sch, struct nlattr *opt,
     rtnl_kfree_skbs(skb, skb);
     drop_count++;
   }
+  q->coflow_trim = 0;
   qdisc_tree_reduce_backlog(sch, drop_count, drop_len);
 
-  sch_tree_unlock(sch);
+  fq_tree_unlock(sch);
+
+  fq_free(old_fq_root);
+  return 0;
+
+nomem:
+  vfree(ring);
+  fq_free(array);
+  return -ENOMEM;
+}
+
+/*
+ * debugfs : sch_fq/<dev>-<handle> lists the co-flow state, then one line
+ * per flow. The tree lock is held from ->start() to ->stop(), that is for
+ * one seq_file buffer at most, and dropped between buffers : flows that
+ * come and go meanwhile can be missed or shown twice.
+ */
+struct fq_debugfs_iter {
+  struct Qdisc *sch;
+  loff_t pos;        /* of the flow at (bucket, idx) */
+  u32 bucket;
+  u32 idx;           /* rank in the bucket */
+  struct fq_flow *f; /* valid under the lock only */
+};
+
+static const char *const fq_list_names[] = {
+    [FQ_LIST_NEW] = "new",
+    [FQ_LIST_OLD] = "old",
+    [FQ_LIST_CO] = "co",
+    [FQ_LIST_INTERNAL] = "internal",
+};
+
+/* First flow at or after (bucket, idx) */
+static struct fq_flow *fq_debugfs_seek(struct fq_sched_data *q,
+                                       struct fq_debugfs_iter *it) {
+  while (it->bucket < (1U << q->fq_trees_log)) {
+    struct rb_node *p = rb_first(&q->fq_root[it->bucket]);
+    u32 i;
+
+    for (i = 0; p && i < it->idx; i++) p = rb_next(p);
+    if (p) return rb_entry(p, struct fq_flow, fq_node);
+    it->bucket++;
+    it->idx = 0;
+  }
+  return NULL;
+}
+
+static void *fq_debugfs_next(struct seq_file *seq, void *v, loff_t *pos) {
+  struct fq_debugfs_iter *it = seq->private;
+  struct fq_sched_data *q = qdisc_priv(it->sch);
+  struct rb_node *p = NULL;
+
+  if (v != SEQ_START_TOKEN) p = rb_next(&it->f->fq_node);
+  if (p) {
+    it->idx++;
+    it->f = rb_entry(p, struct fq_flow, fq_node);
+  } else {
+    if (v != SEQ_START_TOKEN) {
+      it->bucket++;
+      it->idx = 0;
+    }
+    it->f = fq_debugfs_seek(q, it);
+  }
+  it->pos = ++*pos;
+  return it->f;
+}
+
+static void *fq_debugfs_start(struct seq_file *seq, loff_t *pos) {
+  struct fq_debugfs_iter *it = seq->private;
+  struct fq_sched_data *q = qdisc_priv(it->sch);
+  loff_t i;
+
+  fq_tree_lock(it->sch);
+  if (!*pos) {
+    it->pos = it->bucket = it->idx = 0;
+    return SEQ_START_TOKEN;
+  }
+
+  if (*pos != it->pos) { /* lseek() */
+    it->bucket = it->idx = 0;
+    it->f = fq_debugfs_seek(q, it);
+    for (i = 1; it->f && i < *pos; i++) {
+      struct rb_node *p = rb_next(&it->f->fq_node);
+
+      if (p) {
+        it->idx++;
+        it->f = rb_entry(p, struct fq_flow, fq_node);
+      } else {
+        it->bucket++;
+        it->idx = 0;
+        it->f = fq_debugfs_seek(q, it);
+      }
+    }
+    it->pos = *pos;
+    return it->f;
+  }
+  it->f = fq_debugfs_seek(q, it);
+  return it->f;
+}
+
+static void fq_debugfs_stop(struct seq_file *seq, void *v) {
+  struct fq_debugfs_iter *it = seq->private;
+
+  fq_tree_unlock(it->sch);
+}
+
+static void fq_debugfs_show_coflow(struct seq_file *seq, struct Qdisc *sch) {
+  struct fq_sched_data *q = qdisc_priv(sch);
+  struct fq_coflow_class *cl = &q->coflow_cl;
+  struct fq_coflow_coord *c = q->coord;
+  int i;
+
+  seq_printf(seq, "coflow configured %u barriers consumed %llu complete %llu\n",
+             c->configured, q->dcounter, fq_coflow_barriers(c));
+  seq_printf(seq, "hold %lu ns (min %u max %u)\n", q->coflow_hold_ns,
+             q->coflow_hold_min, q->coflow_hold_max);
+  for (i = 0; i < nMembers; i++)
+    seq_printf(seq, "member %d key %016llx epoch %lld gap %lu ns\n", i,
+               c->members[i], (s64)atomic64_read(&c->epoch[i]),
+               READ_ONCE(c->gap_ns[i]));
+  seq_printf(seq,
+             "class qlen %u backlog %u start %llu last_cct %llu ns "
+             "completions %llu\n",
+             cl->qlen, cl->qstats.backlog, cl->start, cl->last_cct_ns,
+             cl->completions);
+  for (i = 0; i < FQ_INFER_GROUPS; i++) {
+    const struct fq_infer_group *g = &q->infer[i];
+
+    if (g->nflows < 2) continue;
+    seq_printf(seq,
+               "group %d%s cgroup %llu dport %u flows %u confidence %u "
+               "keys %016llx %016llx\n",
+               i, g == q->infer_elected ? " elected" : "", g->cgroup,
+               g->dport, g->nflows, g->confidence, g->keys[0], g->keys[1]);
+  }
+  seq_printf(seq, "flows %u inactive %u throttled %u internal qlen %d\n",
+             q->flows, q->inactive_flows, q->throttled_flows,
+             q->internal.qlen);
+  seq_printf(seq, "%-16s %-8s %6s %6s %8s %20s %s\n", "key", "hash",
+             "coflow", "qlen", "credit", "time_next_packet", "list");
+}
+
+static int fq_debugfs_show(struct seq_file *seq, void *v) {
+  struct fq_debugfs_iter *it = seq->private;
+  struct fq_sched_data *q = qdisc_priv(it->sch);
+  struct fq_flow *f = v;
+  const char *list;
+  int member;
+
+  if (v == SEQ_START_TOKEN) {
+    fq_debugfs_show_coflow(seq, it->sch);
+    return 0;
+  }
+
+  member = fq_coflow_member(q->coord->members, nMembers, f->key);
+
+  if (fq_flow_is_detached(f))
+    list = "detached";
+  else if (fq_flow_is_throttled(f))
+    list = "throttled";
+  else
+    list = fq_list_names[f->list];
+
+  seq_printf(seq, "%016llx %08x %6d %6d %8d %20llu %s\n", f->key,
+             f->socket_hash, member, f->qlen, f->credit, f->time_next_packet,
+             list);
+  return 0;
+}
+
+static const struct seq_operations fq_debugfs_seq_ops = {
+    .start = fq_debugfs_start,
+    .next = fq_debugfs_next,
+    .stop = fq_debugfs_stop,
+    .show = fq_debugfs_show,
+};
+
+static int fq_debugfs_open(struct inode *inode, struct file *file) {
+  struct fq_debugfs_iter *it;
+
+  it = __seq_open_private(file, &fq_debugfs_seq_ops, sizeof(*it));
+  if (!it) return -ENOMEM;
+  it->sch = inode->i_private;
+  return 0;
+}
+
+static const struct file_operations fq_debugfs_fops = {
+    .owner = THIS_MODULE,
+    .open = fq_debugfs_open,
+    .read = seq_read,
+    .llseek = seq_lseek,
+    .release = seq_release_private,
+};
+
+/*
+ * <name>.ring maps the dequeue event ring read only. debugfs proxies do
+ * not forward mmap, so the file is created unsafe and the mapping pins
+ * the file itself; the pages outlive vfree() while mapped.
+ */
+static int fq_ring_mmap(struct file *file, struct vm_area_struct *vma) {
+  struct dentry *dentry = file->f_path.dentry;
+  struct fq_sched_data *q;
+  int err;
+
+  if (vma->vm_flags & VM_WRITE) return -EPERM;
+  vma->vm_flags &= ~VM_MAYWRITE;
+
+  err = debugfs_file_get(dentry);
+  if (err) return err;
+
+  q = qdisc_priv(file_inode(file)->i_private);
+  err = -ENODEV;
+  if (q->ring_mem) err = remap_vmalloc_range(vma, q->ring_mem, vma->vm_pgoff);
+
+  debugfs_file_put(dentry);
   return err;
 }
 
+static const struct file_operations fq_ring_fops = {
+    .owner = THIS_MODULE,
+    .open = simple_open,
+    .mmap = fq_ring_mmap,
+    .llseek = noop_llseek,
+};
+
+/* Default qdiscs (mq children) have no handle, their parent tells them apart */
+static void fq_debugfs_add(struct Qdisc *sch) {
+  struct fq_sched_data *q = qdisc_priv(sch);
+  u32 id = sch->handle ? sch->handle : sch->parent;
+  char name[IFNAMSIZ + 25];
+  int len;
+
+  len = snprintf(name, sizeof(name) - 5, "%s-%x:%x", qdisc_dev(sch)->name,
+                 TC_H_MAJ(id) >> 16, TC_H_MIN(id));
+  q->debugfs = debugfs_create_file(name, 0400, fq_debugfs_root, sch,
+                                   &fq_debugfs_fops);
+  strcpy(name + len, ".ring");
+  q->debugfs_ring = debugfs_create_file_unsafe(name, 0400, fq_debugfs_root,
+                                               sch, &fq_ring_fops);
+}
+
+#ifdef FQ_PROFILE
+/* sch_fq/profile : histograms summed over cpus, then per cpu counts.
+ * Writing 1 or 0 turns profiling on or off, "reset" clears the counters.
+ */
+static int fq_profile_show(struct seq_file *seq, void *v) {
+  int cpu, p, b;
+
+  seq_printf(seq, "profiling %s, cycles\n",
+             static_key_enabled(&fq_profile_on) ? "on" : "off");
+  for (p = 0; p < FQ_PHASE_MAX; p++) {
+    u64 total = 0;
+
+    seq_printf(seq, "%s\n", fq_phase_names[p]);
+    for (b = 0; b < FQ_PROFILE_BUCKETS; b++) {
+      u64 n = 0;
+
+      for_each_possible_cpu(cpu) n += per_cpu(fq_profile, cpu).hist[p][b];
+      total += n;
+      if (n)
+        seq_printf(seq, "  %10llu .. %-10llu %llu\n", b ? 1ULL << (b - 1) : 0,
+                   (1ULL << b) - 1, n);
+    }
+    seq_printf(seq, "  total %llu\n  cpu", total);
+    for_each_online_cpu(cpu) {
+      u64 n = 0;
+
+      for (b = 0; b < FQ_PROFILE_BUCKETS; b++)
+        n += per_cpu(fq_profile, cpu).hist[p][b];
+      seq_printf(seq, " %d:%llu", cpu, n);
+    }
+    seq_putc(seq, '\n');
+  }
+  return 0;
+}
+
+static int fq_profile_open(struct inode *inode, struct file *file) {
+  return single_open(file, fq_profile_show, NULL);
+}
+
+static ssize_t fq_profile_write(struct file *file, const char __user *ubuf,
+                                size_t count, loff_t *ppos) {
+  char buf[16];
+  bool on;
+  int cpu;
+
+  if (count >= sizeof(buf)) return -EINVAL;
+  if (copy_from_user(buf, ubuf, count)) return -EFAULT;
+  buf[count] = '\0';
+
+  if (sysfs_streq(buf, "reset")) {
+    for_each_possible_cpu(cpu)
+      memset(per_cpu_ptr(&fq_profile, cpu), 0, sizeof(struct fq_profile));
+  } else if (!kstrtobool(buf, &on)) {
+    if (on)
+      static_branch_enable(&fq_profile_on);
+    else
+      static_branch_disable(&fq_profile_on);
+  } else {
+    return -EINVAL;
+  }
+  return count;
+}
+
+static const struct file_operations fq_profile_fops = {
+    .owner = THIS_MODULE,
+    .open = fq_profile_open,
+    .read = seq_read,
+    .write = fq_profile_write,
+    .llseek = seq_lseek,
+    .release = single_release,
+};
+
+static void fq_profile_debugfs_init(void) {
+  debugfs_create_file("profile", 0600, fq_debugfs_root, NULL,
+                      &fq_profile_fops);
+}
+#else
+static void fq_profile_debugfs_init(void) {}
+#endif
+
 static void fq_destroy(struct Qdisc *sch) {
   struct fq_sched_data *q = qdisc_priv(sch);
 
+  /* waits for readers */
+  debugfs_remove(q->debugfs);
+  debugfs_remove(q->debugfs_ring);
   fq_reset(sch);
   fq_free(q->fq_root);
   qdisc_watchdog_cancel(&q->watchdog);
+  fq_coord_put(q->coord);
+  vfree(q->ring_mem);
+  /* NULL if fq_init() failed early */
+  if (rcu_access_pointer(q->coflow_cfg))
+    kfree_rcu(rcu_dereference_protected(q->coflow_cfg, 1), rcu);
+#ifdef FQ_STAGING
+  free_percpu(q->stage);
+  free_cpumask_var(q->stage_mask);
+#endif
 }
 
 static int fq_init(struct Qdisc *sch, struct nlattr *opt,
                    struct netlink_ext_ack *extack) {
   struct fq_sched_data *q = qdisc_priv(sch);
+  struct fq_coflow_cfg *cfg;
   int err;
 
   sch->limit = 10000;
@@ -974,8 +2215,11 @@ static int fq_init(struct Qdisc *sch, struct nlattr *opt,
   q->time_next_delayed_flow = ~0ULL;
   q->rate_enable = 1;
   q->new_flows.first = NULL;
+  q->new_flows.list = FQ_LIST_NEW;
   q->old_flows.first = NULL;
+  q->old_flows.list = FQ_LIST_OLD;
   q->co_flows.first = NULL;
+  q->co_flows.list = FQ_LIST_CO;
   q->delayed = RB_ROOT;
   q->fq_root = NULL;
   q->fq_trees_log = ilog2(1024);
@@ -987,24 +2231,51 @@ static int fq_init(struct Qdisc *sch, struct nlattr *opt,
   q->horizon = 10ULL * NSEC_PER_SEC; /* 10 seconds */
   q->horizon_drop = 1; /* by default, drop packets beyond horizon */
 
+  q->coflow_hold_ns = timeInterval;
+
   /* Default ce_threshold of 4294 seconds */
   q->ce_threshold = (u64)NSEC_PER_USEC * ~0U;
 
   qdisc_watchdog_init_clockid(&q->watchdog, sch, CLOCK_MONOTONIC);
 
-  	
-  //testfq(sch,q);
- 	
+  q->coord = fq_coord_get(qdisc_dev(sch));
+  if (!q->coord) return -ENOMEM;
+  q->dcounter = fq_coflow_barriers(q->coord);
+  q->coflow_members_gen = atomic_read(&q->coord->members_gen);
+
+  cfg = kzalloc(sizeof(*cfg), GFP_KERNEL);
+  if (!cfg) return -ENOMEM;
+  cfg->gen = 1; /* the datapath applies it on its first packet */
+  cfg->hold_min = NSEC_PER_USEC; /* 1 usec */
+  cfg->hold_max = NSEC_PER_MSEC; /* 1 msec */
+  cfg->max_rate = ~0U;
+  q->coflow_hold_min = cfg->hold_min;
+  q->coflow_hold_max = cfg->hold_max;
+  q->coflow_max_rate = ~0UL;
+  RCU_INIT_POINTER(q->coflow_cfg, cfg);
+
+#ifdef FQ_STAGING
+  BUILD_BUG_ON(offsetof(struct sk_buff, next) != 0);
+  q->stage = alloc_percpu(struct fq_stage);
+  if (!q->stage || !zalloc_cpumask_var(&q->stage_mask, GFP_KERNEL))
+    return -ENOMEM;
+#endif
+
   if (opt)
     err = fq_change(sch, opt, extack);
   else
     err = fq_resize(sch, q->fq_trees_log);
 
+  /* the enqueue checks need the flow table */
+  //testfq(sch,q);
+
+  if (!err) fq_debugfs_add(sch);
   return err;
 }
 
 static int fq_dump(struct Qdisc *sch, struct sk_buff *skb) {
   struct fq_sched_data *q = qdisc_priv(sch);
+  const struct fq_coflow_cfg *cfg = rtnl_dereference(q->coflow_cfg);
   u64 ce_threshold = q->ce_threshold;
   u64 horizon = q->horizon;
   struct nlattr *opts;
@@ -1032,7 +2303,21 @@ static int fq_dump(struct Qdisc *sch, struct sk_buff *skb) {
       nla_put_u32(skb, TCA_FQ_BUCKETS_LOG, q->fq_trees_log) ||
       nla_put_u32(skb, TCA_FQ_TIMER_SLACK, q->timer_slack) ||
       nla_put_u32(skb, TCA_FQ_HORIZON, (u32)horizon) ||
-      nla_put_u8(skb, TCA_FQ_HORIZON_DROP, q->horizon_drop))
+      nla_put_u8(skb, TCA_FQ_HORIZON_DROP, q->horizon_drop) ||
+      nla_put_u32(skb, TCA_FQ_COFLOW_HOLD_MIN, cfg->hold_min) ||
+      nla_put_u32(skb, TCA_FQ_COFLOW_HOLD_MAX, cfg->hold_max) ||
+      nla_put_u32(skb, TCA_FQ_COFLOW_RING_LOG, q->ring ? q->ring_log : 0) ||
+      nla_put_u32(skb, TCA_FQ_COFLOW_RELEASE_GRID, cfg->release_grid) ||
+      nla_put_u32(skb, TCA_FQ_COFLOW_MAX_RATE, cfg->max_rate) ||
+      nla_put_u32(skb, TCA_FQ_COFLOW_TAG, cfg->tag) ||
+      nla_put_u32(skb, TCA_FQ_COFLOW_TAG_STAMP, cfg->tag_stamp) ||
+      nla_put_u32(skb, TCA_FQ_COFLOW_INFER_WINDOW, cfg->infer_window) ||
+      nla_put_u32(skb, TCA_FQ_COFLOW_INFER_PORT_SHIFT, cfg->infer_port_shift))
+    goto nla_put_failure;
+
+  if (cfg->nrules &&
+      nla_put(skb, TCA_FQ_COFLOW_RULES, cfg->nrules * sizeof(cfg->rules[0]),
+              cfg->rules))
     goto nla_put_failure;
 
   return nla_nest_end(skb, opts);
@@ -1043,9 +2328,12 @@ nla_put_failure:
 
 static int fq_dump_stats(struct Qdisc *sch, struct gnet_dump *d) {
   struct fq_sched_data *q = qdisc_priv(sch);
+  const struct fq_coflow_class *cl = &q->coflow_cl;
+  struct tc_fq_coflow_qd_stats cst;
   struct tc_fq_qd_stats st;
+  int i;
 
-  sch_tree_lock(sch);
+  fq_tree_lock(sch);
 
   st.gc_flows = q->stat_gc_flows;
   st.highprio_packets = q->stat_internal_packets;
@@ -1064,14 +2352,176 @@ static int fq_dump_stats(struct Qdisc *sch, struct gnet_dump *d) {
   st.ce_mark = q->stat_ce_mark;
   st.horizon_drops = q->stat_horizon_drops;
   st.horizon_caps = q->stat_horizon_caps;
-  sch_tree_unlock(sch);
+  cst.coflow_hold_ns = q->coflow_hold_ns;
+  cst.coflow_bytes = cl->bstats.bytes;
+  cst.coflow_packets = cl->bstats.packets;
+  cst.coflow_drops = cl->qstats.drops;
+  cst.coflow_qlen = cl->qlen;
+  cst.coflow_backlog = cl->qstats.backlog;
+  cst.coflow_completions = cl->completions;
+  cst.coflow_cct_sum_ns = cl->cct_sum_ns;
+  memcpy(cst.coflow_cct_hist, cl->cct_hist, sizeof(cst.coflow_cct_hist));
+  cst.coflow_release_ns =
+      q->coflow_release_grid ? atomic64_read(&q->coord->release) : 0;
+  cst.coflow_release_windows = q->coflow_release_windows;
+  cst.coflow_infer_joins = q->infer_joins;
+  cst.coflow_infer_hits = q->infer_hits;
+  cst.coflow_infer_misses = q->infer_misses;
+  cst.coflow_infer_groups = 0;
+  for (i = 0; i < FQ_INFER_GROUPS; i++)
+    if (q->infer[i].nflows >= 2) cst.coflow_infer_groups++;
+  cst.coflow_infer_confidence =
+      q->infer_elected ? q->infer_elected->confidence : 0;
+  fq_tree_unlock(sch);
+
+  cst.fq = st;
+  return gnet_stats_copy_app(d, &cst, sizeof(cst));
+}
+
+/*
+ * Class interface : the co-flow is class <handle>:1, shown while it has
+ * members. Creating or changing it sets the member keys (TCA_FQ_CLASS_KEYS)
+ * and stops learning them from traffic, deleting it leaves the instance
+ * without co-flow until the class is created again.
+ */
+static const struct nla_policy fq_class_policy[TCA_FQ_CLASS_MAX + 1] = {
+    [TCA_FQ_CLASS_MEMBERS] = {.type = NLA_REJECT},
+    [TCA_FQ_CLASS_KEYS] = {.type = NLA_BINARY, .len = sizeof(u64) * nMembers},
+};
+
+static struct Qdisc *fq_class_leaf(struct Qdisc *sch, unsigned long cl) {
+  return NULL;
+}
+
+static unsigned long fq_class_find(struct Qdisc *sch, u32 classid) {
+  struct fq_sched_data *q = qdisc_priv(sch);
+
+  if (TC_H_MIN(classid) != FQ_COFLOW_MINOR || !fq_class_present(q)) return 0;
+  return FQ_COFLOW_MINOR;
+}
+
+static int fq_class_change(struct Qdisc *sch, u32 classid, u32 parentid,
+                           struct nlattr **tca, unsigned long *arg,
+                           struct netlink_ext_ack *extack) {
+  struct fq_sched_data *q = qdisc_priv(sch);
+  struct nlattr *opt = tca[TCA_OPTIONS];
+  struct nlattr *tb[TCA_FQ_CLASS_MAX + 1];
+  u64 members[nMembers];
+  int err;
+
+  if (!*arg && classid && TC_H_MIN(classid) != FQ_COFLOW_MINOR) {
+    NL_SET_ERR_MSG_MOD(extack, "fq has a single co-flow class, minor 1");
+    return -EOPNOTSUPP;
+  }
+  if (!opt) {
+    NL_SET_ERR_MSG_MOD(extack, "co-flow members required");
+    return -EINVAL;
+  }
+
+  err = nla_parse_nested_deprecated(tb, TCA_FQ_CLASS_MAX, opt, fq_class_policy,
+                                    extack);
+  if (err < 0) return err;
+
+  if (!tb[TCA_FQ_CLASS_KEYS] ||
+      nla_len(tb[TCA_FQ_CLASS_KEYS]) != sizeof(members)) {
+    NL_SET_ERR_MSG_MOD(extack, "co-flow member keys required");
+    return -EINVAL;
+  }
+  nla_memcpy(members, tb[TCA_FQ_CLASS_KEYS], sizeof(members));
+  fq_coflow_members_set(q->coord, members, true);
 
-  return gnet_stats_copy_app(d, &st, sizeof(st));
+  *arg = FQ_COFLOW_MINOR;
+  return 0;
+}
+
+static int fq_class_delete(struct Qdisc *sch, unsigned long cl,
+                           struct netlink_ext_ack *extack) {
+  struct fq_sched_data *q = qdisc_priv(sch);
+
+  fq_coflow_members_set(q->coord, NULL, true);
+  return 0;
 }
 
+static void fq_class_walk(struct Qdisc *sch, struct qdisc_walker *arg) {
+  struct fq_sched_data *q = qdisc_priv(sch);
+
+  if (arg->stop || !fq_class_present(q)) return;
+
+  if (arg->count >= arg->skip &&
+      arg->fn(sch, FQ_COFLOW_MINOR, arg) < 0) {
+    arg->stop = 1;
+    return;
+  }
+  arg->count++;
+}
+
+static int fq_class_dump(struct Qdisc *sch, unsigned long cl,
+                         struct sk_buff *skb, struct tcmsg *tcm) {
+  struct fq_sched_data *q = qdisc_priv(sch);
+  struct nlattr *opts;
+
+  tcm->tcm_parent = TC_H_ROOT;
+  tcm->tcm_handle = TC_H_MAKE(sch->handle, cl);
+  tcm->tcm_info = 0;
+
+  opts = nla_nest_start_noflag(skb, TCA_OPTIONS);
+  if (opts == NULL) goto nla_put_failure;
+
+  if (nla_put(skb, TCA_FQ_CLASS_KEYS, nMembers * sizeof(u64),
+              fq_class_members(q)))
+    goto nla_put_failure;
+
+  return nla_nest_end(skb, opts);
+
+nla_put_failure:
+  nla_nest_cancel(skb, opts);
+  return -1;
+}
+
+static int fq_class_dump_stats(struct Qdisc *sch, unsigned long cl,
+                               struct gnet_dump *d) {
+  struct fq_sched_data *q = qdisc_priv(sch);
+  struct fq_coflow_class *c = &q->coflow_cl;
+  struct gnet_stats_basic_packed bstats;
+  struct gnet_stats_queue qstats;
+  struct tc_fq_coflow_xstats xst;
+  u32 qlen;
+
+  /* snapshot, the datapath updates these under the same lock */
+  fq_tree_lock(sch);
+  bstats = c->bstats;
+  qstats = c->qstats;
+  qlen = c->qlen;
+  xst.last_cct_ns = c->last_cct_ns;
+  xst.completions = c->completions;
+  xst.barriers = q->dcounter;
+  memset(xst.members, 0xff, sizeof(xst.members));
+  memcpy(xst.keys, fq_class_members(q), sizeof(xst.keys));
+  fq_tree_unlock(sch);
+
+  if (gnet_stats_copy_basic(NULL, d, NULL, &bstats) < 0 ||
+      gnet_stats_copy_queue(d, NULL, &qstats, qlen) < 0)
+    return -1;
+  return gnet_stats_copy_app(d, &xst, sizeof(xst));
+}
+
+static const struct Qdisc_class_ops fq_class_ops = {
+    .leaf = fq_class_leaf,
+    .find = fq_class_find,
+    .change = fq_class_change,
+    .delete = fq_class_delete,
+    .walk = fq_class_walk,
+    .dump = fq_class_dump,
+    .dump_stats = fq_class_dump_stats,
+};
+
 static struct Qdisc_ops fq_qdisc_ops __read_mostly = {
+    .cl_ops = &fq_class_ops,
     .id = "fq",
     .priv_size = sizeof(struct fq_sched_data),
+#ifdef FQ_STAGING
+    .static_flags = TCQ_F_NOLOCK | TCQ_F_CPUSTATS,
+#endif
 
     .enqueue = fq_enqueue,
     .dequeue = fq_dequeue,
@@ -1088,17 +2538,35 @@ static struct Qdisc_ops fq_qdisc_ops __read_mostly = {
 static int __init fq_module_init(void) {
   int ret;
 
+  /* fq_uapi.h : co-flow attributes must not land on this kernel's own */
+  BUILD_BUG_ON(TCA_FQ_COFLOW_HOLD_MIN <= TCA_FQ_MAX);
+
   fq_flow_cachep =
       kmem_cache_create("fq_flow_cache", sizeof(struct fq_flow), 0, 0, NULL);
   if (!fq_flow_cachep) return -ENOMEM;
 
+  fq_debugfs_root = debugfs_create_dir("sch_fq", NULL);
+  fq_profile_debugfs_init();
+
+  ret = genl_register_family(&fq_coflow_genl_family);
+  if (ret) goto err_genl;
+
   ret = register_qdisc(&fq_qdisc_ops);
-  if (ret) kmem_cache_destroy(fq_flow_cachep);
+  if (ret) goto err_qdisc;
+  return 0;
+
+err_qdisc:
+  genl_unregister_family(&fq_coflow_genl_family);
+err_genl:
+  debugfs_remove_recursive(fq_debugfs_root);
+  kmem_cache_destroy(fq_flow_cachep);
   return ret;
 }
 
 static void __exit fq_module_exit(void) {
   unregister_qdisc(&fq_qdisc_ops);
+  genl_unregister_family(&fq_coflow_genl_family);
+  debugfs_remove_recursive(fq_debugfs_root);
   kmem_cache_destroy(fq_flow_cachep);
 }
 
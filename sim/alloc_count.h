@@ -0,0 +1,47 @@
+/*
+ * sim/alloc_count.h Counting replacement of the global allocator
+ *
+ *  Include from exactly one translation unit of a benchmark program.
+ *  fq_allocs counts heap allocations, fq_live_bytes the bytes currently
+ *  allocated (as malloc_usable_size() reports them).
+ */
+#ifndef FQ_ALLOC_COUNT_H
+#define FQ_ALLOC_COUNT_H
+
+#include <malloc.h>
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+/* operator new is malloc() here, so free() is the matching release */
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+
+static std::atomic<uint64_t> fq_allocs;
+static std::atomic<int64_t> fq_live_bytes;
+
+void *operator new(size_t size) {
+  void *p = malloc(size ? size : 1);
+
+  if (!p) throw std::bad_alloc();
+  fq_allocs.fetch_add(1, std::memory_order_relaxed);
+  fq_live_bytes.fetch_add(malloc_usable_size(p), std::memory_order_relaxed);
+  return p;
+}
+
+void *operator new[](size_t size) { return operator new(size); }
+
+void operator delete(void *p) noexcept {
+  if (!p) return;
+  fq_live_bytes.fetch_sub(malloc_usable_size(p), std::memory_order_relaxed);
+  free(p);
+}
+
+void operator delete[](void *p) noexcept { operator delete(p); }
+
+void operator delete(void *p, size_t) noexcept { operator delete(p); }
+
+void operator delete[](void *p, size_t) noexcept { operator delete(p); }
+
+#endif /* FQ_ALLOC_COUNT_H */
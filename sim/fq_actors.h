@@ -0,0 +1,247 @@
+/*
+ * sim/fq_actors.h Coroutine application actors on top of the engine
+ *
+ *  A simulated host runs one fq_engine<Policy> in front of its link, and
+ *  any number of application tasks written as C++20 coroutines :
+ *
+ *	fq_task mapper(fq_host<fq_policy_barrier> &h, fq_socket *s) {
+ *	  for (int i = 0; i < 8; i++) {
+ *	    co_await h.send(s, 1 << 20);	// resumes when the last byte left
+ *	    co_await h.ack(s);			// resumes one rtt later
+ *	  }
+ *	}
+ *
+ *  Nothing runs on its own thread : fq_host::run() is a virtual time
+ *  event loop that dequeues packets at link rate, and resumes tasks from
+ *  the dequeue events (send completion) and from a timer queue (acks,
+ *  sleeps). A suspended task costs one coroutine frame.
+ *
+ *  Sockets push at most @window packets into the qdisc and refill on
+ *  every dequeue, like TCP small queues, so flow_plimit is not hit. When
+ *  the qdisc is at its limit a socket waits for the next dequeue rather
+ *  than losing packets.
+ *
+ *  Build with -std=c++20.
+ */
+#ifndef FQ_ACTORS_H
+#define FQ_ACTORS_H
+
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <memory>
+
+#include "fq_core.h"
+
+/* Coroutine handle owned by the host that spawned it */
+struct fq_task {
+  struct promise_type {
+    fq_task get_return_object() {
+      return fq_task(std::coroutine_handle<promise_type>::from_promise(*this));
+    }
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    std::suspend_always final_suspend() noexcept { return {}; }
+    void return_void() {}
+    void unhandled_exception() { std::terminate(); }
+  };
+
+  explicit fq_task(std::coroutine_handle<promise_type> h) : handle(h) {}
+  fq_task(fq_task &&o) noexcept : handle(o.handle) { o.handle = nullptr; }
+  fq_task(const fq_task &) = delete;
+  ~fq_task() {
+    if (handle) handle.destroy();
+  }
+
+  std::coroutine_handle<promise_type> handle;
+};
+
+struct fq_socket {
+  u64 sk;
+  u32 socket_hash;
+  u64 unsent;    /* bytes of the current send not yet queued */
+  u32 inflight;  /* packets queued in the qdisc */
+  u64 last_tx;   /* time the last packet left */
+  bool blocked;  /* waiting for room below q->limit */
+  std::coroutine_handle<> waiter; /* task blocked in send() */
+};
+
+template <class Policy>
+class fq_host {
+ public:
+  fq_host(const fq_sim_params &params,
+          const std::vector<fq_coflow_spec> &coflows, u64 link_rate,
+          u64 rtt_ns, u32 mss = 1448, u32 window = 10)
+      : q(params, coflows),
+        link_rate_(link_rate),
+        rtt_(rtt_ns),
+        mss_(mss),
+        window_(std::min(window, params.flow_plimit)) {}
+
+  fq_engine<Policy> q;
+  u64 now = 0;
+  u64 resumes = 0;
+  u64 sent_packets = 0;
+
+  fq_socket *socket(u64 sk, u32 socket_hash) {
+    sockets_.emplace_back(new fq_socket{sk, socket_hash, 0, 0, 0, false, nullptr});
+    by_sk_.emplace(sk, sockets_.back().get());
+    return sockets_.back().get();
+  }
+
+  /* Takes ownership of @t, it first runs at the current time */
+  void spawn(fq_task &&t) {
+    ready_.push_back(t.handle);
+    tasks_.push_back(std::move(t));
+  }
+
+  struct send_awaiter {
+    fq_host *h;
+    fq_socket *s;
+    u64 bytes;
+
+    bool await_ready() {
+      s->unsent += bytes;
+      h->push(s);
+      return !s->unsent && !s->inflight;
+    }
+    void await_suspend(std::coroutine_handle<> c) { s->waiter = c; }
+    void await_resume() {}
+  };
+
+  struct timer_awaiter {
+    fq_host *h;
+    u64 when;
+
+    bool await_ready() { return when <= h->now; }
+    void await_suspend(std::coroutine_handle<> c) { h->timer(when, c); }
+    void await_resume() {}
+  };
+
+  /* Completes when the last packet of @bytes has been dequeued */
+  send_awaiter send(fq_socket *s, u64 bytes) { return {this, s, bytes}; }
+
+  /* Completes one rtt after the last packet of @s left */
+  timer_awaiter ack(fq_socket *s) { return {this, s->last_tx + rtt_}; }
+
+  timer_awaiter sleep(u64 ns) { return {this, now + ns}; }
+
+  timer_awaiter sleep_until(u64 t) { return {this, t}; }
+
+  /* Runs until every task finished or nothing can progress */
+  void run() {
+    for (;;) {
+      while (!ready_.empty()) {
+        std::vector<std::coroutine_handle<>> batch;
+
+        batch.swap(ready_);
+        for (auto c : batch) {
+          resumes++;
+          c.resume();
+        }
+      }
+
+      fq_skb *skb = q.fq_dequeue(now);
+
+      if (skb) {
+        u64 tx = (u64)skb->len * NSEC_PER_SEC / link_rate_;
+
+        now += tx ? tx : 1;
+        sent_packets++;
+        transmitted(skb);
+        q.skb_pool.free(skb);
+        fire_timers();
+        continue;
+      }
+
+      u64 next = q.time_next_delayed_flow;
+
+      if (!timers_.empty()) next = std::min(next, timers_.top().when);
+      if (next == ~0ULL) break;
+      now = std::max(now, next);
+      fire_timers();
+    }
+  }
+
+ private:
+  struct timer_ent {
+    u64 when;
+    u64 seq;
+    std::coroutine_handle<> c;
+
+    bool operator>(const timer_ent &o) const {
+      return when != o.when ? when > o.when : seq > o.seq;
+    }
+  };
+
+  void timer(u64 when, std::coroutine_handle<> c) {
+    timers_.push({when, timer_seq_++, c});
+  }
+
+  void fire_timers() {
+    while (!timers_.empty() && timers_.top().when <= now) {
+      ready_.push_back(timers_.top().c);
+      timers_.pop();
+    }
+  }
+
+  /* Moves bytes from the socket into the qdisc, up to the window */
+  void push(fq_socket *s) {
+    while (s->unsent && s->inflight < window_) {
+      if (q.qlen >= q.p.limit) {
+        if (!s->blocked) blocked_.push_back(s);
+        s->blocked = true;
+        return;
+      }
+
+      fq_skb *skb = q.skb_pool.alloc();
+      u32 len = (u32)std::min<u64>(s->unsent, mss_);
+
+      skb->sk = s->sk;
+      skb->socket_hash = s->socket_hash;
+      skb->len = len + 66; /* headers */
+      if (!q.fq_enqueue(skb, now)) return;
+      s->unsent -= len;
+      s->inflight++;
+    }
+  }
+
+  void transmitted(const fq_skb *skb) {
+    auto it = by_sk_.find(skb->sk);
+
+    if (it == by_sk_.end()) return;
+
+    fq_socket *s = it->second;
+
+    s->inflight--;
+    s->last_tx = now;
+    push(s);
+    if (!s->unsent && !s->inflight && s->waiter) {
+      ready_.push_back(s->waiter);
+      s->waiter = nullptr;
+    }
+    while (!blocked_.empty() && q.qlen < q.p.limit) {
+      fq_socket *b = blocked_.front();
+
+      blocked_.pop_front();
+      b->blocked = false;
+      push(b);
+    }
+  }
+
+  u64 link_rate_;
+  u64 rtt_;
+  u32 mss_;
+  u32 window_;
+
+  std::vector<std::unique_ptr<fq_socket>> sockets_;
+  std::unordered_map<u64, fq_socket *> by_sk_;
+  std::deque<fq_socket *> blocked_;
+  std::vector<fq_task> tasks_;
+  std::vector<std::coroutine_handle<>> ready_;
+  std::priority_queue<timer_ent, std::vector<timer_ent>,
+                      std::greater<timer_ent>>
+      timers_;
+  u64 timer_seq_ = 0;
+};
+
+#endif /* FQ_ACTORS_H */
@@ -0,0 +1,119 @@
+/*
+ * sim/fq_bench.cc Trace replay benchmark for the userspace core
+ *
+ *  Replays one workload through every policy twice : with the policy
+ *  steps inlined (fq_engine<Policy>) and through a fq_policy_ops table
+ *  (fq_engine<fq_policy_dyn>), and reports packets per second of host
+ *  time for both. Each measurement is the best of -n runs.
+ *
+ *  It then compares skbs from the fq_skb_pool arena against one malloc
+ *  per skb, counting heap allocations per replayed packet.
+ */
+#include <getopt.h>
+
+#include "alloc_count.h"
+#include "workload.h"
+
+static void usage(void) {
+  fprintf(stderr,
+          "usage: fq_bench [-p policy,...] [-t trace] [-n runs]\n" FQ_WORKLOAD_USAGE);
+}
+
+/* Best of @runs, in Mpps. @allocs gets heap allocations per packet */
+static double fq_bench_mpps(int id, const fq_sim_params &params,
+                            const fq_workload &w, bool dyn, int runs,
+                            double *allocs = nullptr) {
+  u64 best = ~0ULL, packets = 0;
+
+  for (int i = 0; i < runs; i++) {
+    u64 before = fq_allocs.load();
+    fq_sim_result r = fq_sim_run_policy(id, params, w, dyn);
+
+    if (allocs && r.sent_packets)
+      *allocs = (double)(fq_allocs.load() - before) / r.sent_packets;
+    best = std::min(best, r.wall_ns);
+    packets = r.sent_packets;
+  }
+  return best ? (double)packets * 1000 / best : 0;
+}
+
+int main(int argc, char **argv) {
+  static const struct option opts[] = {
+      {"trace", required_argument, nullptr, 't'},
+      {"runs", required_argument, nullptr, 'n'},
+      {"policy", required_argument, nullptr, 'p'},
+      FQ_WORKLOAD_LONG_OPTS,
+      {nullptr, 0, nullptr, 0},
+  };
+  std::vector<int> policies;
+  fq_workload_spec spec;
+  fq_sim_params params;
+  fq_workload w;
+  const char *trace = nullptr;
+  int runs = 5, c;
+
+  spec.coflows = 8;
+  spec.load = 1.2;
+  while ((c = getopt_long(argc, argv, "t:n:p:h", opts, nullptr)) != -1) {
+    switch (c) {
+      case 't': trace = optarg; break;
+      case 'n': runs = std::max(atoi(optarg), 1); break;
+      case 'p':
+        for (char *name = strtok(optarg, ","); name;
+             name = strtok(nullptr, ",")) {
+          int id = fq_policy_lookup(name);
+
+          if (id < 0) {
+            fprintf(stderr, "fq_bench: unknown policy '%s'\n", name);
+            return 1;
+          }
+          policies.push_back(id);
+        }
+        break;
+      default:
+        if (!fq_workload_parse_opt(c, optarg, spec)) {
+          usage();
+          return 1;
+        }
+    }
+  }
+
+  if (trace) {
+    w.link_rate = spec.link_rate;
+    if (!fq_workload_load(trace, w)) {
+      fprintf(stderr, "fq_bench: cannot read %s: %s\n", trace, strerror(errno));
+      return 1;
+    }
+  } else {
+    w = fq_workload_generate(spec);
+  }
+  if (policies.empty())
+    for (int id = 0; id < FQ_POLICY_MAX; id++) policies.push_back(id);
+
+  printf("%zu packets, %zu co-flows, best of %d runs\n", w.arrivals.size(),
+         w.coflows.size(), runs);
+  printf("%-10s %12s %12s %8s\n", "policy", "inline Mpps", "fnptr Mpps",
+         "speedup");
+  for (int id : policies) {
+    double st = fq_bench_mpps(id, params, w, false, runs);
+    double dy = fq_bench_mpps(id, params, w, true, runs);
+
+    printf("%-10s %12.2f %12.2f %7.2fx\n", fq_policy_names[id], st, dy,
+           dy > 0 ? st / dy : 0);
+  }
+
+  fq_sim_params heap = params;
+
+  heap.skb_pool_chunk = 0;
+  printf("\n%-10s %12s %12s %12s %12s\n", "policy", "malloc Mpps",
+         "allocs/pkt", "pool Mpps", "allocs/pkt");
+  for (int id : policies) {
+    double heap_allocs = 0, pool_allocs = 0;
+    double hm = fq_bench_mpps(id, heap, w, false, runs, &heap_allocs);
+    double pm = fq_bench_mpps(id, params, w, false, runs, &pool_allocs);
+
+    printf("%-10s %12.2f %12.4f %12.2f %12.4f\n", fq_policy_names[id], hm,
+           heap_allocs, pm, pool_allocs);
+  }
+  return 0;
+}
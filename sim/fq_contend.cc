@@ -0,0 +1,396 @@
+/*
+ * sim/fq_contend.cc Root lock contention between enqueuers and dequeue
+ *
+ *  fq_contend [-p policy] [-m lock|stage] [-T max threads] [-P packets]
+ *             [-f flows] [-C coflows] [-M members] [-c churn]
+ *
+ *  Models the kernel path where every CPU calls fq_enqueue() under the
+ *  root qdisc lock and one CPU runs fq_dequeue() : for N = 1, 2, 4 ..
+ *  max producer threads, each enqueues its share of @packets on its own
+ *  flows under one fq_qdisc_lock, while a consumer thread dequeues under
+ *  the same lock. Time is the host monotonic clock, as ktime_get_ns().
+ *
+ *  Co-flow members are dealt round robin over the producers, so a
+ *  co-flow spans CPUs as it does on a real host. Every @churn packets a
+ *  producer opens a new flow (classify + co-flow lookup).
+ *
+ *  Lock hold time is recorded per operation kind, and kinds doing
+ *  co-flow work are flagged when they hold the lock noticeably longer
+ *  than a plain enqueue or dequeue.
+ *
+ *  With -m stage producers never take the lock : they push on their
+ *  fq_stages list (FQ_STAGING in the module) and the consumer merges
+ *  every staged skb under the lock before each dequeue. A producer whose
+ *  list holds FQ_STAGE_LIMIT skbs yields until the consumer drained it.
+ *  Without -m both modes run.
+ *
+ *  fq_qdisc_lock spins like spin_lock(), but yields every 64 spins : a
+ *  preempted holder cannot happen in the kernel (preemption is off under
+ *  a spinlock), it can here once threads outnumber cores.
+ */
+#include <getopt.h>
+
+#include <atomic>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
+#include "fq_stage.h"
+#include "workload.h"
+
+struct fq_qdisc_lock {
+  std::atomic<bool> locked{false};
+
+  void lock() {
+    for (unsigned spins = 0;;) {
+      if (!locked.exchange(true, std::memory_order_acquire)) return;
+      while (locked.load(std::memory_order_relaxed)) {
+        if (++spins % 64 == 0)
+          std::this_thread::yield();
+#if defined(__x86_64__) || defined(__i386__)
+        else
+          __builtin_ia32_pause();
+#endif
+      }
+    }
+  }
+
+  void unlock() { locked.store(false, std::memory_order_release); }
+};
+
+static inline u64 fq_clock_ns(void) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+enum fq_op_kind {
+  FQ_OP_ENQUEUE,   /* packet of an existing plain flow */
+  FQ_OP_NEW_FLOW,  /* classify created the flow : fq_coflow_lookup() */
+  FQ_OP_MEMBER,    /* co-flow member packet : barrier bookkeeping */
+  FQ_OP_DEQUEUE,   /* dequeue without promotion */
+  FQ_OP_PROMOTE,   /* dequeue that ran Promotecoflows() */
+  FQ_OP_IDLE,      /* dequeue found nothing eligible */
+  FQ_OP_STAGE,     /* -m stage : lockless push, no lock held */
+  FQ_OP_MERGE,     /* -m stage : one batch merged under the lock */
+  FQ_OP_MAX
+};
+
+static const char *const fq_op_names[FQ_OP_MAX] = {
+    "enqueue", "new flow", "member", "dequeue", "promote", "idle",
+    "stage", "merge",
+};
+
+/* The plain operation each kind is compared against, -1 if none */
+static const int fq_op_base[FQ_OP_MAX] = {
+    -1, FQ_OP_ENQUEUE, FQ_OP_ENQUEUE, -1, FQ_OP_DEQUEUE, -1, -1, -1,
+};
+
+struct fq_hold_stats {
+  u64 count[FQ_OP_MAX];
+  u64 hold_ns[FQ_OP_MAX];
+  u64 max_hold_ns[FQ_OP_MAX];
+  u64 acquires;
+  u64 wait_ns;
+  u64 max_wait_ns;
+
+  /* @acquired : the lock was taken for this operation */
+  void add(int kind, u64 wait, u64 hold, bool acquired = true) {
+    count[kind]++;
+    hold_ns[kind] += hold;
+    max_hold_ns[kind] = std::max(max_hold_ns[kind], hold);
+    if (!acquired) return;
+    acquires++;
+    wait_ns += wait;
+    max_wait_ns = std::max(max_wait_ns, wait);
+  }
+
+  void merge(const fq_hold_stats &o) {
+    for (int k = 0; k < FQ_OP_MAX; k++) {
+      count[k] += o.count[k];
+      hold_ns[k] += o.hold_ns[k];
+      max_hold_ns[k] = std::max(max_hold_ns[k], o.max_hold_ns[k]);
+    }
+    acquires += o.acquires;
+    wait_ns += o.wait_ns;
+    max_wait_ns = std::max(max_wait_ns, o.max_wait_ns);
+  }
+
+  double mean(int kind) const {
+    return count[kind] ? (double)hold_ns[kind] / count[kind] : 0;
+  }
+};
+
+struct fq_contend_spec {
+  u32 packets = 1000000; /* total, split over the producers */
+  u32 flows = 64;        /* per producer */
+  u32 coflows = 8;
+  u32 members = 4;       /* per co-flow, at most 32 */
+  u32 churn = 1024;      /* new flow every @churn packets, 0 : never */
+  bool staged = false;   /* -m stage */
+};
+
+struct fq_contend_result {
+  double enqueue_mpps; /* until the last producer finished */
+  double dequeue_mpps; /* until the queue drained */
+  u64 packets;
+  u64 merged;          /* -m stage : packets merged in FQ_OP_MERGE batches */
+  fq_hold_stats producers;
+  fq_hold_stats consumer;
+};
+
+/* Flows of producer @t : its share of co-flow members, then plain flows */
+static std::vector<u32> fq_contend_flows(const fq_contend_spec &s, u32 t,
+                                         u32 nthreads) {
+  std::vector<u32> hashes;
+  u32 nmembers = s.coflows * s.members;
+
+  for (u32 i = t; i < nmembers; i += nthreads) hashes.push_back(i + 1);
+  for (u32 i = 0; hashes.size() < std::max<size_t>(s.flows, 1); i++)
+    hashes.push_back(0x80000000U | (t << 16) | i);
+  return hashes;
+}
+
+template <class Policy>
+static fq_contend_result fq_contend_run(const fq_sim_params &params,
+                                        const fq_contend_spec &s,
+                                        u32 nthreads) {
+  std::vector<fq_coflow_spec> coflows(s.coflows);
+  std::vector<fq_hold_stats> hold(nthreads);
+  fq_contend_result r = {};
+  u32 nmembers = s.coflows * s.members;
+
+  for (u32 i = 0; i < nmembers; i++)
+    coflows[i / s.members].members.push_back(i + 1);
+
+  fq_engine<Policy> q(params, coflows);
+  fq_qdisc_lock lock;
+  fq_stages stages(nthreads);
+  std::atomic<u32> done{0};
+  std::atomic<bool> go{false};
+  std::atomic<u64> enqueue_end{0};
+  u32 per_thread = s.packets / nthreads;
+  std::vector<std::vector<fq_skb>> skbs(nthreads);
+  std::vector<std::thread> threads;
+
+  /* skbs are built up front, allocation is not under the root lock */
+  for (u32 t = 0; t < nthreads; t++) {
+    std::vector<u32> hashes = fq_contend_flows(s, t, nthreads);
+    u32 fresh = 0;
+
+    skbs[t].resize(per_thread);
+    for (u32 i = 0; i < per_thread; i++) {
+      fq_skb &skb = skbs[t][i];
+      u32 hash = hashes[i % hashes.size()];
+
+      skb.sk = ((u64)t << 32) | hash;
+      skb.socket_hash = hash;
+      if (s.churn && i % s.churn == s.churn - 1) {
+        skb.socket_hash = 0x40000000U | (t << 20) | fresh++;
+        skb.sk = ((u64)t << 32) | skb.socket_hash;
+      }
+      skb.len = 1514;
+    }
+  }
+
+  for (u32 t = 0; t < nthreads; t++)
+    threads.emplace_back([&, t] {
+      fq_hold_stats &st = hold[t];
+
+      while (!go.load(std::memory_order_acquire)) std::this_thread::yield();
+      for (fq_skb &skb : skbs[t]) {
+        if (s.staged) {
+          u64 t0 = fq_clock_ns();
+
+          while (!stages.push(t, &skb)) std::this_thread::yield();
+          st.add(FQ_OP_STAGE, 0, fq_clock_ns() - t0, false);
+          continue;
+        }
+
+        int member = skb.socket_hash <= nmembers;
+        u64 t0 = fq_clock_ns(), t1, t2;
+        u32 flows;
+
+        lock.lock();
+        t1 = fq_clock_ns();
+        flows = q.flows;
+        q.fq_enqueue(&skb, t1);
+        flows = q.flows - flows;
+        t2 = fq_clock_ns();
+        lock.unlock();
+        st.add(flows ? FQ_OP_NEW_FLOW : member ? FQ_OP_MEMBER : FQ_OP_ENQUEUE,
+               t1 - t0, t2 - t1);
+      }
+      if (done.fetch_add(1) + 1 == nthreads) enqueue_end = fq_clock_ns();
+    });
+
+  u64 start = fq_clock_ns(), end;
+
+  go.store(true, std::memory_order_release);
+  for (;;) {
+    bool finished = done.load(std::memory_order_acquire) == nthreads;
+    u64 t0 = fq_clock_ns(), t1, tm, t2;
+    u64 promotions;
+    fq_skb *skb;
+    u32 qlen, merged = 0;
+
+    lock.lock();
+    t1 = tm = fq_clock_ns();
+    if (s.staged) {
+      merged = stages.merge(q, t1);
+      tm = fq_clock_ns();
+    }
+    promotions = q.st.promotions;
+    skb = q.fq_dequeue(tm);
+    promotions = q.st.promotions - promotions;
+    qlen = q.qlen;
+    t2 = fq_clock_ns();
+    lock.unlock();
+
+    if (merged) {
+      r.consumer.add(FQ_OP_MERGE, t1 - t0, tm - t1);
+      r.merged += merged;
+    }
+    r.consumer.add(!skb ? FQ_OP_IDLE : promotions ? FQ_OP_PROMOTE
+                                                  : FQ_OP_DEQUEUE,
+                   t1 - t0, t2 - tm, !merged);
+    if (skb) {
+      r.packets++;
+      continue;
+    }
+    if (finished && !qlen) break;
+    std::this_thread::yield();
+  }
+  end = fq_clock_ns();
+  for (auto &t : threads) t.join();
+
+  for (const fq_hold_stats &st : hold) r.producers.merge(st);
+  r.enqueue_mpps = (double)per_thread * nthreads * 1000 /
+                   std::max<u64>(enqueue_end - start, 1);
+  r.dequeue_mpps = (double)r.packets * 1000 / std::max<u64>(end - start, 1);
+  return r;
+}
+
+static fq_contend_result fq_contend_run_policy(int id,
+                                               const fq_sim_params &params,
+                                               const fq_contend_spec &s,
+                                               u32 nthreads) {
+  switch (id) {
+    case FQ_POLICY_FQ:
+      return fq_contend_run<fq_policy_fq>(params, s, nthreads);
+    case FQ_POLICY_SEBF:
+      return fq_contend_run<fq_policy_sebf>(params, s, nthreads);
+    case FQ_POLICY_AALO:
+      return fq_contend_run<fq_policy_aalo>(params, s, nthreads);
+    default:
+      return fq_contend_run<fq_policy_barrier>(params, s, nthreads);
+  }
+}
+
+static void fq_contend_table(int policy, const fq_sim_params &params,
+                             const fq_contend_spec &s, u32 max_threads) {
+  fq_hold_stats total = {};
+  u64 merged = 0;
+
+  printf("\nmode %s\n", s.staged ? "stage" : "lock");
+  printf("%7s %9s %9s %9s %9s | mean hold ns :", "threads", "enq Mpps",
+         "deq Mpps", "wait ns", "max wait");
+  for (int k = 0; k < FQ_OP_MAX; k++) printf(" %8s", fq_op_names[k]);
+  printf("\n");
+
+  for (u32 n = 1;; n = std::min(2 * n, max_threads)) {
+    fq_contend_result r = fq_contend_run_policy(policy, params, s, n);
+    fq_hold_stats all = r.producers;
+
+    all.merge(r.consumer);
+    total.merge(all);
+    merged += r.merged;
+    printf("%7u %9.2f %9.2f %9.1f %9" PRIu64 " |              ", n,
+           r.enqueue_mpps, r.dequeue_mpps,
+           all.acquires ? (double)all.wait_ns / all.acquires : 0,
+           all.max_wait_ns);
+    for (int k = 0; k < FQ_OP_MAX; k++) printf(" %8.1f", all.mean(k));
+    printf("\n");
+    if (r.packets != (u64)(s.packets / n) * n)
+      fprintf(stderr, "fq_contend: %u threads dequeued %" PRIu64 " packets\n",
+              n, r.packets);
+    if (n == max_threads) break;
+  }
+
+  printf("\n%-9s %12s %10s %10s %8s\n", "op", "count", "mean ns", "max ns",
+         "vs base");
+  for (int k = 0; k < FQ_OP_MAX; k++) {
+    int b = fq_op_base[k];
+    double ratio = b >= 0 && total.mean(b) > 0 ? total.mean(k) / total.mean(b)
+                                               : 0;
+
+    if (!total.count[k]) continue;
+    printf("%-9s %12" PRIu64 " %10.1f %10" PRIu64, fq_op_names[k],
+           total.count[k], total.mean(k), total.max_hold_ns[k]);
+    if (b < 0 || !total.count[b])
+      printf(" %8s\n", "-");
+    else
+      printf(" %7.2fx%s\n", ratio,
+             ratio > 1.25 ? "  <- extends the critical section" : "");
+  }
+  if (total.count[FQ_OP_MERGE])
+    printf("%.1f skbs per merge, %.1f ns per merged skb\n",
+           (double)merged / total.count[FQ_OP_MERGE],
+           merged ? (double)total.hold_ns[FQ_OP_MERGE] / merged : 0);
+}
+
+int main(int argc, char **argv) {
+  fq_sim_params params;
+  fq_contend_spec s;
+  int policy = FQ_POLICY_BARRIER, mode = -1, c;
+  u32 max_threads = 64;
+
+  while ((c = getopt(argc, argv, "p:m:T:P:f:C:M:c:h")) != -1) {
+    switch (c) {
+      case 'p':
+        policy = fq_policy_lookup(optarg);
+        if (policy < 0) {
+          fprintf(stderr, "fq_contend: unknown policy '%s'\n", optarg);
+          return 1;
+        }
+        break;
+      case 'm':
+        mode = !strcmp(optarg, "stage") ? 1 : !strcmp(optarg, "lock") ? 0 : -2;
+        if (mode == -2) {
+          fprintf(stderr, "fq_contend: unknown mode '%s'\n", optarg);
+          return 1;
+        }
+        break;
+      case 'T': max_threads = std::max(atoi(optarg), 1); break;
+      case 'P': s.packets = std::max(atoi(optarg), 1); break;
+      case 'f': s.flows = atoi(optarg); break;
+      case 'C': s.coflows = atoi(optarg); break;
+      case 'M': s.members = std::min(std::max(atoi(optarg), 1), 32); break;
+      case 'c': s.churn = atoi(optarg); break;
+      default:
+        fprintf(stderr,
+                "usage: fq_contend [-p policy] [-m lock|stage] [-T max threads] "
+                "[-P packets]\n"
+                "                  [-f flows] [-C coflows] [-M members] "
+                "[-c churn]\n");
+        return 1;
+    }
+  }
+
+  /* the queue may hold every packet when producers outrun the consumer */
+  params.limit = ~0U;
+  params.flow_plimit = 0x7fffffff;
+
+  printf("policy %s, %u packets, %u co-flows of %u members, %u cpus\n",
+         fq_policy_names[policy], s.packets, s.coflows, s.members,
+         std::thread::hardware_concurrency());
+  for (int m = 0; m <= 1; m++) {
+    if (mode >= 0 && m != mode) continue;
+    s.staged = m;
+    fq_contend_table(policy, params, s, max_threads);
+  }
+  return 0;
+}
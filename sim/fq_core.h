@@ -0,0 +1,774 @@
+/*
+ * sim/fq_core.h Userspace model of the co-flow Fair Queue scheduler
+ *
+ *  This mirrors fq_enqueue()/fq_dequeue() of sch_fq.c closely enough to
+ *  evaluate barrierNumber, timeInterval, quantum and flow_plimit settings
+ *  without reloading the module. Time is virtual : callers pass @now.
+ *
+ *  The engine is fq_engine<Policy>. Policy supplies the steps that differ
+ *  between scheduling disciplines, as static functions :
+ *
+ *   classify(q, f)          a new flow was created, set f->coflow/member
+ *   attach(q, f)            list a flow joins when it becomes active
+ *   enqueue(q, f, skb, now) skb was queued on f (barrier bits, holding)
+ *   select(q)               list to serve next, NULL if all are empty
+ *   credit(q, head, f)      refill/demote f, true if it left @head
+ *   pace(q, f, skb, now)    skb leaves f, compute f->time_next_packet
+ *   unthrottle(q, f)        list a flow returns to once its time came
+ *
+ *  so the compiler inlines the whole dequeue path per policy. The same
+ *  steps can be reached through a fq_policy_ops table of function
+ *  pointers (fq_engine<fq_policy_dyn>), to measure what that costs.
+ *
+ *  Differences with the kernel:
+ *   - flows live in a hash map keyed by the socket stand-in, no gc.
+ *   - skbs come from a fq_skb_pool instead of the skbuff slab caches.
+ *   - out of order packets are inserted in the per flow list by a walk,
+ *     instead of the per flow rb tree.
+ *   - several co-flows, each with its own barrier ring (the kernel has
+ *     one pFlowid[] set). The ring wraps at barrierNumber.
+ *   - co-flow promotion also moves the flow that detected the barrier
+ *     breach (the kernel drops it from its RR list).
+ */
+#ifndef FQ_CORE_H
+#define FQ_CORE_H
+
+#include <algorithm>
+#include <cstdint>
+#include <queue>
+#include <unordered_map>
+#include <vector>
+
+typedef uint8_t u8;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef int64_t s64;
+
+#define NSEC_PER_SEC 1000000000ULL
+
+/* Tunables, same defaults as fq_init() and additional.h */
+struct fq_sim_params {
+  u32 limit = 10000;
+  u32 flow_plimit = 100;
+  u32 quantum = 2 * 1514;
+  u32 initial_quantum = 10 * 1514;
+  u64 flow_refill_delay = 40000000ULL; /* ns, 40 ms */
+  unsigned long flow_max_rate = ~0UL;
+  u32 low_rate_threshold = 550000 / 8;
+  u64 ce_threshold = 1000ULL * ~0U;
+  u8 rate_enable = 1;
+  u32 barrierNumber = 10000;
+  u64 timeInterval = 10000; /* ns member hold before any rate sample */
+  u64 coflow_hold_min = 1000;    /* ns, clamp of the adaptive hold */
+  u64 coflow_hold_max = 1000000; /* ns */
+  u64 aalo_threshold = 10ULL << 20; /* bytes sent to leave Aalo queue 0 */
+  u32 aalo_factor = 10;             /* queue thresholds grow by this */
+  u32 skb_pool_chunk = 4096; /* skbs per pool chunk, 0 : malloc each skb */
+  u32 flows_hint = 0;        /* expected flows, to size flow tables once */
+};
+
+/* Stand-in for struct sk_buff + struct fq_skb_cb */
+struct fq_skb {
+  fq_skb *next; /* flow queue link, or free list link while in the pool */
+  u64 time_to_send;
+  u64 tstamp;  /* EDT, 0 if none */
+  u64 arrival; /* enqueue time, for completion stats */
+  u64 sk;      /* socket stand-in, flow identity */
+  u32 socket_hash;
+  u32 len;
+};
+
+/*
+ * Arena of fixed size skb descriptors. Chunks of skb_pool_chunk skbs are
+ * carved on demand and never returned until the pool dies; free skbs are
+ * chained through skb->next, the link they use while queued on a flow.
+ * Once the pool has grown to the peak backlog, a replay does no heap
+ * allocation for packets.
+ */
+struct fq_skb_pool {
+  std::vector<fq_skb *> chunks;
+  fq_skb *free_list = nullptr;
+  u32 chunk_size;
+
+  explicit fq_skb_pool(u32 n) : chunk_size(n) {}
+
+  ~fq_skb_pool() {
+    for (fq_skb *chunk : chunks) delete[] chunk;
+  }
+
+  fq_skb_pool(const fq_skb_pool &) = delete;
+  fq_skb_pool &operator=(const fq_skb_pool &) = delete;
+
+  fq_skb *alloc() {
+    fq_skb *skb;
+
+    if (!chunk_size) return new fq_skb();
+    if (!free_list) {
+      fq_skb *chunk = new fq_skb[chunk_size];
+
+      chunks.push_back(chunk);
+      for (u32 i = 0; i < chunk_size; i++) {
+        chunk[i].next = free_list;
+        free_list = &chunk[i];
+      }
+    }
+    skb = free_list;
+    free_list = skb->next;
+    *skb = fq_skb();
+    return skb;
+  }
+
+  void free(fq_skb *skb) {
+    if (!chunk_size) {
+      delete skb;
+      return;
+    }
+    skb->next = free_list;
+    free_list = skb;
+  }
+};
+
+/* flow_queue_add() on a (head, tail) skb list ordered by time_to_send */
+static inline void fq_skb_queue_add(fq_skb *&head, fq_skb *&tail,
+                                    fq_skb *skb) {
+  fq_skb **pp;
+
+  if (!head || skb->time_to_send >= tail->time_to_send) {
+    if (!head)
+      head = skb;
+    else
+      tail->next = skb;
+    tail = skb;
+    skb->next = nullptr;
+    return;
+  }
+  for (pp = &head; skb->time_to_send >= (*pp)->time_to_send;
+       pp = &(*pp)->next)
+    ;
+  skb->next = *pp;
+  *pp = skb;
+}
+
+struct fq_flow {
+  fq_skb *head; /* list of skbs for this flow : first skb */
+  fq_skb *tail;
+  u64 age;      /* (now | 1) when flow was emptied, 0 when attached */
+  u64 sk;
+  u32 socket_hash;
+  int qlen;
+  int credit;
+  int coflow;   /* index in q->coflows, -1 if none */
+  int member;   /* index in the co-flow member list */
+  fq_flow *next; /* next pointer in RR lists */
+  u64 time_next_packet;
+};
+
+struct fq_flow_head {
+  fq_flow *first = nullptr;
+  fq_flow *last = nullptr;
+};
+
+/* A co-flow as described by the workload */
+struct fq_coflow_spec {
+  std::vector<u32> members; /* socket_hash of member flows, at most 32 */
+  u64 size;                 /* total bytes, used by clairvoyant policies */
+};
+
+/* Per co-flow state, pFlowid[] / barrier[] / barriercounter_flow[] */
+struct fq_coflow {
+  std::vector<u32> pFlowid;
+  std::vector<u32> barrier;
+  std::vector<u64> barriercounter_flow;
+  u32 barrier_full;
+  u64 dcounter;
+  u64 size;
+  u64 bytes_sent;
+  std::vector<u64> last_dequeue; /* per member */
+  std::vector<u64> gap_ns;       /* EWMA of the member dequeue interval */
+  u64 hold_ns;                   /* last hold given to a member packet */
+};
+
+static inline std::vector<fq_coflow> fq_coflows_create(
+    const fq_sim_params &p, const std::vector<fq_coflow_spec> &specs) {
+  std::vector<fq_coflow> coflows;
+
+  for (const fq_coflow_spec &s : specs) {
+    fq_coflow c;
+
+    c.pFlowid = s.members;
+    c.barrier.assign(std::max(p.barrierNumber, 1U), 0);
+    c.barriercounter_flow.assign(s.members.size(), 0);
+    c.barrier_full =
+        s.members.size() >= 32 ? ~0U : (1U << s.members.size()) - 1;
+    c.dcounter = 0;
+    c.size = s.size;
+    c.bytes_sent = 0;
+    c.last_dequeue.assign(s.members.size(), 0);
+    c.gap_ns.assign(s.members.size(), 0);
+    c.hold_ns = p.timeInterval;
+    coflows.push_back(c);
+  }
+  return coflows;
+}
+
+/* Returns the co-flow index of @socket_hash, -1 if not a member */
+static inline int fq_coflow_lookup(const std::vector<fq_coflow> &coflows,
+                                   u32 socket_hash, int *member) {
+  for (size_t c = 0; c < coflows.size(); c++)
+    for (size_t i = 0; i < coflows[c].pFlowid.size(); i++)
+      if (coflows[c].pFlowid[i] == socket_hash) {
+        if (member) *member = (int)i;
+        return (int)c;
+      }
+  return -1;
+}
+
+/* fq_coflow_sample() : dequeue interval EWMA of @member, idle gaps
+ * capped to the max hold.
+ */
+static inline void fq_coflow_sample(const fq_sim_params &p, fq_coflow &c,
+                                    int member, u64 now) {
+  u64 last = c.last_dequeue[member];
+
+  c.last_dequeue[member] = now;
+  if (!last) return;
+  c.gap_ns[member] -= c.gap_ns[member] >> 3;
+  c.gap_ns[member] += std::min(now - last, p.coflow_hold_max) >> 3;
+}
+
+/* fq_coflow_hold() : time for the slowest member to send its next packet */
+static inline u64 fq_coflow_hold(const fq_sim_params &p, fq_coflow &c) {
+  u64 hold = 0;
+
+  for (u64 gap : c.gap_ns) hold = std::max(hold, gap);
+  if (!hold) hold = p.timeInterval;
+  c.hold_ns = std::min(std::max(hold, p.coflow_hold_min), p.coflow_hold_max);
+  return c.hold_ns;
+}
+
+/* Barrier bookkeeping of one member packet, the enqueue side of
+ * fq_policy_barrier.
+ */
+static inline void fq_coflow_barrier_set(const fq_sim_params &p,
+                                         fq_coflow &c, int member,
+                                         fq_skb *skb, u64 now) {
+  u64 &cnt = c.barriercounter_flow[member];
+
+  c.barrier[cnt % c.barrier.size()] |= 1U << member;
+  skb->time_to_send = now + fq_coflow_hold(p, c);
+  cnt++;
+}
+
+/* True (and the slot is consumed) if all members reached the current
+ * barrier of @c.
+ */
+static inline bool fq_coflow_barrier_breach(fq_coflow &c) {
+  u32 &slot = c.barrier[c.dcounter % c.barrier.size()];
+
+  if (slot != c.barrier_full) return false;
+  slot = 0;
+  c.dcounter++;
+  return true;
+}
+
+struct fq_sim_stats {
+  u64 gc_flows;
+  u64 throttled;
+  u64 ce_mark;
+  u64 flows_plimit;
+  u64 pkts_too_long;
+  u64 drops;
+  u64 promotions;
+};
+
+/* Credit and pacing update when @skb leaves its flow, the tail of
+ * fq_dequeue().
+ */
+static inline void fq_pace(const fq_sim_params &p, fq_sim_stats &st,
+                           int &credit, u64 &time_next_packet,
+                           const fq_skb *skb, u64 now) {
+  unsigned long rate;
+  u32 plen = skb->len;
+
+  credit -= plen;
+  if (!p.rate_enable) return;
+
+  rate = p.flow_max_rate;
+  if (!skb->tstamp) {
+    if (rate <= p.low_rate_threshold) {
+      credit = 0;
+    } else {
+      plen = std::max(plen, p.quantum);
+      if (credit > 0) return;
+    }
+  }
+  if (rate != ~0UL) {
+    u64 len = (u64)plen * NSEC_PER_SEC;
+
+    if (rate) len /= rate;
+    if (len > NSEC_PER_SEC) {
+      len = NSEC_PER_SEC;
+      st.pkts_too_long++;
+    }
+    if (time_next_packet) len -= std::min(len / 2, now - time_next_packet);
+    time_next_packet = now + len;
+  }
+}
+
+/* special value to mark a throttled flow (not on old/new list) */
+static fq_flow fq_throttled_marker;
+
+static inline void fq_flow_set_detached(fq_flow *f, u64 now) {
+  f->age = now | 1ULL;
+}
+
+static inline bool fq_flow_is_detached(const fq_flow *f) {
+  return f->age & 1ULL;
+}
+
+static inline bool fq_flow_is_throttled(const fq_flow *f) {
+  return f->next == &fq_throttled_marker;
+}
+
+static inline void fq_flow_add_tail(fq_flow_head *head, fq_flow *flow) {
+  if (head->first)
+    head->last->next = flow;
+  else
+    head->first = flow;
+  head->last = flow;
+  flow->next = nullptr;
+}
+
+struct fq_sched;
+
+/* Function pointer flavour of a policy, see fq_policy_dyn */
+struct fq_policy_ops {
+  void (*classify)(fq_sched &q, fq_flow *f);
+  fq_flow_head *(*attach)(fq_sched &q, fq_flow *f);
+  void (*enqueue)(fq_sched &q, fq_flow *f, fq_skb *skb, u64 now);
+  fq_flow_head *(*select)(fq_sched &q);
+  bool (*credit)(fq_sched &q, fq_flow_head *head, fq_flow *f);
+  void (*pace)(fq_sched &q, fq_flow *f, fq_skb *skb, u64 now);
+  fq_flow_head *(*unthrottle)(fq_sched &q, fq_flow *f);
+};
+
+/* Scheduler state shared by every policy */
+struct fq_sched {
+  fq_sim_params p;
+
+  fq_flow_head new_flows;
+  fq_flow_head old_flows;
+  fq_flow_head co_flows;
+
+  /* q->delayed : min heap on time_next_packet */
+  typedef std::pair<u64, fq_flow *> delayed_ent;
+  std::priority_queue<delayed_ent, std::vector<delayed_ent>,
+                      std::greater<delayed_ent>>
+      delayed;
+  u64 time_next_delayed_flow = ~0ULL;
+  u64 unthrottle_latency_ns = 0;
+
+  std::unordered_map<u64, fq_flow *> fq_root;
+  u32 flows = 0;
+  u32 inactive_flows = 0;
+  u32 throttled_flows = 0;
+  u32 qlen = 0;
+  u64 backlog = 0;
+
+  std::vector<fq_coflow> coflows;
+  const fq_policy_ops *ops;
+  fq_skb_pool skb_pool;
+
+  fq_sim_stats st = {};
+
+  fq_sched(const fq_sim_params &params,
+           const std::vector<fq_coflow_spec> &specs,
+           const fq_policy_ops *policy_ops = nullptr)
+      : p(params),
+        coflows(fq_coflows_create(params, specs)),
+        ops(policy_ops),
+        skb_pool(params.skb_pool_chunk) {
+    if (p.flows_hint) fq_root.reserve(p.flows_hint);
+  }
+
+  ~fq_sched() {
+    for (auto &it : fq_root) {
+      fq_flow_purge(it.second);
+      delete it.second;
+    }
+  }
+
+  fq_sched(const fq_sched &) = delete;
+  fq_sched &operator=(const fq_sched &) = delete;
+
+  int coflow_lookup(u32 socket_hash, int *member = nullptr) const {
+    return fq_coflow_lookup(coflows, socket_hash, member);
+  }
+
+  void fq_flow_purge(fq_flow *f) {
+    while (f->head) {
+      fq_skb *skb = f->head;
+
+      f->head = skb->next;
+      skb_pool.free(skb);
+    }
+    f->qlen = 0;
+  }
+
+  static void flow_queue_add(fq_flow *flow, fq_skb *skb) {
+    fq_skb_queue_add(flow->head, flow->tail, skb);
+  }
+
+  void fq_flow_set_throttled(fq_flow *f) {
+    delayed.emplace(f->time_next_packet, f);
+    throttled_flows++;
+    st.throttled++;
+    f->next = &fq_throttled_marker;
+    if (time_next_delayed_flow > f->time_next_packet)
+      time_next_delayed_flow = f->time_next_packet;
+  }
+
+  /* Promotecoflows() : move members of co-flow @c found on new/old lists
+   * to co_flows.
+   */
+  void promote_coflows(int c) {
+    fq_flow_head *heads[2] = {&new_flows, &old_flows};
+
+    for (fq_flow_head *head : heads) {
+      fq_flow **pp = &head->first, *prev = nullptr;
+
+      while (*pp) {
+        fq_flow *f = *pp;
+
+        if (f->coflow != c) {
+          prev = f;
+          pp = &f->next;
+          continue;
+        }
+        *pp = f->next;
+        if (head->last == f) head->last = prev;
+        fq_flow_add_tail(&co_flows, f);
+      }
+    }
+    st.promotions++;
+  }
+};
+
+/*
+ * Plain fq : no co-flow awareness. Other policies inherit from it and
+ * only redefine the steps they change.
+ */
+struct fq_policy_fq {
+  static void classify(fq_sched &q, fq_flow *f) { f->coflow = -1; }
+
+  static fq_flow_head *attach(fq_sched &q, fq_flow *f) {
+    return &q.new_flows;
+  }
+
+  static void enqueue(fq_sched &q, fq_flow *f, fq_skb *skb, u64 now) {}
+
+  static fq_flow_head *select(fq_sched &q) {
+    if (q.co_flows.first) return &q.co_flows;
+    if (q.new_flows.first) return &q.new_flows;
+    if (q.old_flows.first) return &q.old_flows;
+    return nullptr;
+  }
+
+  static bool credit(fq_sched &q, fq_flow_head *head, fq_flow *f) {
+    if (f->credit > 0) return false;
+    f->credit += q.p.quantum;
+    head->first = f->next;
+    fq_flow_add_tail(&q.old_flows, f);
+    return true;
+  }
+
+  static void pace(fq_sched &q, fq_flow *f, fq_skb *skb, u64 now) {
+    fq_pace(q.p, q.st, f->credit, f->time_next_packet, skb, now);
+  }
+
+  static fq_flow_head *unthrottle(fq_sched &q, fq_flow *f) {
+    return &q.old_flows;
+  }
+};
+
+/*
+ * Barrier co-flow scheduling, as in sch_fq.c : every packet of a member
+ * sets its bit in the next barrier slot and is held for timeInterval.
+ * When the head flow is a member and its co-flow's current slot is full,
+ * all members move to co_flows together.
+ */
+struct fq_policy_barrier : fq_policy_fq {
+  static void classify(fq_sched &q, fq_flow *f) {
+    f->coflow = q.coflow_lookup(f->socket_hash, &f->member);
+  }
+
+  static void enqueue(fq_sched &q, fq_flow *f, fq_skb *skb, u64 now) {
+    if (f->coflow < 0) return;
+
+    fq_coflow_barrier_set(q.p, q.coflows[f->coflow], f->member, skb, now);
+  }
+
+  static fq_flow_head *select(fq_sched &q) {
+    fq_flow_head *head;
+
+    while ((head = fq_policy_fq::select(q))) {
+      fq_flow *f = head->first;
+
+      if (f->coflow < 0 || head == &q.co_flows) return head;
+      if (!fq_coflow_barrier_breach(q.coflows[f->coflow])) return head;
+      q.promote_coflows(f->coflow);
+    }
+    return nullptr;
+  }
+};
+
+/*
+ * Co-flow ordering policies : members go straight to co_flows, and the
+ * flow of the most urgent co-flow (smallest Key::key()) is brought to
+ * the front of it. Flows that exhaust their credit rotate within
+ * co_flows instead of being demoted.
+ */
+template <class Key>
+struct fq_policy_coflow_order : fq_policy_fq {
+  static void classify(fq_sched &q, fq_flow *f) {
+    f->coflow = q.coflow_lookup(f->socket_hash, &f->member);
+  }
+
+  static fq_flow_head *attach(fq_sched &q, fq_flow *f) {
+    return f->coflow >= 0 ? &q.co_flows : &q.new_flows;
+  }
+
+  static fq_flow_head *unthrottle(fq_sched &q, fq_flow *f) {
+    return f->coflow >= 0 ? &q.co_flows : &q.old_flows;
+  }
+
+  static fq_flow_head *select(fq_sched &q) {
+    fq_flow_head *head = &q.co_flows;
+    fq_flow *f, *prev, *best = head->first, *best_prev = nullptr;
+    u64 best_key;
+
+    if (!best) return fq_policy_fq::select(q);
+
+    best_key = Key::key(q, best->coflow);
+    for (prev = best, f = best->next; f; prev = f, f = f->next) {
+      u64 key = Key::key(q, f->coflow);
+
+      if (key < best_key) {
+        best_key = key;
+        best = f;
+        best_prev = prev;
+      }
+    }
+    if (best_prev) {
+      best_prev->next = best->next;
+      if (head->last == best) head->last = best_prev;
+      best->next = head->first;
+      head->first = best;
+    }
+    return head;
+  }
+
+  static bool credit(fq_sched &q, fq_flow_head *head, fq_flow *f) {
+    if (f->credit > 0) return false;
+    f->credit += q.p.quantum;
+    head->first = f->next;
+    fq_flow_add_tail(head == &q.co_flows ? head : &q.old_flows, f);
+    return true;
+  }
+};
+
+/* Smallest Effective Bottleneck First (Varys). On a single link the
+ * bottleneck is the bytes the co-flow still has to send.
+ */
+struct fq_sebf_key {
+  static u64 key(const fq_sched &q, int coflow) {
+    const fq_coflow &c = q.coflows[coflow];
+
+    return c.size > c.bytes_sent ? c.size - c.bytes_sent : 0;
+  }
+};
+
+/* Aalo discretized co-flow priority : queue k holds co-flows that sent
+ * less than aalo_threshold * aalo_factor^k bytes, FIFO (co-flow index)
+ * within a queue.
+ */
+struct fq_aalo_key {
+  static u64 key(const fq_sched &q, int coflow) {
+    u64 threshold = q.p.aalo_threshold, k = 0;
+
+    while (q.coflows[coflow].bytes_sent >= threshold && k < 9) {
+      threshold *= q.p.aalo_factor;
+      k++;
+    }
+    return (k << 32) | (u32)coflow;
+  }
+};
+
+struct fq_policy_sebf : fq_policy_coflow_order<fq_sebf_key> {};
+
+struct fq_policy_aalo : fq_policy_coflow_order<fq_aalo_key> {};
+
+template <class P>
+inline const fq_policy_ops fq_policy_ops_of = {
+    P::classify, P::attach, P::enqueue, P::select,
+    P::credit,   P::pace,   P::unthrottle,
+};
+
+/* Calls every step through q.ops, the indirect dispatch baseline */
+struct fq_policy_dyn {
+  static void classify(fq_sched &q, fq_flow *f) { q.ops->classify(q, f); }
+
+  static fq_flow_head *attach(fq_sched &q, fq_flow *f) {
+    return q.ops->attach(q, f);
+  }
+
+  static void enqueue(fq_sched &q, fq_flow *f, fq_skb *skb, u64 now) {
+    q.ops->enqueue(q, f, skb, now);
+  }
+
+  static fq_flow_head *select(fq_sched &q) { return q.ops->select(q); }
+
+  static bool credit(fq_sched &q, fq_flow_head *head, fq_flow *f) {
+    return q.ops->credit(q, head, f);
+  }
+
+  static void pace(fq_sched &q, fq_flow *f, fq_skb *skb, u64 now) {
+    q.ops->pace(q, f, skb, now);
+  }
+
+  static fq_flow_head *unthrottle(fq_sched &q, fq_flow *f) {
+    return q.ops->unthrottle(q, f);
+  }
+};
+
+template <class Policy>
+struct fq_engine : fq_sched {
+  using fq_sched::fq_sched;
+
+  fq_flow *fq_classify(const fq_skb *skb, u64 now) {
+    auto it = fq_root.find(skb->sk);
+
+    if (it != fq_root.end()) return it->second;
+
+    fq_flow *f = new fq_flow();
+
+    fq_flow_set_detached(f, now);
+    f->sk = skb->sk;
+    f->socket_hash = skb->socket_hash;
+    f->credit = p.initial_quantum;
+    Policy::classify(*this, f);
+    fq_root.emplace(skb->sk, f);
+    flows++;
+    inactive_flows++;
+    return f;
+  }
+
+  /* Returns false if the skb was dropped (and freed to q->skb_pool) */
+  bool fq_enqueue(fq_skb *skb, u64 now) {
+    fq_flow *f;
+
+    if (qlen >= p.limit) {
+      st.drops++;
+      skb_pool.free(skb);
+      return false;
+    }
+    skb->time_to_send = skb->tstamp ? skb->tstamp : now;
+    skb->arrival = now;
+
+    f = fq_classify(skb, now);
+    if (f->qlen >= (int)p.flow_plimit) {
+      st.flows_plimit++;
+      st.drops++;
+      skb_pool.free(skb);
+      return false;
+    }
+
+    f->qlen++;
+    backlog += skb->len;
+    if (fq_flow_is_detached(f)) {
+      fq_flow_add_tail(Policy::attach(*this, f), f);
+      if (now > f->age + p.flow_refill_delay)
+        f->credit = std::max<int>(f->credit, p.quantum);
+      f->age = 0;
+      inactive_flows--;
+    }
+
+    flow_queue_add(f, skb);
+    Policy::enqueue(*this, f, skb, now);
+    qlen++;
+    return true;
+  }
+
+  void fq_check_throttled(u64 now) {
+    if (time_next_delayed_flow > now) return;
+
+    u64 sample = now - time_next_delayed_flow;
+    unthrottle_latency_ns -= unthrottle_latency_ns >> 3;
+    unthrottle_latency_ns += sample >> 3;
+
+    time_next_delayed_flow = ~0ULL;
+    while (!delayed.empty()) {
+      fq_flow *f = delayed.top().second;
+
+      if (f->time_next_packet > now) {
+        time_next_delayed_flow = f->time_next_packet;
+        break;
+      }
+      delayed.pop();
+      throttled_flows--;
+      fq_flow_add_tail(Policy::unthrottle(*this, f), f);
+    }
+  }
+
+  fq_skb *fq_dequeue(u64 now) {
+    fq_flow_head *head;
+    fq_skb *skb;
+    fq_flow *f;
+
+    if (!qlen) return nullptr;
+
+    fq_check_throttled(now);
+  begin:
+    head = Policy::select(*this);
+    if (!head) return nullptr;
+    f = head->first;
+
+    if (Policy::credit(*this, head, f)) goto begin;
+
+    skb = f->head;
+    if (skb) {
+      u64 time_next_packet = std::max(skb->time_to_send, f->time_next_packet);
+
+      if (now < time_next_packet) {
+        head->first = f->next;
+        f->time_next_packet = time_next_packet;
+        fq_flow_set_throttled(f);
+        goto begin;
+      }
+      if ((s64)(now - time_next_packet - p.ce_threshold) > 0) st.ce_mark++;
+      f->head = skb->next;
+      skb->next = nullptr;
+      f->qlen--;
+      backlog -= skb->len;
+      qlen--;
+    } else {
+      head->first = f->next;
+      /* force a pass through old_flows to prevent starvation */
+      if (head == &new_flows && old_flows.first) {
+        fq_flow_add_tail(&old_flows, f);
+      } else {
+        fq_flow_set_detached(f, now);
+        inactive_flows++;
+      }
+      goto begin;
+    }
+    if (f->coflow >= 0) {
+      coflows[f->coflow].bytes_sent += skb->len;
+      fq_coflow_sample(p, coflows[f->coflow], f->member, now);
+    }
+    Policy::pace(*this, f, skb, now);
+    return skb;
+  }
+};
+
+#endif /* FQ_CORE_H */
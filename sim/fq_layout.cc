@@ -0,0 +1,119 @@
+/*
+ * sim/fq_layout.cc Flow state layout benchmark
+ *
+ *  fq_layout [-f flows] [-P packets per flow] [-n runs]
+ *
+ *  Enqueues @packets packets on each of @flows flows (flows 1 and 2 form
+ *  a co-flow), then drains the scheduler, once with the AoS core
+ *  (fq_engine<fq_policy_barrier>) and once with the SoA store
+ *  (fq_soa_engine). Reports heap bytes per flow once every flow exists,
+ *  skbs excluded, and dequeue throughput.
+ */
+#include <getopt.h>
+
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+
+#include "alloc_count.h"
+#include "fq_soa.h"
+
+struct fq_layout_result {
+  double bytes_per_flow;
+  double dequeue_mpps;
+  u64 packets;
+};
+
+template <class Engine>
+static fq_layout_result fq_layout_run(u32 nflows, u32 packets) {
+  fq_sim_params params;
+  std::vector<fq_coflow_spec> coflows = {{{1, 2}, 0}};
+  fq_layout_result r = {};
+  int64_t before = fq_live_bytes.load();
+  u64 now = 0;
+
+  params.limit = ~0U;
+  params.flows_hint = nflows;
+
+  Engine q(params, coflows);
+
+  for (u32 k = 0; k < packets; k++)
+    for (u32 i = 1; i <= nflows; i++) {
+      fq_skb *skb = q.skb_pool.alloc();
+
+      skb->sk = i;
+      skb->socket_hash = i;
+      skb->len = 1514;
+      q.fq_enqueue(skb, now);
+    }
+
+  int64_t pool = (int64_t)q.skb_pool.chunks.size() * q.skb_pool.chunk_size *
+                 sizeof(fq_skb);
+
+  r.bytes_per_flow =
+      (double)(fq_live_bytes.load() - before - pool) / std::max(nflows, 1U);
+
+  auto start = std::chrono::steady_clock::now();
+
+  while (q.qlen) {
+    fq_skb *skb = q.fq_dequeue(now);
+
+    if (!skb) {
+      if (q.time_next_delayed_flow == ~0ULL) break;
+      now = q.time_next_delayed_flow;
+      continue;
+    }
+    now += 1200; /* 1514 bytes at 10Gbit */
+    r.packets++;
+    q.skb_pool.free(skb);
+  }
+
+  double ns = std::chrono::duration<double, std::nano>(
+                  std::chrono::steady_clock::now() - start)
+                  .count();
+
+  r.dequeue_mpps = ns > 0 ? r.packets * 1000 / ns : 0;
+  return r;
+}
+
+int main(int argc, char **argv) {
+  u32 nflows = 1000000, packets = 2;
+  int runs = 3, c;
+
+  while ((c = getopt(argc, argv, "f:P:n:h")) != -1) {
+    switch (c) {
+      case 'f': nflows = strtoul(optarg, nullptr, 0); break;
+      case 'P': packets = std::max(atoi(optarg), 1); break;
+      case 'n': runs = std::max(atoi(optarg), 1); break;
+      default:
+        fprintf(stderr, "usage: fq_layout [-f flows] [-P packets] [-n runs]\n");
+        return 1;
+    }
+  }
+
+  printf("%u flows, %u packets per flow, best of %d runs\n", nflows, packets,
+         runs);
+  printf("%-8s %14s %14s\n", "layout", "bytes/flow", "dequeue Mpps");
+
+  fq_layout_result aos = {}, soa = {};
+
+  for (int i = 0; i < runs; i++) {
+    fq_layout_result r = fq_layout_run<fq_engine<fq_policy_barrier>>(
+        nflows, packets);
+
+    if (r.dequeue_mpps > aos.dequeue_mpps) aos = r;
+  }
+  printf("%-8s %14.1f %14.2f\n", "aos", aos.bytes_per_flow, aos.dequeue_mpps);
+
+  for (int i = 0; i < runs; i++) {
+    fq_layout_result r = fq_layout_run<fq_soa_engine>(nflows, packets);
+
+    if (r.dequeue_mpps > soa.dequeue_mpps) soa = r;
+  }
+  printf("%-8s %14.1f %14.2f\n", "soa", soa.bytes_per_flow, soa.dequeue_mpps);
+
+  if (aos.packets != soa.packets)
+    fprintf(stderr, "fq_layout: aos sent %" PRIu64 " packets, soa %" PRIu64
+                    "\n", aos.packets, soa.packets);
+  return 0;
+}
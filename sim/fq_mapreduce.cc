@@ -0,0 +1,167 @@
+/*
+ * sim/fq_mapreduce.cc Map/reduce shuffle on one simulated host
+ *
+ *  fq_mapreduce [-p policy,...] [-J jobs] [-T tasks per job] [-B blocks]
+ *               [-b block bytes] [-c think ns] [-g job gap ns] [-R rtt ns]
+ *               [-r rate bits/s] [-w window]
+ *
+ *  Every job is one co-flow of @tasks map tasks, each on its own socket.
+ *  A task computes for @think ns, sends a block, waits for its ack, and
+ *  repeats @blocks times. Jobs start @gap ns apart. Tasks are fq_task
+ *  coroutines driven by fq_host (fq_actors.h) : a task blocked on send()
+ *  resumes from the dequeue of its last packet.
+ *
+ *  Reports job completion time (job start to the last ack of its tasks),
+ *  task resumes and host time per policy.
+ */
+#include <getopt.h>
+
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "fq_actors.h"
+#include "workload.h"
+
+struct fq_mr_spec {
+  u32 jobs = 64;
+  u32 tasks = 32;          /* per job, at most 32 */
+  u32 blocks = 8;
+  u64 block = 256 * 1024;
+  u64 think_ns = 20000;
+  u64 gap_ns = 500000;
+  u64 rtt_ns = 50000;
+  u64 link_rate = 10000000000ULL / 8;
+  u32 window = 10;
+};
+
+struct fq_mr_result {
+  u64 jct_ns;      /* mean */
+  u64 max_jct_ns;
+  u64 makespan_ns;
+  u64 packets;
+  u64 resumes;
+  u64 wall_ns;
+};
+
+template <class Policy>
+static fq_task fq_mr_mapper(fq_host<Policy> &h, fq_socket *s,
+                            const fq_mr_spec &m, u64 start, u64 *done) {
+  co_await h.sleep_until(start);
+  for (u32 i = 0; i < m.blocks; i++) {
+    co_await h.sleep(m.think_ns);
+    co_await h.send(s, m.block);
+    co_await h.ack(s);
+  }
+  *done = std::max(*done, h.now);
+}
+
+template <class Policy>
+static fq_mr_result fq_mr_run(const fq_sim_params &params,
+                              const fq_mr_spec &m) {
+  auto wall = std::chrono::steady_clock::now();
+  std::vector<fq_coflow_spec> coflows(m.jobs);
+  std::vector<u64> done(m.jobs, 0);
+  fq_mr_result r = {};
+
+  for (u32 j = 0; j < m.jobs; j++) {
+    for (u32 t = 0; t < m.tasks; t++)
+      coflows[j].members.push_back(j * m.tasks + t + 1);
+    coflows[j].size = (u64)m.tasks * m.blocks * m.block;
+  }
+
+  fq_host<Policy> h(params, coflows, m.link_rate, m.rtt_ns, 1448, m.window);
+
+  for (u32 j = 0; j < m.jobs; j++)
+    for (u32 t = 0; t < m.tasks; t++) {
+      u32 id = j * m.tasks + t + 1;
+
+      h.spawn(fq_mr_mapper(h, h.socket(id, id), m, j * m.gap_ns, &done[j]));
+    }
+  h.run();
+
+  u64 sum = 0;
+
+  for (u32 j = 0; j < m.jobs; j++) {
+    u64 jct = done[j] - j * m.gap_ns;
+
+    sum += jct;
+    r.max_jct_ns = std::max(r.max_jct_ns, jct);
+  }
+  r.jct_ns = m.jobs ? sum / m.jobs : 0;
+  r.makespan_ns = h.now;
+  r.packets = h.sent_packets;
+  r.resumes = h.resumes;
+  r.wall_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                  std::chrono::steady_clock::now() - wall)
+                  .count();
+  return r;
+}
+
+static fq_mr_result fq_mr_run_policy(int id, const fq_sim_params &params,
+                                     const fq_mr_spec &m) {
+  switch (id) {
+    case FQ_POLICY_BARRIER: return fq_mr_run<fq_policy_barrier>(params, m);
+    case FQ_POLICY_SEBF: return fq_mr_run<fq_policy_sebf>(params, m);
+    case FQ_POLICY_AALO: return fq_mr_run<fq_policy_aalo>(params, m);
+    default: return fq_mr_run<fq_policy_fq>(params, m);
+  }
+}
+
+int main(int argc, char **argv) {
+  std::vector<int> policies;
+  fq_sim_params params;
+  fq_mr_spec m;
+  int c;
+
+  while ((c = getopt(argc, argv, "p:J:T:B:b:c:g:R:r:w:h")) != -1) {
+    switch (c) {
+      case 'p':
+        for (char *name = strtok(optarg, ","); name;
+             name = strtok(nullptr, ",")) {
+          int id = fq_policy_lookup(name);
+
+          if (id < 0) {
+            fprintf(stderr, "fq_mapreduce: unknown policy '%s'\n", name);
+            return 1;
+          }
+          policies.push_back(id);
+        }
+        break;
+      case 'J': m.jobs = std::max(atoi(optarg), 1); break;
+      case 'T': m.tasks = std::min(std::max(atoi(optarg), 1), 32); break;
+      case 'B': m.blocks = std::max(atoi(optarg), 1); break;
+      case 'b': m.block = strtoull(optarg, nullptr, 0); break;
+      case 'c': m.think_ns = strtoull(optarg, nullptr, 0); break;
+      case 'g': m.gap_ns = strtoull(optarg, nullptr, 0); break;
+      case 'R': m.rtt_ns = strtoull(optarg, nullptr, 0); break;
+      case 'r': m.link_rate = strtoull(optarg, nullptr, 0) / 8; break;
+      case 'w': m.window = std::max(atoi(optarg), 1); break;
+      default:
+        fprintf(stderr,
+                "usage: fq_mapreduce [-p policy,...] [-J jobs] [-T tasks] "
+                "[-B blocks] [-b bytes]\n"
+                "                    [-c think_ns] [-g gap_ns] [-R rtt_ns] "
+                "[-r rate] [-w window]\n");
+        return 1;
+    }
+  }
+  if (policies.empty())
+    for (int id = 0; id < FQ_POLICY_MAX; id++) policies.push_back(id);
+
+  printf("%u jobs x %u tasks, %u blocks of %" PRIu64 " bytes per task\n",
+         m.jobs, m.tasks, m.blocks, m.block);
+  printf("%-10s %12s %12s %12s %12s %12s\n", "policy", "mean jct us",
+         "max jct us", "makespan us", "resumes", "wall ms");
+  for (int id : policies) {
+    fq_mr_result r = fq_mr_run_policy(id, params, m);
+
+    printf("%-10s %12.1f %12.1f %12.1f %12" PRIu64 " %12.1f\n",
+           fq_policy_names[id], r.jct_ns / 1e3, r.max_jct_ns / 1e3,
+           r.makespan_ns / 1e3, r.resumes,
+           r.wall_ns / 1e6);
+  }
+  return 0;
+}
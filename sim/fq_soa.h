@@ -0,0 +1,362 @@
+/*
+ * sim/fq_soa.h Structure of arrays flow store for the userspace core
+ *
+ *  struct fq_flow (and the kernel's, ____cacheline_aligned_in_smp) keeps
+ *  every field of a flow together, plus a hash map node per flow. At ten
+ *  million flows that is well over a gigabyte. Here a flow is a dense
+ *  32-bit id : fields read on every dequeue (credit, qlen,
+ *  time_next_packet, co-flow id, RR link, first skb) live in one array
+ *  each, and fields only needed at enqueue or on reuse (sk, socket_hash,
+ *  age, tail, member) are kept apart. RR lists and q->delayed link ids,
+ *  and sk -> id lookup is an open addressing table of ids.
+ *
+ *  fq_soa_engine implements the module's barrier co-flow policy, the
+ *  same decisions as fq_engine<fq_policy_barrier>.
+ */
+#ifndef FQ_SOA_H
+#define FQ_SOA_H
+
+#include "fq_core.h"
+
+#define FQ_SOA_NONE (~0U)
+
+struct fq_soa_head {
+  u32 first = FQ_SOA_NONE;
+  u32 last = FQ_SOA_NONE;
+};
+
+struct fq_soa_flows {
+  /* hot : every dequeue */
+  std::vector<int> credit;
+  std::vector<int> qlen;
+  std::vector<u64> time_next_packet;
+  std::vector<int> coflow; /* -1 if none */
+  std::vector<u32> next;   /* RR link, FQ_SOA_NONE ends a list */
+  std::vector<fq_skb *> head;
+
+  /* cold : enqueue of a new flow, list appends, detach */
+  std::vector<fq_skb *> tail;
+  std::vector<u64> sk;
+  std::vector<u64> age;
+  std::vector<u32> socket_hash;
+  std::vector<u8> member;
+
+  /* sk -> id, linear probing, at most half full */
+  std::vector<u32> index;
+  u32 index_mask = 0;
+
+  u32 count() const { return (u32)credit.size(); }
+
+  void reserve(u32 n) {
+    credit.reserve(n);
+    qlen.reserve(n);
+    time_next_packet.reserve(n);
+    coflow.reserve(n);
+    next.reserve(n);
+    head.reserve(n);
+    tail.reserve(n);
+    sk.reserve(n);
+    age.reserve(n);
+    socket_hash.reserve(n);
+    member.reserve(n);
+    rehash(n);
+  }
+
+  static u32 slot_of(u64 key, u32 mask) {
+    return (u32)((key * 0x9E3779B97F4A7C15ULL) >> 32) & mask;
+  }
+
+  void rehash(u32 n) {
+    u32 size = 16;
+
+    while (size < 2 * (u64)n) size <<= 1;
+    if (size <= index.size()) return;
+    index.assign(size, FQ_SOA_NONE);
+    index_mask = size - 1;
+    for (u32 id = 0; id < count(); id++) {
+      u32 i = slot_of(sk[id], index_mask);
+
+      while (index[i] != FQ_SOA_NONE) i = (i + 1) & index_mask;
+      index[i] = id;
+    }
+  }
+
+  u32 lookup(u64 key) const {
+    if (index.empty()) return FQ_SOA_NONE;
+    for (u32 i = slot_of(key, index_mask);; i = (i + 1) & index_mask) {
+      u32 id = index[i];
+
+      if (id == FQ_SOA_NONE || sk[id] == key) return id;
+    }
+  }
+
+  u32 add(u64 key) {
+    u32 id = count(), i;
+
+    credit.push_back(0);
+    qlen.push_back(0);
+    time_next_packet.push_back(0);
+    coflow.push_back(-1);
+    next.push_back(FQ_SOA_NONE);
+    head.push_back(nullptr);
+    tail.push_back(nullptr);
+    sk.push_back(key);
+    age.push_back(0);
+    socket_hash.push_back(0);
+    member.push_back(0);
+
+    if (2 * (u64)count() > index.size()) rehash(count());
+    for (i = slot_of(key, index_mask); index[i] != FQ_SOA_NONE;
+         i = (i + 1) & index_mask)
+      ;
+    index[i] = id;
+    return id;
+  }
+
+  size_t bytes() const {
+    return credit.capacity() * sizeof(int) + qlen.capacity() * sizeof(int) +
+           time_next_packet.capacity() * sizeof(u64) +
+           coflow.capacity() * sizeof(int) + next.capacity() * sizeof(u32) +
+           head.capacity() * sizeof(fq_skb *) +
+           tail.capacity() * sizeof(fq_skb *) + sk.capacity() * sizeof(u64) +
+           age.capacity() * sizeof(u64) +
+           socket_hash.capacity() * sizeof(u32) +
+           member.capacity() * sizeof(u8) + index.capacity() * sizeof(u32);
+  }
+};
+
+struct fq_soa_engine {
+  fq_sim_params p;
+  fq_soa_flows fl;
+
+  fq_soa_head new_flows;
+  fq_soa_head old_flows;
+  fq_soa_head co_flows;
+
+  typedef std::pair<u64, u32> delayed_ent;
+  std::priority_queue<delayed_ent, std::vector<delayed_ent>,
+                      std::greater<delayed_ent>>
+      delayed;
+  u64 time_next_delayed_flow = ~0ULL;
+  u64 unthrottle_latency_ns = 0;
+
+  u32 inactive_flows = 0;
+  u32 throttled_flows = 0;
+  u32 qlen = 0;
+  u64 backlog = 0;
+
+  std::vector<fq_coflow> coflows;
+  fq_skb_pool skb_pool;
+  fq_sim_stats st = {};
+
+  fq_soa_engine(const fq_sim_params &params,
+                const std::vector<fq_coflow_spec> &specs)
+      : p(params),
+        coflows(fq_coflows_create(params, specs)),
+        skb_pool(params.skb_pool_chunk) {
+    if (p.flows_hint) fl.reserve(p.flows_hint);
+  }
+
+  ~fq_soa_engine() {
+    for (u32 id = 0; id < fl.count(); id++)
+      while (fq_skb *skb = fl.head[id]) {
+        fl.head[id] = skb->next;
+        skb_pool.free(skb);
+      }
+  }
+
+  fq_soa_engine(const fq_soa_engine &) = delete;
+  fq_soa_engine &operator=(const fq_soa_engine &) = delete;
+
+  u32 flows() const { return fl.count(); }
+
+  bool is_detached(u32 id) const { return fl.age[id] & 1ULL; }
+
+  void add_tail(fq_soa_head *head, u32 id) {
+    if (head->first != FQ_SOA_NONE)
+      fl.next[head->last] = id;
+    else
+      head->first = id;
+    head->last = id;
+    fl.next[id] = FQ_SOA_NONE;
+  }
+
+  u32 fq_classify(const fq_skb *skb, u64 now) {
+    u32 id = fl.lookup(skb->sk);
+    int member = 0;
+
+    if (id != FQ_SOA_NONE) return id;
+
+    id = fl.add(skb->sk);
+    fl.age[id] = now | 1ULL;
+    fl.socket_hash[id] = skb->socket_hash;
+    fl.credit[id] = p.initial_quantum;
+    fl.coflow[id] = fq_coflow_lookup(coflows, skb->socket_hash, &member);
+    fl.member[id] = (u8)member;
+    inactive_flows++;
+    return id;
+  }
+
+  /* Returns false if the skb was dropped (and freed to skb_pool) */
+  bool fq_enqueue(fq_skb *skb, u64 now) {
+    u32 id;
+
+    if (qlen >= p.limit) {
+      st.drops++;
+      skb_pool.free(skb);
+      return false;
+    }
+    skb->time_to_send = skb->tstamp ? skb->tstamp : now;
+    skb->arrival = now;
+
+    id = fq_classify(skb, now);
+    if (fl.qlen[id] >= (int)p.flow_plimit) {
+      st.flows_plimit++;
+      st.drops++;
+      skb_pool.free(skb);
+      return false;
+    }
+
+    fl.qlen[id]++;
+    backlog += skb->len;
+    if (is_detached(id)) {
+      add_tail(&new_flows, id);
+      if (now > fl.age[id] + p.flow_refill_delay)
+        fl.credit[id] = std::max<int>(fl.credit[id], p.quantum);
+      fl.age[id] = 0;
+      inactive_flows--;
+    }
+
+    fq_skb_queue_add(fl.head[id], fl.tail[id], skb);
+    if (fl.coflow[id] >= 0)
+      fq_coflow_barrier_set(p, coflows[fl.coflow[id]], fl.member[id], skb,
+                            now);
+    qlen++;
+    return true;
+  }
+
+  void fq_check_throttled(u64 now) {
+    if (time_next_delayed_flow > now) return;
+
+    u64 sample = now - time_next_delayed_flow;
+    unthrottle_latency_ns -= unthrottle_latency_ns >> 3;
+    unthrottle_latency_ns += sample >> 3;
+
+    time_next_delayed_flow = ~0ULL;
+    while (!delayed.empty()) {
+      u32 id = delayed.top().second;
+
+      if (fl.time_next_packet[id] > now) {
+        time_next_delayed_flow = fl.time_next_packet[id];
+        break;
+      }
+      delayed.pop();
+      throttled_flows--;
+      add_tail(&old_flows, id);
+    }
+  }
+
+  void promote_coflows(int c) {
+    fq_soa_head *heads[2] = {&new_flows, &old_flows};
+
+    for (fq_soa_head *head : heads) {
+      u32 *pp = &head->first, prev = FQ_SOA_NONE;
+
+      while (*pp != FQ_SOA_NONE) {
+        u32 id = *pp;
+
+        if (fl.coflow[id] != c) {
+          prev = id;
+          pp = &fl.next[id];
+          continue;
+        }
+        *pp = fl.next[id];
+        if (head->last == id) head->last = prev;
+        add_tail(&co_flows, id);
+      }
+    }
+    st.promotions++;
+  }
+
+  fq_soa_head *select() {
+    for (;;) {
+      fq_soa_head *head = &co_flows;
+
+      if (head->first == FQ_SOA_NONE) {
+        head = &new_flows;
+        if (head->first == FQ_SOA_NONE) {
+          head = &old_flows;
+          if (head->first == FQ_SOA_NONE) return nullptr;
+        }
+      }
+
+      int c = fl.coflow[head->first];
+
+      if (c < 0 || head == &co_flows) return head;
+      if (!fq_coflow_barrier_breach(coflows[c])) return head;
+      promote_coflows(c);
+    }
+  }
+
+  fq_skb *fq_dequeue(u64 now) {
+    fq_soa_head *head;
+    fq_skb *skb;
+    u32 id;
+
+    if (!qlen) return nullptr;
+
+    fq_check_throttled(now);
+  begin:
+    head = select();
+    if (!head) return nullptr;
+    id = head->first;
+
+    if (fl.credit[id] <= 0) {
+      fl.credit[id] += p.quantum;
+      head->first = fl.next[id];
+      add_tail(&old_flows, id);
+      goto begin;
+    }
+
+    skb = fl.head[id];
+    if (skb) {
+      u64 time_next_packet =
+          std::max(skb->time_to_send, fl.time_next_packet[id]);
+
+      if (now < time_next_packet) {
+        head->first = fl.next[id];
+        fl.time_next_packet[id] = time_next_packet;
+        delayed.emplace(time_next_packet, id);
+        throttled_flows++;
+        st.throttled++;
+        if (time_next_delayed_flow > time_next_packet)
+          time_next_delayed_flow = time_next_packet;
+        goto begin;
+      }
+      if ((s64)(now - time_next_packet - p.ce_threshold) > 0) st.ce_mark++;
+      fl.head[id] = skb->next;
+      skb->next = nullptr;
+      fl.qlen[id]--;
+      backlog -= skb->len;
+      qlen--;
+    } else {
+      head->first = fl.next[id];
+      /* force a pass through old_flows to prevent starvation */
+      if (head == &new_flows && old_flows.first != FQ_SOA_NONE) {
+        add_tail(&old_flows, id);
+      } else {
+        fl.age[id] = now | 1ULL;
+        inactive_flows++;
+      }
+      goto begin;
+    }
+    if (fl.coflow[id] >= 0) {
+      coflows[fl.coflow[id]].bytes_sent += skb->len;
+      fq_coflow_sample(p, coflows[fl.coflow[id]], fl.member[id], now);
+    }
+    fq_pace(p, st, fl.credit[id], fl.time_next_packet[id], skb, now);
+    return skb;
+  }
+};
+
+#endif /* FQ_SOA_H */
@@ -0,0 +1,103 @@
+/*
+ * sim/fq_stage.h Per-CPU lockless enqueue staging
+ *
+ *  Userspace twin of FQ_STAGING in sch_fq.c : each producer pushes skbs
+ *  on its own lock free list (skb->next is the link, like llist_add()),
+ *  and flags its bit in a pending mask when the list goes non empty. The
+ *  dequeuing thread takes whole lists (llist_del_all()), restores their
+ *  order and runs fq_enqueue() on the batch, so the scheduler lock is
+ *  taken once per dequeue rather than once per packet.
+ *
+ *  At most @limit skbs wait on one list (FQ_STAGE_LIMIT), push() fails
+ *  beyond that : the module drops, fq_contend makes the producer retry.
+ */
+#ifndef FQ_STAGE_H
+#define FQ_STAGE_H
+
+#include <atomic>
+#include <memory>
+
+#include "fq_core.h"
+
+struct alignas(64) fq_stage {
+  std::atomic<fq_skb *> head{nullptr};
+  u32 staged = 0;           /* producer only */
+  std::atomic<u32> merged{0}; /* consumer only */
+};
+
+class fq_stages {
+ public:
+  explicit fq_stages(u32 ncpus, u32 limit = 1024)
+      : ncpus_(ncpus),
+        limit_(limit),
+        cpus_(new fq_stage[ncpus]),
+        pending_(new std::atomic<u64>[(ncpus + 63) / 64]) {
+    for (u32 w = 0; w < (ncpus + 63) / 64; w++) pending_[w] = 0;
+  }
+
+  /* Producer side, @cpu is owned by the caller. False if its list is full */
+  bool push(u32 cpu, fq_skb *skb) {
+    fq_stage &s = cpus_[cpu];
+    std::atomic<fq_skb *> &head = s.head;
+
+    if (s.staged - s.merged.load(std::memory_order_relaxed) >= limit_)
+      return false;
+    s.staged++;
+    skb->next = head.load(std::memory_order_relaxed);
+    while (!head.compare_exchange_weak(skb->next, skb,
+                                       std::memory_order_release,
+                                       std::memory_order_relaxed))
+      ;
+    if (!skb->next)
+      pending_[cpu / 64].fetch_or(1ULL << (cpu % 64),
+                                  std::memory_order_release);
+    return true;
+  }
+
+  /* Consumer side : enqueues every staged skb into @q, returns how many */
+  template <class Engine>
+  u32 merge(Engine &q, u64 now) {
+    u32 n = 0;
+
+    for (u32 w = 0; w < (ncpus_ + 63) / 64; w++) {
+      /* clear first : a push that finds its list empty sets it again */
+      u64 bits = pending_[w].exchange(0, std::memory_order_acq_rel);
+
+      while (bits) {
+        u32 cpu = w * 64 + __builtin_ctzll(bits);
+        fq_skb *skb = cpus_[cpu].head.exchange(nullptr,
+                                               std::memory_order_acquire);
+        fq_skb *batch = nullptr;
+        u32 k = 0;
+
+        bits &= bits - 1;
+        while (skb) { /* llist_reverse_order() */
+          fq_skb *next = skb->next;
+
+          skb->next = batch;
+          batch = skb;
+          skb = next;
+        }
+        while (batch) {
+          fq_skb *next = batch->next;
+
+          batch->next = nullptr;
+          q.fq_enqueue(batch, now);
+          batch = next;
+          k++;
+        }
+        cpus_[cpu].merged.fetch_add(k, std::memory_order_release);
+        n += k;
+      }
+    }
+    return n;
+  }
+
+ private:
+  u32 ncpus_;
+  u32 limit_;
+  std::unique_ptr<fq_stage[]> cpus_;
+  std::unique_ptr<std::atomic<u64>[]> pending_;
+};
+
+#endif /* FQ_STAGE_H */
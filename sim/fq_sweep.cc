@@ -0,0 +1,243 @@
+/*
+ * sim/fq_sweep.cc Parameter sweep driver for the userspace core
+ *
+ *  fq_sweep -g timeInterval=0:50000:5000 -g quantum=3028,9084 \
+ *           -g flow_plimit=17,100 -g barrierNumber=100,10000 \
+ *           -p barrier,sebf -o out.csv
+ *
+ *  Every point of the cartesian product of the -g lists and -p policies
+ *  is replayed against the same workload, in parallel on all cores, and
+ *  written as one row of a CSV file with one column per tunable and per
+ *  metric. A list is either "a,b,c" or "lo:hi:step".
+ */
+#include <getopt.h>
+
+#include <cinttypes>
+#include <cstring>
+#include <string>
+
+#include "work_pool.h"
+#include "workload.h"
+
+struct fq_param_desc {
+  const char *name;
+  u64 fq_sim_params::*u64_field;
+  u32 fq_sim_params::*u32_field;
+};
+
+static const fq_param_desc fq_param_descs[] = {
+    {"limit", nullptr, &fq_sim_params::limit},
+    {"flow_plimit", nullptr, &fq_sim_params::flow_plimit},
+    {"quantum", nullptr, &fq_sim_params::quantum},
+    {"initial_quantum", nullptr, &fq_sim_params::initial_quantum},
+    {"low_rate_threshold", nullptr, &fq_sim_params::low_rate_threshold},
+    {"barrierNumber", nullptr, &fq_sim_params::barrierNumber},
+    {"timeInterval", &fq_sim_params::timeInterval, nullptr},
+    {"coflow_hold_min", &fq_sim_params::coflow_hold_min, nullptr},
+    {"coflow_hold_max", &fq_sim_params::coflow_hold_max, nullptr},
+    {"flow_refill_delay", &fq_sim_params::flow_refill_delay, nullptr},
+    {"aalo_threshold", &fq_sim_params::aalo_threshold, nullptr},
+    {"aalo_factor", nullptr, &fq_sim_params::aalo_factor},
+    {"flow_max_rate", nullptr, nullptr},
+};
+
+static u64 fq_param_get(const fq_sim_params &p, const fq_param_desc &d) {
+  if (d.u64_field) return p.*d.u64_field;
+  if (d.u32_field) return p.*d.u32_field;
+  return p.flow_max_rate;
+}
+
+static void fq_param_set(fq_sim_params &p, const fq_param_desc &d, u64 v) {
+  if (d.u64_field)
+    p.*d.u64_field = v;
+  else if (d.u32_field)
+    p.*d.u32_field = (u32)v;
+  else
+    p.flow_max_rate = v;
+}
+
+struct fq_grid_axis {
+  const fq_param_desc *desc;
+  std::vector<u64> values;
+};
+
+static bool parse_axis(const char *arg, fq_grid_axis &axis) {
+  const char *eq = strchr(arg, '=');
+  unsigned long long lo, hi, step;
+
+  if (!eq) return false;
+  axis.desc = nullptr;
+  for (const fq_param_desc &d : fq_param_descs)
+    if (strlen(d.name) == (size_t)(eq - arg) && !strncmp(d.name, arg, eq - arg))
+      axis.desc = &d;
+  if (!axis.desc) return false;
+
+  if (sscanf(eq + 1, "%llu:%llu:%llu", &lo, &hi, &step) == 3) {
+    if (!step || lo > hi) return false;
+    /* stops before v wraps when hi is close to UINT64_MAX */
+    for (u64 v = lo;; v += step) {
+      axis.values.push_back(v);
+      if (hi - v < step) break;
+    }
+    return true;
+  }
+  for (const char *p = eq + 1; *p;) {
+    char *end;
+    u64 v = strtoull(p, &end, 0);
+
+    if (end == p) return false;
+    axis.values.push_back(v);
+    p = *end == ',' ? end + 1 : end;
+  }
+  return !axis.values.empty();
+}
+
+static void usage(void) {
+  fprintf(stderr,
+          "usage: fq_sweep [-g name=list]... [-p policy,...] [-t trace]\n"
+          "                [-o out.csv] [-j threads]\n" FQ_WORKLOAD_USAGE
+          "policies:");
+  for (const char *name : fq_policy_names) fprintf(stderr, " %s", name);
+  fprintf(stderr, "\ntunables:");
+  for (const fq_param_desc &d : fq_param_descs) fprintf(stderr, " %s", d.name);
+  fprintf(stderr, "\n");
+}
+
+int main(int argc, char **argv) {
+  static const struct option opts[] = {
+      {"grid", required_argument, nullptr, 'g'},
+      {"trace", required_argument, nullptr, 't'},
+      {"output", required_argument, nullptr, 'o'},
+      {"jobs", required_argument, nullptr, 'j'},
+      {"policy", required_argument, nullptr, 'p'},
+      FQ_WORKLOAD_LONG_OPTS,
+      {nullptr, 0, nullptr, 0},
+  };
+  std::vector<fq_grid_axis> grid;
+  std::vector<int> policies;
+  fq_workload_spec spec;
+  fq_workload w;
+  const char *trace = nullptr, *out = "sweep.csv";
+  unsigned nthreads = std::thread::hardware_concurrency();
+  int c;
+
+  while ((c = getopt_long(argc, argv, "g:t:o:j:p:h", opts, nullptr)) != -1) {
+    switch (c) {
+      case 'g': {
+        fq_grid_axis axis;
+
+        if (!parse_axis(optarg, axis)) {
+          fprintf(stderr, "fq_sweep: bad grid axis '%s'\n", optarg);
+          usage();
+          return 1;
+        }
+        grid.push_back(axis);
+        break;
+      }
+      case 't': trace = optarg; break;
+      case 'o': out = optarg; break;
+      case 'j':
+        if (atoi(optarg) < 1) {
+          fprintf(stderr, "fq_sweep: bad thread count '%s'\n", optarg);
+          usage();
+          return 1;
+        }
+        nthreads = atoi(optarg);
+        break;
+      case 'p':
+        for (char *name = strtok(optarg, ","); name;
+             name = strtok(nullptr, ",")) {
+          int id = fq_policy_lookup(name);
+
+          if (id < 0) {
+            fprintf(stderr, "fq_sweep: unknown policy '%s'\n", name);
+            usage();
+            return 1;
+          }
+          policies.push_back(id);
+        }
+        break;
+      default:
+        if (!fq_workload_parse_opt(c, optarg, spec)) {
+          usage();
+          return 1;
+        }
+    }
+  }
+
+  if (trace) {
+    w.link_rate = spec.link_rate;
+    if (!fq_workload_load(trace, w)) {
+      fprintf(stderr, "fq_sweep: cannot read %s: %s\n", trace, strerror(errno));
+      return 1;
+    }
+  } else {
+    w = fq_workload_generate(spec);
+  }
+
+  if (policies.empty()) policies.push_back(FQ_POLICY_BARRIER);
+
+  /* Expand the grid, last axis varies fastest */
+  std::vector<fq_sim_params> points(1);
+
+  for (const fq_grid_axis &axis : grid) {
+    std::vector<fq_sim_params> next;
+
+    for (const fq_sim_params &p : points)
+      for (u64 v : axis.values) {
+        fq_sim_params np = p;
+
+        fq_param_set(np, *axis.desc, v);
+        next.push_back(np);
+      }
+    points.swap(next);
+  }
+
+  size_t npoints = points.size() * policies.size();
+  std::vector<fq_sim_result> results(npoints);
+  work_pool pool(nthreads);
+  auto start = std::chrono::steady_clock::now();
+
+  pool.run(npoints, [&](size_t i) {
+    results[i] = fq_sim_run_policy(policies[i % policies.size()],
+                                   points[i / policies.size()], w);
+  });
+
+  double secs = std::chrono::duration<double>(
+                    std::chrono::steady_clock::now() - start)
+                    .count();
+
+  FILE *fp = fopen(out, "w");
+
+  if (!fp) {
+    fprintf(stderr, "fq_sweep: cannot write %s: %s\n", out, strerror(errno));
+    return 1;
+  }
+  fprintf(fp, "policy,");
+  for (const fq_param_desc &d : fq_param_descs) fprintf(fp, "%s,", d.name);
+  fprintf(fp,
+          "sent_packets,sent_bytes,drops,flows_plimit,throttled,promotions,"
+          "ce_mark,makespan_ns,cct_ns,max_cct_ns,mean_fct_ns,max_delay_ns,"
+          "wall_ns\n");
+  for (size_t i = 0; i < npoints; i++) {
+    const fq_sim_params &p = points[i / policies.size()];
+    const fq_sim_result &r = results[i];
+
+    fprintf(fp, "%s,", fq_policy_names[policies[i % policies.size()]]);
+    for (const fq_param_desc &d : fq_param_descs)
+      fprintf(fp, "%" PRIu64 ",", fq_param_get(p, d));
+    fprintf(fp,
+            "%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64
+            ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64
+            ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 "\n",
+            r.sent_packets, r.sent_bytes, r.st.drops, r.st.flows_plimit,
+            r.st.throttled, r.st.promotions, r.st.ce_mark, r.makespan_ns,
+            r.cct_ns, r.max_cct_ns, r.mean_fct_ns, r.max_delay_ns,
+            r.wall_ns);
+  }
+  fclose(fp);
+
+  fprintf(stderr, "fq_sweep: %zu points, %zu packets each, %u threads, %.2fs\n",
+          npoints, w.arrivals.size(), nthreads ? nthreads : 1, secs);
+  return 0;
+}
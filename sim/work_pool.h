@@ -0,0 +1,71 @@
+/*
+ * sim/work_pool.h Small work stealing pool
+ *
+ *  Each worker owns a deque of job indexes. Jobs are dealt round robin,
+ *  a worker pops from the back of its own deque and, when empty, steals
+ *  from the front of the others. Sweep points have very uneven cost
+ *  (a tiny flow_plimit drops most of the workload), so static
+ *  partitioning leaves cores idle at the end of a sweep.
+ */
+#ifndef FQ_WORK_POOL_H
+#define FQ_WORK_POOL_H
+
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class work_pool {
+ public:
+  explicit work_pool(unsigned nthreads)
+      : queues_(nthreads ? nthreads : 1) {}
+
+  /* Runs job(i) for every i in [0, njobs), returns when all are done */
+  void run(size_t njobs, const std::function<void(size_t)> &job) {
+    std::vector<std::thread> threads;
+    size_t n = queues_.size();
+
+    for (size_t i = 0; i < njobs; i++) queues_[i % n].jobs.push_back(i);
+
+    for (size_t w = 0; w < n; w++)
+      threads.emplace_back([this, w, n, &job] {
+        size_t i;
+
+        while (pop(w, i) || steal(w, n, i)) job(i);
+      });
+    for (auto &t : threads) t.join();
+  }
+
+ private:
+  struct worker_queue {
+    std::mutex lock;
+    std::deque<size_t> jobs;
+  };
+
+  bool pop(size_t w, size_t &i) {
+    std::lock_guard<std::mutex> g(queues_[w].lock);
+
+    if (queues_[w].jobs.empty()) return false;
+    i = queues_[w].jobs.back();
+    queues_[w].jobs.pop_back();
+    return true;
+  }
+
+  bool steal(size_t w, size_t n, size_t &i) {
+    for (size_t k = 1; k < n; k++) {
+      worker_queue &v = queues_[(w + k) % n];
+      std::lock_guard<std::mutex> g(v.lock);
+
+      if (v.jobs.empty()) continue;
+      i = v.jobs.front();
+      v.jobs.pop_front();
+      return true;
+    }
+    return false;
+  }
+
+  std::vector<worker_queue> queues_;
+};
+
+#endif /* FQ_WORK_POOL_H */
@@ -0,0 +1,310 @@
+/*
+ * sim/workload.h Workloads and the link loop driving the userspace core
+ *
+ *  A workload is a time ordered list of packet arrivals plus the
+ *  co-flows, each a set of member socket_hash values (pFlowid[]). It is
+ *  either generated (co-flows racing against background flows) or read
+ *  from a trace file with one "time_ns sk socket_hash len" per line.
+ *
+ *  fq_sim_run() replays it through fq_engine on a link of fixed rate,
+ *  serving one packet per transmission time like a NIC would.
+ */
+#ifndef FQ_WORKLOAD_H
+#define FQ_WORKLOAD_H
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+
+#include "fq_core.h"
+
+struct fq_arrival {
+  u64 time;
+  u64 sk;
+  u32 socket_hash;
+  u32 len;
+};
+
+struct fq_workload {
+  std::vector<fq_arrival> arrivals;
+  std::vector<fq_coflow_spec> coflows;
+  u64 link_rate = 10000000000ULL / 8; /* bytes per second */
+};
+
+struct fq_workload_spec {
+  u32 flows = 64;        /* background flows */
+  u32 coflows = 1;
+  u32 members = 2;       /* members per co-flow, at most 32 */
+  u32 packets = 1000;    /* packets per flow */
+  u32 len = 1514;
+  double load = 0.9;     /* offered load relative to the link */
+  u64 link_rate = 10000000000ULL / 8;
+  u64 seed = 1;
+};
+
+/* Workload options shared by the sim tools, see fq_workload_parse_opt() */
+#define FQ_WORKLOAD_LONG_OPTS                        \
+  {"flows", required_argument, nullptr, 'F'},        \
+  {"coflows", required_argument, nullptr, 'C'},      \
+  {"members", required_argument, nullptr, 'M'},      \
+  {"packets", required_argument, nullptr, 'P'},      \
+  {"len", required_argument, nullptr, 'L'},          \
+  {"load", required_argument, nullptr, 'l'},         \
+  {"rate", required_argument, nullptr, 'r'},         \
+  {"seed", required_argument, nullptr, 's'}
+
+#define FQ_WORKLOAD_USAGE                                             \
+  "                [--flows N] [--coflows N] [--members N] [--packets N]\n" \
+  "                [--len N] [--load F] [--rate bits/s] [--seed N]\n"
+
+static inline bool fq_workload_parse_opt(int c, const char *arg,
+                                         fq_workload_spec &s) {
+  switch (c) {
+    case 'F': s.flows = atoi(arg); break;
+    case 'C': s.coflows = atoi(arg); break;
+    case 'M': s.members = std::min(atoi(arg), 32); break;
+    case 'P': s.packets = atoi(arg); break;
+    case 'L': s.len = atoi(arg); break;
+    case 'l': s.load = atof(arg); break;
+    case 'r': s.link_rate = strtoull(arg, nullptr, 0) / 8; break;
+    case 's': s.seed = strtoull(arg, nullptr, 0); break;
+    default: return false;
+  }
+  return true;
+}
+
+/* Sums the bytes each co-flow will send, for clairvoyant policies */
+static inline void fq_workload_size_coflows(fq_workload &w) {
+  std::unordered_map<u32, size_t> owner;
+
+  for (size_t c = 0; c < w.coflows.size(); c++) {
+    w.coflows[c].size = 0;
+    for (u32 h : w.coflows[c].members) owner.emplace(h, c);
+  }
+  for (const fq_arrival &a : w.arrivals) {
+    auto it = owner.find(a.socket_hash);
+
+    if (it != owner.end()) w.coflows[it->second].size += a.len;
+  }
+}
+
+/* Co-flow members use sk/socket_hash 1..coflows*members, background flows
+ * follow. Co-flow c sends packets * (c + 1) / coflows packets per member,
+ * so co-flows differ in size.
+ */
+static inline fq_workload fq_workload_generate(const fq_workload_spec &s) {
+  fq_workload w;
+  std::mt19937_64 rng(s.seed);
+  u32 nmembers = s.coflows * s.members;
+  u32 nflows = s.flows + nmembers;
+  double pkt_ns = (double)s.len * NSEC_PER_SEC / s.link_rate;
+  std::exponential_distribution<double> gap(s.load / (pkt_ns * nflows));
+
+  w.link_rate = s.link_rate;
+  w.coflows.resize(s.coflows);
+  for (u32 i = 1; i <= nmembers; i++)
+    w.coflows[(i - 1) / s.members].members.push_back(i);
+
+  w.arrivals.reserve((size_t)nflows * s.packets);
+  for (u32 i = 1; i <= nflows; i++) {
+    u32 packets = s.packets;
+    double t = gap(rng);
+
+    if (i <= nmembers)
+      packets = std::max(1U, s.packets * ((i - 1) / s.members + 1) / s.coflows);
+    for (u32 k = 0; k < packets; k++) {
+      w.arrivals.push_back({(u64)t, i, i, s.len});
+      t += gap(rng);
+    }
+  }
+  std::sort(w.arrivals.begin(), w.arrivals.end(),
+            [](const fq_arrival &a, const fq_arrival &b) {
+              return a.time < b.time;
+            });
+  fq_workload_size_coflows(w);
+  return w;
+}
+
+/* Trace lines : "time_ns sk socket_hash len", '#' starts a comment.
+ * Each "coflow <socket_hash>..." line declares one co-flow.
+ */
+static inline bool fq_workload_load(const char *path, fq_workload &w) {
+  FILE *fp = fopen(path, "r");
+  char line[512];
+
+  if (!fp) return false;
+  while (fgets(line, sizeof(line), fp)) {
+    unsigned long long t, sk;
+    unsigned hash, len;
+
+    if (line[0] == '#') continue;
+    if (!strncmp(line, "coflow", 6)) {
+      fq_coflow_spec c = {};
+      char *p = line + 6, *end;
+
+      for (;;) {
+        unsigned long v = strtoul(p, &end, 0);
+
+        if (end == p) break;
+        if (c.members.size() < 32) c.members.push_back((u32)v);
+        p = end;
+      }
+      w.coflows.push_back(c);
+      continue;
+    }
+    if (sscanf(line, "%llu %llu %u %u", &t, &sk, &hash, &len) == 4)
+      w.arrivals.push_back({t, sk, hash, len});
+  }
+  fclose(fp);
+  std::stable_sort(w.arrivals.begin(), w.arrivals.end(),
+                   [](const fq_arrival &a, const fq_arrival &b) {
+                     return a.time < b.time;
+                   });
+  fq_workload_size_coflows(w);
+  return true;
+}
+
+struct fq_sim_result {
+  u64 sent_packets;
+  u64 sent_bytes;
+  u64 makespan_ns;   /* virtual time when the last packet left */
+  u64 cct_ns;        /* mean co-flow completion : first member arrival
+                      * to last member departure */
+  u64 max_cct_ns;
+  u64 mean_fct_ns;   /* mean completion of non member flows */
+  u64 max_delay_ns;  /* worst sojourn time */
+  u64 wall_ns;       /* host time spent in the replay */
+  fq_sim_stats st;
+};
+
+template <class Policy>
+static fq_sim_result fq_sim_run(const fq_sim_params &params,
+                                const fq_workload &w,
+                                const fq_policy_ops *ops = nullptr) {
+  auto wall = std::chrono::steady_clock::now();
+  fq_engine<Policy> q(params, w.coflows, ops);
+  fq_sim_result r = {};
+  struct flow_track {
+    u64 first, last;
+    int coflow;
+  };
+  std::unordered_map<u64, flow_track> fct; /* keyed by sk */
+  std::vector<std::pair<u64, u64>> cct(w.coflows.size(),
+                                       std::make_pair(~0ULL, 0ULL));
+  size_t idx = 0, n = w.arrivals.size();
+  u64 now = 0;
+
+  while (idx < n || q.qlen) {
+    fq_skb *skb;
+
+    for (; idx < n && w.arrivals[idx].time <= now; idx++) {
+      const fq_arrival &a = w.arrivals[idx];
+
+      skb = q.skb_pool.alloc();
+      skb->sk = a.sk;
+      skb->socket_hash = a.socket_hash;
+      skb->len = a.len;
+      if (q.fq_enqueue(skb, now)) {
+        int c = q.coflow_lookup(a.socket_hash);
+
+        fct.try_emplace(a.sk, flow_track{now, now, c});
+        if (c >= 0) cct[c].first = std::min(cct[c].first, now);
+      }
+    }
+
+    skb = q.fq_dequeue(now);
+    if (skb) {
+      u64 tx = (u64)skb->len * NSEC_PER_SEC / w.link_rate;
+
+      now += tx ? tx : 1;
+      r.sent_packets++;
+      r.sent_bytes += skb->len;
+      r.max_delay_ns = std::max(r.max_delay_ns, now - skb->arrival);
+      flow_track &t = fct[skb->sk];
+
+      t.last = now;
+      if (t.coflow >= 0) cct[t.coflow].second = now;
+      q.skb_pool.free(skb);
+      continue;
+    }
+
+    /* idle link : jump to the next arrival or unthrottle event */
+    u64 next = q.time_next_delayed_flow;
+
+    if (idx < n) next = std::min(next, w.arrivals[idx].time);
+    if (next == ~0ULL) break;
+    now = std::max(now + 1, next);
+  }
+
+  r.makespan_ns = now;
+
+  u64 sum = 0, cnt = 0;
+
+  for (auto &c : cct) {
+    if (c.first == ~0ULL || !c.second) continue;
+    sum += c.second - c.first;
+    r.max_cct_ns = std::max(r.max_cct_ns, c.second - c.first);
+    cnt++;
+  }
+  r.cct_ns = cnt ? sum / cnt : 0;
+
+  sum = cnt = 0;
+  for (auto &it : fct) {
+    if (it.second.coflow >= 0) continue;
+    sum += it.second.last - it.second.first;
+    cnt++;
+  }
+  r.mean_fct_ns = cnt ? sum / cnt : 0;
+  r.st = q.st;
+  r.wall_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                  std::chrono::steady_clock::now() - wall)
+                  .count();
+  return r;
+}
+
+enum fq_policy_id {
+  FQ_POLICY_FQ,
+  FQ_POLICY_BARRIER,
+  FQ_POLICY_SEBF,
+  FQ_POLICY_AALO,
+  FQ_POLICY_MAX
+};
+
+static const char *const fq_policy_names[FQ_POLICY_MAX] = {
+    "fq", "barrier", "sebf", "aalo",
+};
+
+static inline int fq_policy_lookup(const char *name) {
+  for (int i = 0; i < FQ_POLICY_MAX; i++)
+    if (!strcmp(fq_policy_names[i], name)) return i;
+  return -1;
+}
+
+/* Runs @w under policy @id, through function pointers if @dyn */
+static inline fq_sim_result fq_sim_run_policy(int id,
+                                              const fq_sim_params &params,
+                                              const fq_workload &w,
+                                              bool dyn = false) {
+  switch (id) {
+    case FQ_POLICY_BARRIER:
+      return dyn ? fq_sim_run<fq_policy_dyn>(
+                       params, w, &fq_policy_ops_of<fq_policy_barrier>)
+                 : fq_sim_run<fq_policy_barrier>(params, w);
+    case FQ_POLICY_SEBF:
+      return dyn ? fq_sim_run<fq_policy_dyn>(params, w,
+                                             &fq_policy_ops_of<fq_policy_sebf>)
+                 : fq_sim_run<fq_policy_sebf>(params, w);
+    case FQ_POLICY_AALO:
+      return dyn ? fq_sim_run<fq_policy_dyn>(params, w,
+                                             &fq_policy_ops_of<fq_policy_aalo>)
+                 : fq_sim_run<fq_policy_aalo>(params, w);
+    default:
+      return dyn ? fq_sim_run<fq_policy_dyn>(params, w,
+                                             &fq_policy_ops_of<fq_policy_fq>)
+                 : fq_sim_run<fq_policy_fq>(params, w);
+  }
+}
+
+#endif /* FQ_WORKLOAD_H */
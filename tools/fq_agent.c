@@ -0,0 +1,381 @@
+/*
+ * tools/fq_agent.c Per host agent of fq_controller
+ *
+ *  fq_agent -d dev -H handle -c controller[:port] -i id -b link bytes/s
+ *           -C coflow:bytes:key[,key] [-C ...] [-t interval us]
+ *
+ *  Every interval the agent reads the co-flow counters of its fq qdisc
+ *  (one RTM_GETQDISC), credits the bytes dequeued since the last read to
+ *  the co-flow installed as class <handle>:1, and reports its unfinished
+ *  co-flows to the controller. On an ORDER it installs the first co-flow
+ *  of the list it still has bytes for : the member keys through
+ *  TCA_FQ_CLASS_KEYS and the rate, split over the members, through
+ *  TCA_FQ_COFLOW_MAX_RATE. bytes 0 is a co-flow of unknown size, which
+ *  never finishes.
+ */
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/gen_stats.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+#include "../fq_uapi.h"
+#include "fq_ctl.h"
+
+struct fq_agent_coflow {
+  __u32 id;
+  __u64 size; /* 0 : unknown */
+  __u64 sent;
+  __u64 keys[FQ_COFLOW_MEMBERS];
+  int nkeys;
+};
+
+struct fq_agent {
+  int nl;
+  int ifindex;
+  __u32 handle;
+  struct fq_agent_coflow coflows[FQ_CTL_ENTRIES];
+  int n;
+  int installed; /* index in coflows, -1 : none */
+  __u32 rate;    /* per member, as last set */
+  __u64 coflow_bytes;
+  __u64 rtt_ns;
+  __u64 orders;
+};
+
+struct fq_agent_req {
+  struct nlmsghdr nlh;
+  struct tcmsg tcm;
+  char attrs[256];
+};
+
+static volatile sig_atomic_t fq_agent_stop;
+
+static void fq_agent_sigint(int sig) { fq_agent_stop = 1; }
+
+static uint64_t fq_agent_now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int fq_agent_done(const struct fq_agent_coflow *c) {
+  return c->size && c->sent >= c->size;
+}
+
+static void fq_agent_init(struct fq_agent_req *r, const struct fq_agent *a,
+                          int type, int flags, __u32 parent, __u32 handle) {
+  memset(r, 0, sizeof(*r));
+  r->nlh.nlmsg_len = NLMSG_LENGTH(sizeof(r->tcm));
+  r->nlh.nlmsg_type = type;
+  r->nlh.nlmsg_flags = NLM_F_REQUEST | flags;
+  r->tcm.tcm_family = AF_UNSPEC;
+  r->tcm.tcm_ifindex = a->ifindex;
+  r->tcm.tcm_parent = parent;
+  r->tcm.tcm_handle = handle;
+}
+
+static struct rtattr *fq_agent_put(struct fq_agent_req *r, int type,
+                                   const void *data, int len) {
+  struct rtattr *rta = (void *)r + NLMSG_ALIGN(r->nlh.nlmsg_len);
+
+  rta->rta_type = type;
+  rta->rta_len = RTA_LENGTH(len);
+  if (len) memcpy(RTA_DATA(rta), data, len);
+  r->nlh.nlmsg_len = NLMSG_ALIGN(r->nlh.nlmsg_len) + RTA_ALIGN(rta->rta_len);
+  return rta;
+}
+
+/* coflow_bytes out of an RTM_NEWQDISC answer, -ENOENT on a stock fq */
+static int fq_agent_parse(struct fq_agent *a, struct nlmsghdr *nlh) {
+  struct tcmsg *tcm = NLMSG_DATA(nlh);
+  int len = nlh->nlmsg_len - NLMSG_LENGTH(sizeof(*tcm));
+  struct rtattr *rta, *st;
+
+  for (rta = TCA_RTA(tcm); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+    int slen = RTA_PAYLOAD(rta);
+
+    if (rta->rta_type != TCA_STATS2) continue;
+    for (st = RTA_DATA(rta); RTA_OK(st, slen); st = RTA_NEXT(st, slen)) {
+      if (st->rta_type != TCA_STATS_APP ||
+          RTA_PAYLOAD(st) < offsetof(struct tc_fq_coflow_qd_stats,
+                                     coflow_packets))
+        continue;
+      memcpy(&a->coflow_bytes,
+             (char *)RTA_DATA(st) +
+                 offsetof(struct tc_fq_coflow_qd_stats, coflow_bytes),
+             sizeof(a->coflow_bytes));
+      return 0;
+    }
+  }
+  return -ENOENT;
+}
+
+/* Sends a request and waits for its answer or ack, 0 or -errno */
+static int fq_agent_talk(struct fq_agent *a, struct fq_agent_req *r) {
+  static __u32 seq;
+  char buf[8192];
+  ssize_t len;
+  struct nlmsghdr *nlh;
+
+  r->nlh.nlmsg_seq = ++seq;
+  if (send(a->nl, r, r->nlh.nlmsg_len, 0) < 0) return -errno;
+
+  for (;;) {
+    len = recv(a->nl, buf, sizeof(buf), 0);
+    if (len < 0) {
+      if (errno == EINTR) continue;
+      return -errno;
+    }
+    for (nlh = (struct nlmsghdr *)buf; NLMSG_OK(nlh, len);
+         nlh = NLMSG_NEXT(nlh, len)) {
+      if (nlh->nlmsg_seq != seq) continue;
+      if (nlh->nlmsg_type == NLMSG_ERROR)
+        return ((struct nlmsgerr *)NLMSG_DATA(nlh))->error;
+      if (nlh->nlmsg_type == RTM_NEWQDISC) return fq_agent_parse(a, nlh);
+    }
+  }
+}
+
+/* Credits the co-flow bytes dequeued since the last read, 0 or -errno */
+static int fq_agent_poll_stats(struct fq_agent *a) {
+  struct fq_agent_req r;
+  __u64 last = a->coflow_bytes;
+  int err;
+
+  fq_agent_init(&r, a, RTM_GETQDISC, 0, 0, a->handle);
+  err = fq_agent_talk(a, &r);
+  if (err) return err;
+  /* the counter restarts with the qdisc */
+  if (a->installed >= 0 && a->coflow_bytes >= last)
+    a->coflows[a->installed].sent += a->coflow_bytes - last;
+  return 0;
+}
+
+static int fq_agent_install(struct fq_agent *a, int idx, __u32 rate) {
+  __u64 keys[FQ_COFLOW_MEMBERS];
+  struct fq_agent_req r;
+  struct rtattr *opts;
+  int i, err;
+
+  if (idx != a->installed) {
+    for (i = 0; i < FQ_COFLOW_MEMBERS; i++)
+      keys[i] = idx >= 0 && i < a->coflows[idx].nkeys ? a->coflows[idx].keys[i]
+                                                      : FQ_COFLOW_KEY_NONE;
+    fq_agent_init(&r, a, RTM_NEWTCLASS, NLM_F_CREATE | NLM_F_ACK, a->handle,
+                  TC_H_MAKE(a->handle, FQ_COFLOW_MINOR));
+    fq_agent_put(&r, TCA_KIND, "fq", 3);
+    opts = fq_agent_put(&r, TCA_OPTIONS, NULL, 0);
+    fq_agent_put(&r, TCA_FQ_CLASS_KEYS, keys, sizeof(keys));
+    opts->rta_len = (void *)&r + r.nlh.nlmsg_len - (void *)opts;
+    err = fq_agent_talk(a, &r);
+    if (err) return err;
+    a->installed = idx;
+  }
+
+  /* the qdisc paces each member flow, the order is for the co-flow */
+  if (idx >= 0 && rate != ~0U && a->coflows[idx].nkeys)
+    rate /= a->coflows[idx].nkeys;
+  if (rate == a->rate) return 0;
+
+  fq_agent_init(&r, a, RTM_NEWQDISC, NLM_F_ACK, TC_H_UNSPEC, a->handle);
+  fq_agent_put(&r, TCA_KIND, "fq", 3);
+  opts = fq_agent_put(&r, TCA_OPTIONS, NULL, 0);
+  fq_agent_put(&r, TCA_FQ_COFLOW_MAX_RATE, &rate, sizeof(rate));
+  opts->rta_len = (void *)&r + r.nlh.nlmsg_len - (void *)opts;
+  err = fq_agent_talk(a, &r);
+  if (!err) a->rate = rate;
+  return err;
+}
+
+static void fq_agent_report(struct fq_agent *a, int udp, __u32 id,
+                            __u64 capacity) {
+  static __u32 seq;
+  char buf[sizeof(struct fq_ctl_hdr) +
+           FQ_CTL_ENTRIES * sizeof(struct fq_ctl_report)];
+  struct fq_ctl_hdr *h = (void *)buf;
+  struct fq_ctl_report *e = (void *)(h + 1);
+  int i;
+
+  memset(h, 0, sizeof(*h));
+  h->magic = FQ_CTL_MAGIC;
+  h->type = FQ_CTL_REPORT;
+  h->agent = id;
+  h->seq = ++seq;
+  h->ts_ns = fq_agent_now();
+  h->capacity = capacity;
+  h->rtt_ns = a->rtt_ns;
+  for (i = 0; i < a->n; i++) {
+    const struct fq_agent_coflow *c = &a->coflows[i];
+
+    if (fq_agent_done(c)) continue;
+    e->coflow = c->id;
+    e->pad = 0;
+    e->sent = c->sent;
+    e->remaining = c->size ? c->size - c->sent : ~0ULL;
+    e++;
+    h->count++;
+  }
+  send(udp, buf, (char *)e - buf, 0);
+}
+
+/* Installs the first unfinished co-flow of an ORDER */
+static void fq_agent_order(struct fq_agent *a, const char *buf, ssize_t len) {
+  const struct fq_ctl_hdr *h = (const void *)buf;
+  const struct fq_ctl_order *o = (const void *)(h + 1);
+  int i, j, idx = -1, err;
+  __u32 rate = ~0U;
+
+  if (len < (ssize_t)sizeof(*h) || h->magic != FQ_CTL_MAGIC ||
+      h->type != FQ_CTL_ORDER ||
+      len < (ssize_t)(sizeof(*h) + h->count * sizeof(*o)))
+    return;
+
+  if (h->echo_ns) a->rtt_ns = fq_agent_now() - h->echo_ns;
+  a->orders++;
+
+  for (i = 0; i < h->count && idx < 0; i++) {
+    for (j = 0; j < a->n; j++) {
+      if (a->coflows[j].id != o[i].coflow || fq_agent_done(&a->coflows[j]))
+        continue;
+      idx = j;
+      rate = o[i].rate;
+      break;
+    }
+  }
+  err = fq_agent_install(a, idx, rate);
+  if (err) fprintf(stderr, "fq_agent: install: %s\n", strerror(-err));
+}
+
+/* coflow:bytes:key[,key] */
+static int fq_agent_parse_coflow(char *s, struct fq_agent_coflow *c) {
+  char *end;
+
+  memset(c, 0, sizeof(*c));
+  c->id = strtoul(s, &end, 0);
+  if (*end != ':') return -1;
+  c->size = strtoull(end + 1, &end, 0);
+  if (*end != ':') return -1;
+  s = end + 1;
+  while (*s && c->nkeys < FQ_COFLOW_MEMBERS) {
+    c->keys[c->nkeys++] = strtoull(s, &end, 0);
+    if (end == s || (*end && *end != ',')) return -1;
+    s = *end ? end + 1 : end;
+  }
+  return *s || !c->nkeys ? -1 : 0;
+}
+
+static void fq_agent_usage(void) {
+  fprintf(stderr,
+          "usage: fq_agent -d dev -H handle -c controller[:port] -i id "
+          "-b bytes/s\n"
+          "                -C coflow:bytes:key[,key] [-C ...] "
+          "[-t interval_us]\n");
+}
+
+int main(int argc, char **argv) {
+  static struct fq_agent a = {.installed = -1, .rate = ~0U};
+  struct sockaddr_in ctl = {.sin_family = AF_INET,
+                            .sin_port = htons(FQ_CTL_PORT)};
+  int interval_us = 1000, udp, c, have_ctl = 0;
+  __u64 capacity = 0, next, now, last_print;
+  __u32 id = 0;
+  char *port;
+
+  while ((c = getopt(argc, argv, "d:H:c:i:b:C:t:h")) != -1) {
+    switch (c) {
+      case 'd': a.ifindex = if_nametoindex(optarg); break;
+      case 'H': a.handle = strtoul(optarg, NULL, 16) << 16; break;
+      case 'c':
+        port = strchr(optarg, ':');
+        if (port) {
+          *port++ = '\0';
+          ctl.sin_port = htons(atoi(port));
+        }
+        have_ctl = inet_pton(AF_INET, optarg, &ctl.sin_addr) == 1;
+        break;
+      case 'i': id = strtoul(optarg, NULL, 0); break;
+      case 'b': capacity = strtoull(optarg, NULL, 0); break;
+      case 'C':
+        if (a.n == FQ_CTL_ENTRIES ||
+            fq_agent_parse_coflow(optarg, &a.coflows[a.n])) {
+          fprintf(stderr, "fq_agent: bad co-flow, or more than %d\n",
+                  FQ_CTL_ENTRIES);
+          return 1;
+        }
+        a.n++;
+        break;
+      case 't': interval_us = atoi(optarg) > 0 ? atoi(optarg) : 1000; break;
+      default: fq_agent_usage(); return 1;
+    }
+  }
+  if (!a.ifindex || !a.handle || !have_ctl || !capacity) {
+    fq_agent_usage();
+    return 1;
+  }
+
+  a.nl = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+  udp = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  if (a.nl < 0 || udp < 0 || connect(udp, (void *)&ctl, sizeof(ctl))) {
+    fprintf(stderr, "fq_agent: socket: %s\n", strerror(errno));
+    return 1;
+  }
+  if (fq_agent_poll_stats(&a)) {
+    fprintf(stderr, "fq_agent: no co-flow fq qdisc %x: on this device\n",
+            a.handle >> 16);
+    return 1;
+  }
+
+  signal(SIGINT, fq_agent_sigint);
+  signal(SIGTERM, fq_agent_sigint);
+  next = last_print = fq_agent_now();
+
+  while (!fq_agent_stop) {
+    struct pollfd pfd = {.fd = udp, .events = POLLIN};
+    char buf[sizeof(struct fq_ctl_hdr) +
+             FQ_CTL_ENTRIES * sizeof(struct fq_ctl_order)];
+    struct timespec timeout;
+
+    now = fq_agent_now();
+    if (now >= next) {
+      next += interval_us * 1000ULL;
+      if (next < now) next = now + interval_us * 1000ULL;
+      fq_agent_poll_stats(&a);
+      fq_agent_report(&a, udp, id, capacity);
+    }
+    if (now - last_print >= 1000000000ULL) {
+      last_print = now;
+      printf("agent %u: co-flow %d installed, %" PRIu64 " orders, "
+             "control latency %.3f ms\n",
+             id, a.installed >= 0 ? (int)a.coflows[a.installed].id : -1,
+             (uint64_t)a.orders, a.rtt_ns / 1e6);
+      fflush(stdout);
+    }
+
+    timeout.tv_sec = (next - now) / 1000000000ULL;
+    timeout.tv_nsec = (next - now) % 1000000000ULL;
+    if (ppoll(&pfd, 1, &timeout, NULL) > 0) {
+      ssize_t len = recv(udp, buf, sizeof(buf), 0);
+
+      if (len > 0) fq_agent_order(&a, buf, len);
+    }
+  }
+
+  fq_agent_install(&a, -1, ~0U);
+  return 0;
+}
@@ -0,0 +1,401 @@
+/*
+ * tools/fq_cfg.c Set the co-flow configuration of an fq qdisc
+ *
+ *  fq_cfg -d dev -H handle [-n hold_min ns] [-x hold_max ns] [-m key,key]
+ *         [-e release grid ns] [-p member rate B/s] [-R rule]...
+ *         [-g none|dscp|flowlabel] [-s stamped tag]
+ *         [-w infer window ns] [-P infer port shift]
+ *  fq_cfg -d dev -H handle -r changes/s -t seconds
+ *
+ *  The first form sends the hold clamps (TCA_FQ_COFLOW_HOLD_MIN/MAX) as a
+ *  qdisc change and the member keys (TCA_FQ_CLASS_KEYS : socket cookies,
+ *  or FQ_COFLOW_KEY_ORPHAN | orphan hash) as a change of class <handle>:1,
+ *  which stock tc cannot express. The second form is a stress test : it
+ *  alternates two hold clamps and two member sets at the given rate and
+ *  reports the changes the kernel acknowledged, to run while the qdisc
+ *  forwards traffic.
+ *
+ *  -e sets the EDT release grid (TCA_FQ_COFLOW_RELEASE_GRID), 0 goes back
+ *  to hold mode. -p caps the pacing rate of member flows
+ *  (TCA_FQ_COFLOW_MAX_RATE), 4294967295 lifts the cap. -g selects the
+ *  header field orphan traffic is tagged with (TCA_FQ_COFLOW_TAG), -s the
+ *  tag written on member packets, 0 for none (TCA_FQ_COFLOW_TAG_STAMP).
+ *  -w turns on co-flow inference with the given start window, 0 turns it
+ *  off (TCA_FQ_COFLOW_INFER_WINDOW), -P sets the low port bits ignored
+ *  when comparing destination ports (TCA_FQ_COFLOW_INFER_PORT_SHIFT).
+ *
+ *  Each -R adds an orphan co-flow rule (TCA_FQ_COFLOW_RULES), the set
+ *  replaces the table of the qdisc ; -R none clears it. A rule is
+ *
+ *	key=K[,mark=M[/MASK]][,proto=udp|tcp|N][,sport=P][,dport=P]
+ *	     [,src=ADDR][,dst=ADDR]
+ *
+ *  with IPv4 or IPv6 addresses (not both in one rule).
+ */
+#include <arpa/inet.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+#include "../fq_uapi.h"
+
+struct fq_cfg_req {
+  struct nlmsghdr nlh;
+  struct tcmsg tcm;
+  char attrs[4096];
+};
+
+static uint64_t fq_cfg_now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static struct rtattr *fq_cfg_put(struct fq_cfg_req *r, int type,
+                                 const void *data, int len) {
+  struct rtattr *rta = (void *)r + NLMSG_ALIGN(r->nlh.nlmsg_len);
+
+  rta->rta_type = type;
+  rta->rta_len = RTA_LENGTH(len);
+  if (len) memcpy(RTA_DATA(rta), data, len);
+  r->nlh.nlmsg_len = NLMSG_ALIGN(r->nlh.nlmsg_len) + RTA_ALIGN(rta->rta_len);
+  return rta;
+}
+
+static void fq_cfg_nest_end(struct fq_cfg_req *r, struct rtattr *nest) {
+  nest->rta_len = (void *)r + r->nlh.nlmsg_len - (void *)nest;
+}
+
+/* Sends the request and waits for its ack, 0 or -errno */
+static int fq_cfg_talk(int nl, struct fq_cfg_req *r) {
+  static __u32 seq;
+  char buf[4096];
+  ssize_t len;
+  struct nlmsghdr *nlh;
+
+  r->nlh.nlmsg_seq = ++seq;
+  if (send(nl, r, r->nlh.nlmsg_len, 0) < 0) return -errno;
+
+  for (;;) {
+    len = recv(nl, buf, sizeof(buf), 0);
+    if (len < 0) {
+      if (errno == EINTR) continue;
+      return -errno;
+    }
+    for (nlh = (struct nlmsghdr *)buf; NLMSG_OK(nlh, len);
+         nlh = NLMSG_NEXT(nlh, len)) {
+      if (nlh->nlmsg_seq != seq || nlh->nlmsg_type != NLMSG_ERROR) continue;
+      return ((struct nlmsgerr *)NLMSG_DATA(nlh))->error;
+    }
+  }
+}
+
+static void fq_cfg_init(struct fq_cfg_req *r, int type, int flags, int ifindex,
+                        __u32 parent, __u32 handle) {
+  memset(r, 0, sizeof(*r));
+  r->nlh.nlmsg_len = NLMSG_LENGTH(sizeof(r->tcm));
+  r->nlh.nlmsg_type = type;
+  r->nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK | flags;
+  r->tcm.tcm_family = AF_UNSPEC;
+  r->tcm.tcm_ifindex = ifindex;
+  r->tcm.tcm_parent = parent;
+  r->tcm.tcm_handle = handle;
+}
+
+/* One u32 qdisc attribute to send */
+struct fq_cfg_opt {
+  int type;
+  __u32 val;
+};
+
+#define FQ_CFG_OPTS 16
+
+static int fq_cfg_hold(int nl, int ifindex, __u32 handle,
+                       const struct fq_cfg_opt *u32s, int n,
+                       const struct tc_fq_coflow_rule *rules, int nrules) {
+  struct fq_cfg_req r;
+  struct rtattr *opts;
+  int i;
+
+  fq_cfg_init(&r, RTM_NEWQDISC, 0, ifindex, 0, handle);
+  /* no parent : the qdisc is found by its handle */
+  r.tcm.tcm_parent = TC_H_UNSPEC;
+  fq_cfg_put(&r, TCA_KIND, "fq", 3);
+  opts = fq_cfg_put(&r, TCA_OPTIONS, NULL, 0);
+  for (i = 0; i < n; i++)
+    fq_cfg_put(&r, u32s[i].type, &u32s[i].val, sizeof(u32s[i].val));
+  if (nrules >= 0)
+    fq_cfg_put(&r, TCA_FQ_COFLOW_RULES, rules, nrules * sizeof(*rules));
+  fq_cfg_nest_end(&r, opts);
+  return fq_cfg_talk(nl, &r);
+}
+
+static int fq_cfg_members(int nl, int ifindex, __u32 handle,
+                          const __u64 *members) {
+  struct fq_cfg_req r;
+  struct rtattr *opts;
+
+  fq_cfg_init(&r, RTM_NEWTCLASS, NLM_F_CREATE, ifindex, handle,
+              TC_H_MAKE(handle, FQ_COFLOW_MINOR));
+  fq_cfg_put(&r, TCA_KIND, "fq", 3);
+  opts = fq_cfg_put(&r, TCA_OPTIONS, NULL, 0);
+  fq_cfg_put(&r, TCA_FQ_CLASS_KEYS, members,
+             FQ_COFLOW_MEMBERS * sizeof(*members));
+  fq_cfg_nest_end(&r, opts);
+  return fq_cfg_talk(nl, &r);
+}
+
+static int fq_cfg_stress(int nl, int ifindex, __u32 handle, int rate,
+                         int seconds) {
+  static const __u32 holds[2][2] = {{1000, 1000000}, {5000, 200000}};
+  __u64 members[2][FQ_COFLOW_MEMBERS];
+  struct fq_cfg_opt opts[2];
+  uint64_t start = fq_cfg_now(), next = start, end, now;
+  uint64_t step = 1000000000ULL / rate, done = 0, failed = 0;
+  int i, err;
+
+  end = start + seconds * 1000000000ULL;
+  for (i = 0; i < FQ_COFLOW_MEMBERS; i++) {
+    members[0][i] = i + 1;
+    members[1][i] = FQ_COFLOW_KEY_NONE;
+  }
+
+  while ((now = fq_cfg_now()) < end) {
+    if (now < next) {
+      struct timespec ts = {(next - now) / 1000000000ULL,
+                            (next - now) % 1000000000ULL};
+
+      nanosleep(&ts, NULL);
+      continue;
+    }
+    next += step;
+
+    /* even changes move the clamps, odd ones the members */
+    i = (done + failed) / 2 % 2;
+    if ((done + failed) % 2)
+      err = fq_cfg_members(nl, ifindex, handle, members[i]);
+    else {
+      opts[0] = (struct fq_cfg_opt){TCA_FQ_COFLOW_HOLD_MIN, holds[i][0]};
+      opts[1] = (struct fq_cfg_opt){TCA_FQ_COFLOW_HOLD_MAX, holds[i][1]};
+      err = fq_cfg_hold(nl, ifindex, handle, opts, 2, NULL, -1);
+    }
+    if (err) {
+      if (!failed)
+        fprintf(stderr, "fq_cfg: change refused: %s\n", strerror(-err));
+      failed++;
+    } else {
+      done++;
+    }
+  }
+
+  now = fq_cfg_now();
+  printf("%" PRIu64 " changes acknowledged, %" PRIu64 " refused, %.0f/s\n",
+         done, failed, done / ((now - start) / 1e9));
+  return failed ? 1 : 0;
+}
+
+static int fq_cfg_parse_members(const char *s, __u64 *members) {
+  char *end;
+  int i;
+
+  for (i = 0; i < FQ_COFLOW_MEMBERS; i++) members[i] = FQ_COFLOW_KEY_NONE;
+  for (i = 0; i < FQ_COFLOW_MEMBERS && *s; i++) {
+    members[i] = strtoull(s, &end, 0);
+    if (end == s || (*end && *end != ',')) return -1;
+    s = *end ? end + 1 : end;
+  }
+  return *s ? -1 : 0;
+}
+
+static int fq_cfg_parse_addr(const char *s, struct tc_fq_coflow_rule *rule,
+                             __be32 *addr) {
+  int family = strchr(s, ':') ? AF_INET6 : AF_INET;
+
+  if (rule->family && rule->family != family) return -1;
+  rule->family = family;
+  return inet_pton(family, s, addr) == 1 ? 0 : -1;
+}
+
+static int fq_cfg_parse_rule(char *s, struct tc_fq_coflow_rule *rule) {
+  char *tok, *val, *end;
+  int has_key = 0;
+
+  memset(rule, 0, sizeof(*rule));
+  for (tok = strtok(s, ","); tok; tok = strtok(NULL, ",")) {
+    val = strchr(tok, '=');
+    if (!val) return -1;
+    *val++ = '\0';
+
+    if (!strcmp(tok, "key")) {
+      rule->key = strtoull(val, &end, 0);
+      has_key = 1;
+    } else if (!strcmp(tok, "mark")) {
+      rule->mark = strtoul(val, &end, 0);
+      rule->mark_mask = ~0U;
+      if (*end == '/') rule->mark_mask = strtoul(end + 1, &end, 0);
+    } else if (!strcmp(tok, "proto")) {
+      if (!strcmp(val, "udp")) {
+        rule->proto = IPPROTO_UDP;
+        end = val + 3;
+      } else if (!strcmp(val, "tcp")) {
+        rule->proto = IPPROTO_TCP;
+        end = val + 3;
+      } else {
+        rule->proto = strtoul(val, &end, 0);
+      }
+    } else if (!strcmp(tok, "sport")) {
+      rule->sport = htons(strtoul(val, &end, 0));
+    } else if (!strcmp(tok, "dport")) {
+      rule->dport = htons(strtoul(val, &end, 0));
+    } else if (!strcmp(tok, "src") || !strcmp(tok, "dst")) {
+      if (fq_cfg_parse_addr(val, rule,
+                            tok[0] == 's' ? rule->saddr : rule->daddr))
+        return -1;
+      continue;
+    } else {
+      return -1;
+    }
+    if (end == val || *end) return -1;
+  }
+  return has_key ? 0 : -1;
+}
+
+static int fq_cfg_parse_tag(const char *s, __u32 *tag) {
+  static const char *const modes[] = {
+      [FQ_COFLOW_TAG_NONE] = "none",
+      [FQ_COFLOW_TAG_DSCP] = "dscp",
+      [FQ_COFLOW_TAG_FLOWLABEL] = "flowlabel",
+  };
+  __u32 i;
+
+  for (i = 0; i < sizeof(modes) / sizeof(modes[0]); i++) {
+    if (!strcmp(s, modes[i])) {
+      *tag = i;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+static int fq_cfg_add_opt(struct fq_cfg_opt *opts, int *n, int type,
+                          __u32 val) {
+  if (*n == FQ_CFG_OPTS) {
+    fprintf(stderr, "fq_cfg: too many options\n");
+    return -1;
+  }
+  opts[(*n)++] = (struct fq_cfg_opt){type, val};
+  return 0;
+}
+
+static void fq_cfg_usage(void) {
+  fprintf(stderr,
+          "usage: fq_cfg -d dev -H handle [-n hold_min] [-x hold_max] "
+          "[-m key,key]\n"
+          "              [-e release_grid] [-p member_rate] [-R rule]...\n"
+          "              [-g none|dscp|flowlabel] [-s stamped_tag]\n"
+          "              [-w infer_window] [-P infer_port_shift]\n"
+          "       fq_cfg -d dev -H handle -r changes/s -t seconds\n");
+}
+
+int main(int argc, char **argv) {
+  static const int u32_opts[128] = {
+      ['n'] = TCA_FQ_COFLOW_HOLD_MIN,
+      ['x'] = TCA_FQ_COFLOW_HOLD_MAX,
+      ['e'] = TCA_FQ_COFLOW_RELEASE_GRID,
+      ['p'] = TCA_FQ_COFLOW_MAX_RATE,
+      ['s'] = TCA_FQ_COFLOW_TAG_STAMP,
+      ['w'] = TCA_FQ_COFLOW_INFER_WINDOW,
+      ['P'] = TCA_FQ_COFLOW_INFER_PORT_SHIFT,
+  };
+  struct fq_cfg_opt opts[FQ_CFG_OPTS];
+  __u32 tag, handle = 0;
+  __u64 members[FQ_COFLOW_MEMBERS];
+  struct tc_fq_coflow_rule rules[FQ_COFLOW_RULES_MAX];
+  int ifindex = 0, set_members = 0, rate = 0, seconds = 10, nl, c, err = 0;
+  int nrules = -1, nopts = 0;
+
+  while ((c = getopt(argc, argv, "d:H:n:x:m:e:p:g:s:w:P:R:r:t:h")) != -1) {
+    if (c > 0 && c < 128 && u32_opts[c]) {
+      if (fq_cfg_add_opt(opts, &nopts, u32_opts[c],
+                         strtoul(optarg, NULL, 0)))
+        return 1;
+      continue;
+    }
+    switch (c) {
+      case 'd': ifindex = if_nametoindex(optarg); break;
+      case 'H': {
+        /* major only, "1" or "1:" ; anything else leaves it 0 */
+        char *end;
+        unsigned long major = strtoul(optarg, &end, 16);
+
+        handle = (*end && strcmp(end, ":")) || major > 0xffff ? 0 : major << 16;
+        break;
+      }
+      case 'g':
+        if (fq_cfg_parse_tag(optarg, &tag)) {
+          fprintf(stderr, "fq_cfg: bad tag mode %s\n", optarg);
+          return 1;
+        }
+        if (fq_cfg_add_opt(opts, &nopts, TCA_FQ_COFLOW_TAG, tag)) return 1;
+        break;
+      case 'm':
+        if (fq_cfg_parse_members(optarg, members)) {
+          fprintf(stderr, "fq_cfg: bad member list %s\n", optarg);
+          return 1;
+        }
+        set_members = 1;
+        break;
+      case 'R':
+        if (nrules < 0) nrules = 0;
+        if (!strcmp(optarg, "none")) break;
+        if (nrules == FQ_COFLOW_RULES_MAX ||
+            fq_cfg_parse_rule(optarg, &rules[nrules])) {
+          fprintf(stderr, "fq_cfg: bad rule, or more than %d\n",
+                  FQ_COFLOW_RULES_MAX);
+          return 1;
+        }
+        nrules++;
+        break;
+      case 'r': rate = atoi(optarg); break;
+      case 't': seconds = atoi(optarg); break;
+      default: fq_cfg_usage(); return 1;
+    }
+  }
+  if (!ifindex || !handle) {
+    fq_cfg_usage();
+    return 1;
+  }
+  /* above 1e9/s the pacing step would be 0 ns, an unpaced busy loop */
+  if (rate < 0 || rate > 1000000000) {
+    fprintf(stderr, "fq_cfg: -r takes 1 to 1000000000 changes/s\n");
+    return 1;
+  }
+
+  nl = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+  if (nl < 0) {
+    fprintf(stderr, "fq_cfg: netlink: %s\n", strerror(errno));
+    return 1;
+  }
+
+  if (rate > 0) return fq_cfg_stress(nl, ifindex, handle, rate, seconds);
+
+  if (nopts || nrules >= 0)
+    err = fq_cfg_hold(nl, ifindex, handle, opts, nopts, rules, nrules);
+  if (!err && set_members) err = fq_cfg_members(nl, ifindex, handle, members);
+  if (err) {
+    fprintf(stderr, "fq_cfg: %s\n", strerror(-err));
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,322 @@
+/*
+ * tools/fq_controller.c Global co-flow order for the fq_agent of each host
+ *
+ *  fq_controller [-l addr:port] [-t period us] [-a agent timeout ms]
+ *
+ *  Keeps the last REPORT of every agent and, every period, orders all the
+ *  co-flows smallest effective bottleneck first (Varys SEBF) : the
+ *  bottleneck of a co-flow is the longest time one of its hosts needs to
+ *  send its remaining bytes there at link capacity. Rates follow MADD :
+ *  each co-flow, in order, gets on each host the rate that makes all its
+ *  parts finish together, within the capacity earlier co-flows left.
+ *  Co-flows of unknown size come last, unpaced. Every agent then gets an
+ *  ORDER listing its own co-flows. Once a second it prints the agents and
+ *  co-flows seen, the time spent ordering and the worst control latency
+ *  the agents measured.
+ */
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <math.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "fq_ctl.h"
+
+#define FQ_CTL_AGENTS 256
+#define FQ_CTL_COFLOWS (FQ_CTL_AGENTS * FQ_CTL_ENTRIES)
+
+struct fq_ctl_agent {
+  __u32 id;
+  struct sockaddr_in addr;
+  __u64 capacity;
+  __u64 last_seen;
+  __u64 ts_ns; /* of the last report, echoed */
+  __u64 rtt_ns;
+  int n;
+  struct fq_ctl_report reports[FQ_CTL_ENTRIES];
+  double left; /* capacity not given yet, during an ordering */
+};
+
+/* One co-flow part : the bytes a co-flow still has on one agent */
+struct fq_ctl_part {
+  __u32 coflow;
+  int agent;
+  __u64 remaining;
+  __u32 rate;
+};
+
+/* Parts [first, first + n) of the sorted part array */
+struct fq_ctl_coflow {
+  __u32 id;
+  int first;
+  int n;
+  double bottleneck; /* seconds, HUGE_VAL : unknown size */
+};
+
+static struct fq_ctl_agent fq_ctl_agents[FQ_CTL_AGENTS];
+static int fq_ctl_nagents;
+static struct fq_ctl_part fq_ctl_parts[FQ_CTL_COFLOWS];
+static struct fq_ctl_coflow fq_ctl_coflows[FQ_CTL_COFLOWS];
+
+static volatile sig_atomic_t fq_ctl_stop;
+
+static void fq_ctl_sigint(int sig) { fq_ctl_stop = 1; }
+
+static uint64_t fq_ctl_now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void fq_ctl_recv(const char *buf, ssize_t len,
+                        const struct sockaddr_in *from, uint64_t now) {
+  const struct fq_ctl_hdr *h = (const void *)buf;
+  struct fq_ctl_agent *a = NULL;
+  int i;
+
+  if (len < (ssize_t)sizeof(*h) || h->magic != FQ_CTL_MAGIC ||
+      h->type != FQ_CTL_REPORT || h->count > FQ_CTL_ENTRIES ||
+      len < (ssize_t)(sizeof(*h) + h->count * sizeof(struct fq_ctl_report)))
+    return;
+
+  for (i = 0; i < fq_ctl_nagents; i++)
+    if (fq_ctl_agents[i].id == h->agent) a = &fq_ctl_agents[i];
+  if (!a) {
+    if (fq_ctl_nagents == FQ_CTL_AGENTS) return;
+    a = &fq_ctl_agents[fq_ctl_nagents++];
+    a->id = h->agent;
+  }
+  a->addr = *from;
+  a->capacity = h->capacity;
+  a->last_seen = now;
+  a->ts_ns = h->ts_ns;
+  a->rtt_ns = h->rtt_ns;
+  a->n = h->count;
+  memcpy(a->reports, h + 1, h->count * sizeof(struct fq_ctl_report));
+}
+
+static void fq_ctl_expire(uint64_t now, uint64_t timeout) {
+  int i;
+
+  for (i = 0; i < fq_ctl_nagents;) {
+    if (now - fq_ctl_agents[i].last_seen > timeout)
+      fq_ctl_agents[i] = fq_ctl_agents[--fq_ctl_nagents];
+    else
+      i++;
+  }
+}
+
+static int fq_ctl_part_cmp(const void *x, const void *y) {
+  const struct fq_ctl_part *a = x, *b = y;
+
+  return a->coflow < b->coflow ? -1 : a->coflow > b->coflow;
+}
+
+static int fq_ctl_coflow_cmp(const void *x, const void *y) {
+  const struct fq_ctl_coflow *a = x, *b = y;
+
+  if (a->bottleneck != b->bottleneck)
+    return a->bottleneck < b->bottleneck ? -1 : 1;
+  return a->id < b->id ? -1 : a->id > b->id;
+}
+
+/* SEBF order and MADD rates, returns the number of co-flows */
+static int fq_ctl_order(void) {
+  int nparts = 0, ncoflows = 0, i, j;
+
+  for (i = 0; i < fq_ctl_nagents; i++) {
+    struct fq_ctl_agent *a = &fq_ctl_agents[i];
+
+    a->left = a->capacity;
+    for (j = 0; j < a->n; j++) {
+      fq_ctl_parts[nparts].coflow = a->reports[j].coflow;
+      fq_ctl_parts[nparts].agent = i;
+      fq_ctl_parts[nparts].remaining = a->reports[j].remaining;
+      fq_ctl_parts[nparts].rate = ~0U;
+      nparts++;
+    }
+  }
+  qsort(fq_ctl_parts, nparts, sizeof(fq_ctl_parts[0]), fq_ctl_part_cmp);
+
+  for (i = 0; i < nparts; i++) {
+    struct fq_ctl_coflow *c = &fq_ctl_coflows[ncoflows];
+    const struct fq_ctl_part *p = &fq_ctl_parts[i];
+    const struct fq_ctl_agent *a = &fq_ctl_agents[p->agent];
+    double t;
+
+    if (!i || p->coflow != fq_ctl_parts[i - 1].coflow) {
+      c->id = p->coflow;
+      c->first = i;
+      c->n = 0;
+      c->bottleneck = 0;
+      ncoflows++;
+    } else {
+      c--;
+    }
+    c->n++;
+    t = p->remaining == ~0ULL ? HUGE_VAL : p->remaining / (double)a->capacity;
+    if (t > c->bottleneck) c->bottleneck = t;
+  }
+  qsort(fq_ctl_coflows, ncoflows, sizeof(fq_ctl_coflows[0]),
+        fq_ctl_coflow_cmp);
+
+  for (i = 0; i < ncoflows; i++) {
+    const struct fq_ctl_coflow *c = &fq_ctl_coflows[i];
+    double gamma = 0;
+
+    if (c->bottleneck == HUGE_VAL) break;
+
+    /* time to finish with what earlier co-flows left */
+    for (j = c->first; j < c->first + c->n; j++) {
+      const struct fq_ctl_part *p = &fq_ctl_parts[j];
+      double left = fq_ctl_agents[p->agent].left;
+      double t = left > 0 ? p->remaining / left : HUGE_VAL;
+
+      if (t > gamma) gamma = t;
+    }
+    for (j = c->first; j < c->first + c->n; j++) {
+      struct fq_ctl_part *p = &fq_ctl_parts[j];
+      double rate = gamma == HUGE_VAL ? 0 : p->remaining / gamma;
+
+      if (gamma == 0) continue; /* nothing left, leave it unpaced */
+      fq_ctl_agents[p->agent].left -= rate;
+      p->rate = rate >= ~0U ? ~0U - 1 : rate > 1 ? rate : 1;
+    }
+  }
+  return ncoflows;
+}
+
+/* One ORDER per agent, its co-flows in the global order */
+static void fq_ctl_send(int udp, int ncoflows) {
+  char buf[sizeof(struct fq_ctl_hdr) +
+           FQ_CTL_ENTRIES * sizeof(struct fq_ctl_order)];
+  static __u32 seq;
+  int i, j, k;
+
+  seq++;
+  for (i = 0; i < fq_ctl_nagents; i++) {
+    const struct fq_ctl_agent *a = &fq_ctl_agents[i];
+    struct fq_ctl_hdr *h = (void *)buf;
+    struct fq_ctl_order *o = (void *)(h + 1);
+
+    memset(h, 0, sizeof(*h));
+    h->magic = FQ_CTL_MAGIC;
+    h->type = FQ_CTL_ORDER;
+    h->agent = a->id;
+    h->seq = seq;
+    h->echo_ns = a->ts_ns;
+    for (j = 0; j < ncoflows && h->count < FQ_CTL_ENTRIES; j++) {
+      const struct fq_ctl_coflow *c = &fq_ctl_coflows[j];
+
+      for (k = c->first; k < c->first + c->n; k++) {
+        if (fq_ctl_parts[k].agent != i) continue;
+        o->coflow = c->id;
+        o->rate = fq_ctl_parts[k].rate;
+        o++;
+        h->count++;
+        break;
+      }
+    }
+    sendto(udp, buf, (char *)o - buf, 0, (const void *)&a->addr,
+           sizeof(a->addr));
+  }
+}
+
+int main(int argc, char **argv) {
+  struct sockaddr_in addr = {.sin_family = AF_INET,
+                             .sin_port = htons(FQ_CTL_PORT)};
+  int period_us = 1000, timeout_ms = 100, udp, c, ncoflows = 0;
+  uint64_t now, next, last_print, order_ns = 0, orders = 0;
+  char *port;
+
+  while ((c = getopt(argc, argv, "l:t:a:h")) != -1) {
+    switch (c) {
+      case 'l':
+        port = strchr(optarg, ':');
+        if (port) {
+          *port++ = '\0';
+          addr.sin_port = htons(atoi(port));
+        }
+        if (inet_pton(AF_INET, optarg, &addr.sin_addr) != 1) {
+          fprintf(stderr, "fq_controller: bad address %s\n", optarg);
+          return 1;
+        }
+        break;
+      case 't': period_us = atoi(optarg) > 0 ? atoi(optarg) : 1000; break;
+      case 'a': timeout_ms = atoi(optarg) > 0 ? atoi(optarg) : 100; break;
+      default:
+        fprintf(stderr, "usage: fq_controller [-l addr:port] [-t period_us] "
+                        "[-a agent_timeout_ms]\n");
+        return 1;
+    }
+  }
+
+  udp = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  if (udp < 0 || bind(udp, (void *)&addr, sizeof(addr))) {
+    fprintf(stderr, "fq_controller: socket: %s\n", strerror(errno));
+    return 1;
+  }
+
+  signal(SIGINT, fq_ctl_sigint);
+  signal(SIGTERM, fq_ctl_sigint);
+  next = last_print = fq_ctl_now();
+
+  while (!fq_ctl_stop) {
+    struct pollfd pfd = {.fd = udp, .events = POLLIN};
+    struct timespec timeout = {0, 0};
+    int i;
+
+    now = fq_ctl_now();
+    if (now >= next) {
+      next += period_us * 1000ULL;
+      if (next < now) next = now + period_us * 1000ULL;
+      fq_ctl_expire(now, timeout_ms * 1000000ULL);
+      ncoflows = fq_ctl_order();
+      fq_ctl_send(udp, ncoflows);
+      order_ns += fq_ctl_now() - now;
+      orders++;
+    }
+    if (now - last_print >= 1000000000ULL) {
+      uint64_t rtt = 0;
+
+      for (i = 0; i < fq_ctl_nagents; i++)
+        if (fq_ctl_agents[i].rtt_ns > rtt) rtt = fq_ctl_agents[i].rtt_ns;
+      printf("%d agents, %d co-flows, ordering %.1f us, "
+             "control latency max %.3f ms\n",
+             fq_ctl_nagents, ncoflows, orders ? order_ns / 1e3 / orders : 0.0,
+             rtt / 1e6);
+      fflush(stdout);
+      last_print = now;
+      order_ns = orders = 0;
+    }
+
+    /* -t can be a second or more : tv_nsec must stay below 1e9 */
+    timeout.tv_sec = (next - now) / 1000000000ULL;
+    timeout.tv_nsec = (next - now) % 1000000000ULL;
+    if (ppoll(&pfd, 1, &timeout, NULL) <= 0) continue;
+
+    /* drain, the next ordering sees every report received so far */
+    for (;;) {
+      char buf[sizeof(struct fq_ctl_hdr) +
+               FQ_CTL_ENTRIES * sizeof(struct fq_ctl_report)];
+      struct sockaddr_in from;
+      socklen_t alen = sizeof(from);
+      ssize_t len = recvfrom(udp, buf, sizeof(buf), MSG_DONTWAIT,
+                             (void *)&from, &alen);
+
+      if (len < 0) break;
+      fq_ctl_recv(buf, len, &from, fq_ctl_now());
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,48 @@
+/*
+ * tools/fq_ctl.h Wire format between fq_controller and fq_agent
+ *
+ *  UDP, host byte order (controller and agents run the same build). An
+ *  agent sends a REPORT every interval, the controller answers every
+ *  period with an ORDER : the co-flows of that agent, highest priority
+ *  first, with the rate each may use there. ts_ns of a REPORT comes back
+ *  in echo_ns so the agent measures the control latency on its own clock.
+ */
+#ifndef FQ_CTL_H
+#define FQ_CTL_H
+
+#include <linux/types.h>
+
+#define FQ_CTL_MAGIC 0x66716331 /* "fqc1" */
+#define FQ_CTL_PORT 9642
+#define FQ_CTL_ENTRIES 64 /* co-flows per message */
+
+enum {
+  FQ_CTL_REPORT = 1,
+  FQ_CTL_ORDER,
+};
+
+struct fq_ctl_hdr {
+  __u32 magic;
+  __u16 type;
+  __u16 count;    /* entries following */
+  __u32 agent;    /* agent id */
+  __u32 seq;
+  __u64 ts_ns;    /* REPORT : agent CLOCK_MONOTONIC */
+  __u64 echo_ns;  /* ORDER : ts_ns of the last REPORT */
+  __u64 capacity; /* REPORT : bytes/s of the agent's link */
+  __u64 rtt_ns;   /* REPORT : last control latency measured */
+};
+
+struct fq_ctl_report {
+  __u32 coflow;
+  __u32 pad;
+  __u64 sent;      /* bytes dequeued while installed */
+  __u64 remaining; /* bytes left here, ~0ULL : unknown size */
+};
+
+struct fq_ctl_order {
+  __u32 coflow;
+  __u32 rate; /* bytes/s, ~0U : unpaced */
+};
+
+#endif
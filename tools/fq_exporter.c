@@ -0,0 +1,466 @@
+/*
+ * tools/fq_exporter.c Prometheus exporter for the fq qdiscs of a host
+ *
+ *  fq_exporter [-l addr:port]     (default 127.0.0.1:9641)
+ *
+ *  Every GET /metrics runs one RTM_GETQDISC dump over rtnetlink for all
+ *  devices, keeps the "fq" qdiscs and answers with their TCA_STATS2
+ *  counters : basic and queue stats, tc_fq_qd_stats and, when the module
+ *  is the co-flow sch_fq, the co-flow counters and the completion time
+ *  histogram of fq_uapi.h. Stock fq instances only export the first two
+ *  groups. Single threaded, one connection at a time : it is meant for a
+ *  local scraper.
+ */
+#include <arpa/inet.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/gen_stats.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+#include "../fq_uapi.h"
+
+struct fq_exp_qdisc {
+  char dev[IF_NAMESIZE];
+  __u32 handle;
+  __u32 parent;
+  __u64 bytes;
+  __u64 packets;
+  struct gnet_stats_queue queue;
+  struct tc_fq_coflow_qd_stats st;
+  size_t st_len; /* bytes of st the kernel filled */
+};
+
+struct fq_exp_scrape {
+  struct fq_exp_qdisc *q;
+  int n;
+  int size;
+};
+
+enum { FQ_EXP_COUNTER, FQ_EXP_GAUGE };
+
+/* One line per qdisc, the field is a __u32 or __u64 of fq_exp_qdisc */
+struct fq_exp_metric {
+  const char *name;
+  const char *help;
+  int type;
+  size_t off;
+  size_t width;
+  double scale;
+};
+
+#define QD(f) offsetof(struct fq_exp_qdisc, f), sizeof(((struct fq_exp_qdisc *)0)->f)
+#define ST(f) QD(st.f)
+
+static const struct fq_exp_metric fq_exp_metrics[] = {
+    {"fq_sent_bytes_total", "Bytes dequeued", FQ_EXP_COUNTER, QD(bytes), 1},
+    {"fq_sent_packets_total", "Packets dequeued", FQ_EXP_COUNTER, QD(packets), 1},
+    {"fq_backlog_bytes", "Bytes queued", FQ_EXP_GAUGE, QD(queue.backlog), 1},
+    {"fq_qlen_packets", "Packets queued", FQ_EXP_GAUGE, QD(queue.qlen), 1},
+    {"fq_drops_total", "Packets dropped", FQ_EXP_COUNTER, QD(queue.drops), 1},
+    {"fq_requeues_total", "Packets requeued", FQ_EXP_COUNTER, QD(queue.requeues), 1},
+    {"fq_overlimits_total", "Overlimit events", FQ_EXP_COUNTER, QD(queue.overlimits), 1},
+    {"fq_gc_flows_total", "Flows garbage collected", FQ_EXP_COUNTER, ST(fq.gc_flows), 1},
+    {"fq_highprio_packets_total", "Packets of the internal queue", FQ_EXP_COUNTER,
+     ST(fq.highprio_packets), 1},
+    {"fq_throttled_total", "Flows throttled", FQ_EXP_COUNTER, ST(fq.throttled), 1},
+    {"fq_flows_plimit_total", "Drops on the per flow limit", FQ_EXP_COUNTER,
+     ST(fq.flows_plimit), 1},
+    {"fq_pkts_too_long_total", "Packets above the quantum cap", FQ_EXP_COUNTER,
+     ST(fq.pkts_too_long), 1},
+    {"fq_allocation_errors_total", "Flow allocation failures", FQ_EXP_COUNTER,
+     ST(fq.allocation_errors), 1},
+    {"fq_flows", "Flows", FQ_EXP_GAUGE, ST(fq.flows), 1},
+    {"fq_inactive_flows", "Detached flows", FQ_EXP_GAUGE, ST(fq.inactive_flows), 1},
+    {"fq_throttled_flows", "Throttled flows", FQ_EXP_GAUGE, ST(fq.throttled_flows), 1},
+    {"fq_unthrottle_latency_seconds", "Smoothed unthrottle latency", FQ_EXP_GAUGE,
+     ST(fq.unthrottle_latency_ns), 1e-9},
+    {"fq_ce_mark_total", "Packets CE marked", FQ_EXP_COUNTER, ST(fq.ce_mark), 1},
+    {"fq_horizon_drops_total", "Drops beyond the horizon", FQ_EXP_COUNTER,
+     ST(fq.horizon_drops), 1},
+    {"fq_horizon_caps_total", "Timestamps capped to the horizon", FQ_EXP_COUNTER,
+     ST(fq.horizon_caps), 1},
+    {"fq_coflow_hold_seconds", "Current barrier hold interval", FQ_EXP_GAUGE,
+     ST(coflow_hold_ns), 1e-9},
+    {"fq_coflow_sent_bytes_total", "Co-flow bytes dequeued", FQ_EXP_COUNTER,
+     ST(coflow_bytes), 1},
+    {"fq_coflow_sent_packets_total", "Co-flow packets dequeued", FQ_EXP_COUNTER,
+     ST(coflow_packets), 1},
+    {"fq_coflow_drops_total", "Co-flow packets dropped", FQ_EXP_COUNTER,
+     ST(coflow_drops), 1},
+    {"fq_coflow_qlen_packets", "Co-flow packets queued", FQ_EXP_GAUGE,
+     ST(coflow_qlen), 1},
+    {"fq_coflow_backlog_bytes", "Co-flow bytes queued", FQ_EXP_GAUGE,
+     ST(coflow_backlog), 1},
+    {"fq_coflow_release_windows_total", "Common release times issued (EDT mode)",
+     FQ_EXP_COUNTER, ST(coflow_release_windows), 1},
+    {"fq_coflow_infer_joins_total", "Flows joined to an inferred co-flow group",
+     FQ_EXP_COUNTER, ST(coflow_infer_joins), 1},
+    {"fq_coflow_infer_hits_total", "Inferred groupings that match the members",
+     FQ_EXP_COUNTER, ST(coflow_infer_hits), 1},
+    {"fq_coflow_infer_misses_total", "Inferred groupings that miss the members",
+     FQ_EXP_COUNTER, ST(coflow_infer_misses), 1},
+    {"fq_coflow_infer_groups", "Inferred co-flow groups", FQ_EXP_GAUGE,
+     ST(coflow_infer_groups), 1},
+    {"fq_coflow_infer_confidence", "Confidence of the inferred co-flow (0-100)",
+     FQ_EXP_GAUGE, ST(coflow_infer_confidence), 1},
+};
+
+static volatile sig_atomic_t fq_exp_stop;
+
+static void fq_exp_sigint(int sig) { fq_exp_stop = 1; }
+
+static struct fq_exp_qdisc *fq_exp_new(struct fq_exp_scrape *s) {
+  if (s->n == s->size) {
+    int size = s->size ? 2 * s->size : 64;
+    struct fq_exp_qdisc *q = realloc(s->q, size * sizeof(*q));
+
+    if (!q) return NULL;
+    s->q = q;
+    s->size = size;
+  }
+  memset(&s->q[s->n], 0, sizeof(s->q[s->n]));
+  return &s->q[s->n++];
+}
+
+static void fq_exp_stats2(struct fq_exp_qdisc *q, struct rtattr *stats) {
+  int len = RTA_PAYLOAD(stats);
+  struct rtattr *rta;
+
+  for (rta = RTA_DATA(stats); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+    size_t plen = RTA_PAYLOAD(rta);
+
+    switch (rta->rta_type) {
+      case TCA_STATS_BASIC: {
+        struct gnet_stats_basic b = {};
+
+        memcpy(&b, RTA_DATA(rta), plen < sizeof(b) ? plen : sizeof(b));
+        q->bytes = b.bytes;
+        q->packets = b.packets;
+        break;
+      }
+      case TCA_STATS_PKT64: /* follows BASIC past 2^32 packets */
+        if (plen >= sizeof(__u64)) memcpy(&q->packets, RTA_DATA(rta), sizeof(__u64));
+        break;
+      case TCA_STATS_QUEUE:
+        memcpy(&q->queue, RTA_DATA(rta),
+               plen < sizeof(q->queue) ? plen : sizeof(q->queue));
+        break;
+      case TCA_STATS_APP:
+        q->st_len = plen < sizeof(q->st) ? plen : sizeof(q->st);
+        memcpy(&q->st, RTA_DATA(rta), q->st_len);
+        break;
+    }
+  }
+}
+
+/* Keeps the fq qdiscs of one RTM_NEWQDISC message, 0 or -ENOMEM */
+static int fq_exp_parse(struct fq_exp_scrape *s, struct nlmsghdr *nlh) {
+  struct tcmsg *tcm = NLMSG_DATA(nlh);
+  int len = nlh->nlmsg_len - NLMSG_LENGTH(sizeof(*tcm));
+  struct rtattr *rta, *kind = NULL, *stats = NULL;
+  struct fq_exp_qdisc *q;
+
+  if (nlh->nlmsg_type != RTM_NEWQDISC || len < 0) return 0;
+
+  for (rta = TCA_RTA(tcm); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+    if (rta->rta_type == TCA_KIND) kind = rta;
+    if (rta->rta_type == TCA_STATS2) stats = rta;
+  }
+  if (!kind || strcmp(RTA_DATA(kind), "fq") || !stats) return 0;
+
+  q = fq_exp_new(s);
+  if (!q) return -ENOMEM;
+  if (!if_indextoname(tcm->tcm_ifindex, q->dev))
+    snprintf(q->dev, sizeof(q->dev), "if%d", tcm->tcm_ifindex);
+  q->handle = tcm->tcm_handle;
+  q->parent = tcm->tcm_parent;
+  fq_exp_stats2(q, stats);
+  return 0;
+}
+
+/* One dump of every qdisc of every device, 0 or -errno */
+static int fq_exp_dump(int nl, struct fq_exp_scrape *s) {
+  static __u32 seq;
+  struct {
+    struct nlmsghdr nlh;
+    struct tcmsg tcm;
+  } req = {
+      .nlh.nlmsg_len = NLMSG_LENGTH(sizeof(struct tcmsg)),
+      .nlh.nlmsg_type = RTM_GETQDISC,
+      .nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP,
+      .nlh.nlmsg_seq = ++seq,
+      .tcm.tcm_family = AF_UNSPEC,
+  };
+  static char buf[32768];
+
+  s->n = 0;
+  if (send(nl, &req, req.nlh.nlmsg_len, 0) < 0) return -errno;
+
+  for (;;) {
+    ssize_t len = recv(nl, buf, sizeof(buf), 0);
+    struct nlmsghdr *nlh;
+
+    if (len < 0) {
+      if (errno == EINTR) continue;
+      return -errno;
+    }
+    for (nlh = (struct nlmsghdr *)buf; NLMSG_OK(nlh, len);
+         nlh = NLMSG_NEXT(nlh, len)) {
+      if (nlh->nlmsg_seq != seq) continue; /* late answer of a failed scrape */
+      if (nlh->nlmsg_type == NLMSG_DONE) return 0;
+      if (nlh->nlmsg_type == NLMSG_ERROR) {
+        struct nlmsgerr *e = NLMSG_DATA(nlh);
+
+        return e->error ? e->error : -EIO;
+      }
+      if (fq_exp_parse(s, nlh)) return -ENOMEM;
+    }
+  }
+}
+
+static void fq_exp_labels(FILE *out, const struct fq_exp_qdisc *q) {
+  const char *c;
+
+  fputs("{dev=\"", out);
+  for (c = q->dev; *c; c++) {
+    if (*c == '"' || *c == '\\') fputc('\\', out);
+    fputc(*c, out);
+  }
+  fprintf(out, "\",handle=\"%x:\",parent=\"", q->handle >> 16);
+  if (q->parent == TC_H_ROOT)
+    fputs("root", out);
+  else
+    fprintf(out, "%x:%x", q->parent >> 16, q->parent & 0xffff);
+  fputc('"', out);
+}
+
+static int fq_exp_has(const struct fq_exp_qdisc *q, size_t off, size_t width) {
+  size_t st = offsetof(struct fq_exp_qdisc, st);
+
+  return off < st || off + width <= st + q->st_len;
+}
+
+static void fq_exp_metric(FILE *out, const struct fq_exp_scrape *s,
+                          const struct fq_exp_metric *m) {
+  int i, header = 0;
+
+  for (i = 0; i < s->n; i++) {
+    const char *p = (const char *)&s->q[i] + m->off;
+    __u64 v;
+
+    if (!fq_exp_has(&s->q[i], m->off, m->width)) continue;
+    if (!header++)
+      fprintf(out, "# HELP %s %s\n# TYPE %s %s\n", m->name, m->help, m->name,
+              m->type == FQ_EXP_COUNTER ? "counter" : "gauge");
+
+    if (m->width == sizeof(__u32)) {
+      __u32 v32;
+
+      memcpy(&v32, p, sizeof(v32));
+      v = v32;
+    } else {
+      memcpy(&v, p, sizeof(v));
+    }
+    fputs(m->name, out);
+    fq_exp_labels(out, &s->q[i]);
+    if (m->scale == 1)
+      fprintf(out, "} %" PRIu64 "\n", (uint64_t)v);
+    else
+      fprintf(out, "} %.9g\n", v * m->scale);
+  }
+}
+
+/* fq_coflow_cct_seconds, bucket b of the kernel ends at 2^b us */
+static void fq_exp_cct(FILE *out, const struct fq_exp_scrape *s) {
+  const char *name = "fq_coflow_cct_seconds";
+  int i, b, header = 0;
+
+  for (i = 0; i < s->n; i++) {
+    const struct fq_exp_qdisc *q = &s->q[i];
+    __u64 count = 0;
+
+    if (!fq_exp_has(q, ST(coflow_cct_hist))) continue;
+    if (!header++)
+      fprintf(out, "# HELP %s Co-flow completion times\n# TYPE %s histogram\n",
+              name, name);
+
+    for (b = 0; b < FQ_CCT_BUCKETS; b++) {
+      count += q->st.coflow_cct_hist[b];
+      fprintf(out, "%s_bucket", name);
+      fq_exp_labels(out, q);
+      if (b == FQ_CCT_BUCKETS - 1)
+        fprintf(out, ",le=\"+Inf\"} %" PRIu64 "\n", (uint64_t)count);
+      else
+        fprintf(out, ",le=\"%.9g\"} %" PRIu64 "\n", (double)(1ULL << b) * 1e-6,
+                (uint64_t)count);
+    }
+    fprintf(out, "%s_sum", name);
+    fq_exp_labels(out, q);
+    fprintf(out, "} %.9g\n", q->st.coflow_cct_sum_ns * 1e-9);
+    fprintf(out, "%s_count", name);
+    fq_exp_labels(out, q);
+    fprintf(out, "} %" PRIu64 "\n", (uint64_t)count);
+  }
+}
+
+static void fq_exp_reply(int fd, const char *status, const char *body,
+                         size_t len) {
+  char hdr[256];
+  int n = snprintf(hdr, sizeof(hdr),
+                   "HTTP/1.0 %s\r\n"
+                   "Content-Type: text/plain; version=0.0.4\r\n"
+                   "Content-Length: %zu\r\n"
+                   "Connection: close\r\n\r\n",
+                   status, len);
+
+  if (write(fd, hdr, n) != n) return;
+  while (len) {
+    ssize_t w = write(fd, body, len);
+
+    if (w <= 0) return;
+    body += w;
+    len -= w;
+  }
+}
+
+static void fq_exp_serve(int fd, int nl, struct fq_exp_scrape *s) {
+  char req[1024];
+  size_t len = 0;
+  struct timespec t0, t1;
+  char *body = NULL;
+  size_t body_len = 0;
+  FILE *out;
+  int err;
+
+  /* the request line is all we need */
+  while (len < sizeof(req) - 1 && !memchr(req, '\n', len)) {
+    ssize_t r = read(fd, req + len, sizeof(req) - 1 - len);
+
+    if (r <= 0) return;
+    len += r;
+  }
+  req[len] = 0;
+
+  if (strncmp(req, "GET /metrics ", 13) && strncmp(req, "GET /metrics?", 13)) {
+    static const char msg[] = "fq_exporter: try /metrics\n";
+
+    fq_exp_reply(fd, "404 Not Found", msg, sizeof(msg) - 1);
+    return;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  err = fq_exp_dump(nl, s);
+  if (err) {
+    char msg[128];
+    int n = snprintf(msg, sizeof(msg), "fq_exporter: qdisc dump: %s\n",
+                     strerror(-err));
+
+    fq_exp_reply(fd, "503 Service Unavailable", msg, n);
+    return;
+  }
+
+  out = open_memstream(&body, &body_len);
+  if (!out) return;
+  for (size_t i = 0; i < sizeof(fq_exp_metrics) / sizeof(fq_exp_metrics[0]); i++)
+    fq_exp_metric(out, s, &fq_exp_metrics[i]);
+  fq_exp_cct(out, s);
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  fprintf(out,
+          "# HELP fq_exporter_qdiscs fq qdiscs found by the last dump\n"
+          "# TYPE fq_exporter_qdiscs gauge\nfq_exporter_qdiscs %d\n"
+          "# HELP fq_exporter_scrape_seconds Time spent in the last scrape\n"
+          "# TYPE fq_exporter_scrape_seconds gauge\n"
+          "fq_exporter_scrape_seconds %.9g\n",
+          s->n, (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) * 1e-9);
+  fclose(out);
+
+  fq_exp_reply(fd, "200 OK", body, body_len);
+  free(body);
+}
+
+static int fq_exp_listen(const char *spec) {
+  struct sockaddr_in sin = {.sin_family = AF_INET};
+  char addr[64];
+  const char *colon = strrchr(spec, ':');
+  int fd, one = 1;
+
+  if (!colon || colon - spec >= (int)sizeof(addr)) return -1;
+  memcpy(addr, spec, colon - spec);
+  addr[colon - spec] = 0;
+  sin.sin_port = htons(atoi(colon + 1));
+  if (inet_pton(AF_INET, *addr ? addr : "0.0.0.0", &sin.sin_addr) != 1)
+    return -1;
+
+  fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) return -1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  if (bind(fd, (struct sockaddr *)&sin, sizeof(sin)) || listen(fd, 16)) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+int main(int argc, char **argv) {
+  const char *listen_spec = "127.0.0.1:9641";
+  struct fq_exp_scrape s = {};
+  struct sigaction sa = {.sa_handler = fq_exp_sigint};
+  struct timeval tmo = {.tv_sec = 2};
+  int lfd, nl, c;
+
+  while ((c = getopt(argc, argv, "l:h")) != -1) {
+    switch (c) {
+      case 'l': listen_spec = optarg; break;
+      default:
+        fprintf(stderr, "usage: fq_exporter [-l addr:port]\n");
+        return 1;
+    }
+  }
+
+  nl = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+  if (nl < 0) {
+    fprintf(stderr, "fq_exporter: netlink: %s\n", strerror(errno));
+    return 1;
+  }
+  setsockopt(nl, SOL_SOCKET, SO_RCVTIMEO, &tmo, sizeof(tmo));
+
+  lfd = fq_exp_listen(listen_spec);
+  if (lfd < 0) {
+    fprintf(stderr, "fq_exporter: cannot listen on %s: %s\n", listen_spec,
+            strerror(errno));
+    return 1;
+  }
+
+  /* no SA_RESTART : a signal breaks accept() */
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+  signal(SIGPIPE, SIG_IGN);
+
+  while (!fq_exp_stop) {
+    int fd = accept(lfd, NULL, NULL);
+
+    if (fd < 0) continue;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tmo, sizeof(tmo));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tmo, sizeof(tmo));
+    fq_exp_serve(fd, nl, &s);
+    close(fd);
+  }
+
+  close(lfd);
+  close(nl);
+  free(s.q);
+  return 0;
+}
@@ -0,0 +1,201 @@
+/*
+ * tools/fq_ring.c Stream the sch_fq dequeue event ring to a file
+ *
+ *  fq_ring [-o file] [-t seconds] [-i poll us] /sys/kernel/debug/sch_fq/<qdisc>.ring
+ *  fq_ring -r file
+ *
+ *  Maps the ring read only and appends every new event to @file (stdout
+ *  by default) as a struct fq_ring_file followed by raw struct fq_ring_ev
+ *  records, 24 bytes each. Events the kernel overwrote before they were
+ *  copied are replaced by one FQ_RING_LOST record carrying their count.
+ *  -r prints a stream file as text.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../fq_ring.h"
+
+static volatile sig_atomic_t fq_ring_stop;
+
+static const char *const fq_list_names[] = {
+    [FQ_LIST_NEW] = "new",
+    [FQ_LIST_OLD] = "old",
+    [FQ_LIST_CO] = "co",
+    [FQ_LIST_INTERNAL] = "internal",
+};
+
+static void fq_ring_sigint(int sig) { fq_ring_stop = 1; }
+
+static uint64_t fq_ring_now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int fq_ring_print(const char *path) {
+  struct fq_ring_file fh;
+  struct fq_ring_ev ev;
+  FILE *in = fopen(path, "r");
+
+  if (!in) {
+    fprintf(stderr, "fq_ring: %s: %s\n", path, strerror(errno));
+    return 1;
+  }
+  if (fread(&fh, sizeof(fh), 1, in) != 1 || fh.magic != FQ_RING_FILE_MAGIC ||
+      fh.version != FQ_RING_VERSION || fh.ev_size != sizeof(ev)) {
+    fprintf(stderr, "fq_ring: %s: not an fq_ring stream\n", path);
+    fclose(in);
+    return 1;
+  }
+  printf("%-20s %-16s %6s %6s %-8s %8s\n", "tstamp", "key", "member", "len",
+         "list", "qlen");
+  while (fread(&ev, sizeof(ev), 1, in) == 1) {
+    if (ev.list == FQ_RING_LOST) {
+      printf("-- %u events lost\n", ev.len);
+      continue;
+    }
+    printf("%-20" PRIu64 " %016" PRIx64 " %6d %6u %-8s %8u\n",
+           (uint64_t)ev.tstamp, (uint64_t)ev.key, ev.member, ev.len,
+           ev.list <= FQ_LIST_INTERNAL ? fq_list_names[ev.list] : "?",
+           ev.qlen);
+  }
+  fclose(in);
+  return 0;
+}
+
+/* Appends a loss record for @n events */
+static void fq_ring_lost(FILE *out, uint64_t n) {
+  struct fq_ring_ev ev = {.len = n > UINT32_MAX ? UINT32_MAX : (uint32_t)n,
+                          .member = -1,
+                          .list = FQ_RING_LOST};
+
+  fwrite(&ev, sizeof(ev), 1, out);
+}
+
+int main(int argc, char **argv) {
+  const char *output = NULL;
+  uint64_t poll_us = 1000, seconds = 0, deadline, pos, lost = 0, total = 0;
+  struct fq_ring_file fh = {FQ_RING_FILE_MAGIC, FQ_RING_VERSION,
+                            sizeof(struct fq_ring_ev), 0};
+  struct fq_ring_hdr hdr, *r;
+  struct fq_ring_ev *ev, *buf;
+  size_t len;
+  FILE *out;
+  int c, fd;
+
+  while ((c = getopt(argc, argv, "o:t:i:r:h")) != -1) {
+    switch (c) {
+      case 'o': output = optarg; break;
+      case 't': seconds = strtoull(optarg, NULL, 0); break;
+      case 'i': poll_us = strtoull(optarg, NULL, 0); break;
+      case 'r': return fq_ring_print(optarg);
+      default:
+        fprintf(stderr,
+                "usage: fq_ring [-o file] [-t seconds] [-i poll_us] ring\n"
+                "       fq_ring -r file\n");
+        return 1;
+    }
+  }
+  if (optind != argc - 1) {
+    fprintf(stderr, "fq_ring: ring file required\n");
+    return 1;
+  }
+
+  /* the file has no read(), map the header alone to learn the size */
+  fd = open(argv[optind], O_RDONLY);
+  r = fd < 0 ? MAP_FAILED
+             : mmap(NULL, sizeof(hdr), PROT_READ, MAP_SHARED, fd, 0);
+  if (r == MAP_FAILED) {
+    fprintf(stderr, "fq_ring: %s: %s\n", argv[optind], strerror(errno));
+    return 1;
+  }
+  hdr = *r;
+  munmap(r, sizeof(hdr));
+  if (hdr.magic != FQ_RING_MAGIC || hdr.version != FQ_RING_VERSION ||
+      hdr.ev_size != sizeof(*ev) || !hdr.size ||
+      (hdr.size & (hdr.size - 1))) {
+    fprintf(stderr, "fq_ring: %s: bad ring header\n", argv[optind]);
+    return 1;
+  }
+
+  len = sizeof(hdr) + (size_t)hdr.size * sizeof(*ev);
+  r = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+  if (r == MAP_FAILED) {
+    fprintf(stderr, "fq_ring: mmap: %s\n", strerror(errno));
+    return 1;
+  }
+  ev = (struct fq_ring_ev *)(r + 1);
+  buf = calloc(hdr.size, sizeof(*buf));
+  if (!buf) {
+    fprintf(stderr, "fq_ring: out of memory\n");
+    return 1;
+  }
+
+  out = output ? fopen(output, "w") : stdout;
+  if (!out) {
+    fprintf(stderr, "fq_ring: %s: %s\n", output, strerror(errno));
+    return 1;
+  }
+  fwrite(&fh, sizeof(fh), 1, out);
+
+  signal(SIGINT, fq_ring_sigint);
+  signal(SIGTERM, fq_ring_sigint);
+  deadline = seconds ? fq_ring_now() + seconds * 1000000000ULL : 0;
+
+  pos = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+  while (!fq_ring_stop && (!deadline || fq_ring_now() < deadline)) {
+    uint64_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+    uint64_t gap = 0, skip, i;
+
+    if (head == pos) {
+      usleep(poll_us);
+      continue;
+    }
+    if (head - pos > hdr.size) {
+      gap = head - pos - hdr.size;
+      pos = head - hdr.size;
+    }
+
+    /* copy [pos, head) in at most two runs */
+    for (i = pos; i < head;) {
+      uint64_t idx = i & (hdr.size - 1);
+      uint64_t n = head - i < hdr.size - idx ? head - i : hdr.size - idx;
+
+      memcpy(&buf[i - pos], &ev[idx], n * sizeof(*ev));
+      i += n;
+    }
+
+    /* slots the writer reached since then, and the one it may be
+     * filling, can be torn : drop them
+     */
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    skip = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) + 1 - pos;
+    skip = skip > hdr.size ? skip - hdr.size : 0;
+    if (skip > head - pos) skip = head - pos;
+
+    if (gap + skip) {
+      fq_ring_lost(out, gap + skip);
+      lost += gap + skip;
+    }
+    fwrite(&buf[skip], sizeof(*buf), head - pos - skip, out);
+    total += head - pos - skip;
+    pos = head;
+  }
+
+  fflush(out);
+  fprintf(stderr, "fq_ring: %" PRIu64 " events, %" PRIu64 " lost\n", total,
+          lost);
+  if (out != stdout) fclose(out);
+  munmap(r, len);
+  close(fd);
+  return 0;
+}
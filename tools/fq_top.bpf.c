@@ -0,0 +1,116 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * tools/fq_top.bpf.c In kernel aggregation for fq_top
+ *
+ *  Every hook bumps per cpu counters of its fq instance, no atomics and
+ *  no ring buffer traffic : fq_top reads and sums the map once per
+ *  refresh. Module functions and tracepoints are resolved at load time
+ *  (module BTF for fentry/fexit, raw tracepoints by name).
+ */
+#include "vmlinux.h"
+#include <bpf/bpf_core_read.h>
+#include <bpf/bpf_helpers.h>
+#include <bpf/bpf_tracing.h>
+
+#include "fq_top.h"
+
+#define FQ_COFLOW_CMD_ADMIT 1
+#define FQ_COFLOW_CMD_PROMOTE 2
+#define FQ_COFLOW_CMD_TIMEOUT 3
+#define FQ_COFLOW_CMD_COMPLETE 4
+
+char LICENSE[] SEC("license") = "GPL";
+
+struct {
+  __uint(type, BPF_MAP_TYPE_PERCPU_HASH);
+  __uint(max_entries, FQ_TOP_MAX_QDISCS);
+  __type(key, struct fq_top_key);
+  __type(value, struct fq_top_val);
+} stats SEC(".maps");
+
+static __always_inline struct fq_top_val *fq_top_val(const struct Qdisc *sch) {
+  struct fq_top_key key = {};
+  struct fq_top_val *v;
+
+  key.ifindex = BPF_CORE_READ(sch, dev_queue, dev, ifindex);
+  key.handle = BPF_CORE_READ(sch, handle);
+  key.parent = BPF_CORE_READ(sch, parent);
+
+  v = bpf_map_lookup_elem(&stats, &key);
+  if (v) return v;
+
+  struct fq_top_val zero = {};
+
+  bpf_map_update_elem(&stats, &key, &zero, BPF_NOEXIST);
+  return bpf_map_lookup_elem(&stats, &key);
+}
+
+SEC("fentry/fq_enqueue")
+int BPF_PROG(fq_enqueue_entry, struct sk_buff *skb, struct Qdisc *sch) {
+  struct fq_top_val *v = fq_top_val(sch);
+
+  if (v) v->enqueues++;
+  return 0;
+}
+
+SEC("fexit/fq_dequeue")
+int BPF_PROG(fq_dequeue_exit, struct Qdisc *sch, struct sk_buff *ret) {
+  struct fq_top_val *v;
+
+  if (!ret) return 0;
+
+  v = fq_top_val(sch);
+  if (v) {
+    v->dequeues++;
+    v->dequeue_bytes += BPF_CORE_READ(ret, len);
+  }
+  return 0;
+}
+
+SEC("raw_tp/fq_coflow_enqueue")
+int BPF_PROG(fq_coflow_enqueue, struct Qdisc *sch, u64 key, int member,
+             unsigned int len, u64 hold_ns, u32 qlen) {
+  struct fq_top_val *v = fq_top_val(sch);
+
+  if (!v) return 0;
+
+  v->cf_enqueues++;
+  v->hold_ns += hold_ns;
+  v->qlen = qlen;
+  v->qlen_ts = bpf_ktime_get_ns();
+  return 0;
+}
+
+SEC("raw_tp/fq_coflow_dequeue")
+int BPF_PROG(fq_coflow_dequeue, struct Qdisc *sch, u64 key, int member,
+             unsigned int len, u32 qlen) {
+  struct fq_top_val *v = fq_top_val(sch);
+
+  if (!v) return 0;
+
+  v->cf_dequeues++;
+  v->cf_dequeue_bytes += len;
+  v->qlen = qlen;
+  v->qlen_ts = bpf_ktime_get_ns();
+  return 0;
+}
+
+SEC("raw_tp/fq_coflow_event")
+int BPF_PROG(fq_coflow_event, struct Qdisc *sch, u8 event, u64 bytes,
+             u64 packets, u64 cct_ns, u64 barrier) {
+  struct fq_top_val *v = fq_top_val(sch);
+
+  if (!v) return 0;
+
+  switch (event) {
+    case FQ_COFLOW_CMD_ADMIT: v->admits++; break;
+    case FQ_COFLOW_CMD_PROMOTE: v->promotions++; break;
+    case FQ_COFLOW_CMD_TIMEOUT: v->timeouts++; break;
+    case FQ_COFLOW_CMD_COMPLETE:
+      v->completions++;
+      v->cct_ns = cct_ns;
+      v->cct_ts = bpf_ktime_get_ns();
+      break;
+  }
+  return 0;
+}
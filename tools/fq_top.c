@@ -0,0 +1,216 @@
+/*
+ * tools/fq_top.c Live co-flow view of every fq instance, top style
+ *
+ *  fq_top [-i interval ms] [-n iterations]
+ *
+ *  Loads fq_top.bpf.c (CO-RE, needs BTF for vmlinux and the sch_fq
+ *  module), attaches fentry/fq_enqueue, fexit/fq_dequeue and the
+ *  fq_coflow raw tracepoints, then prints per fq instance, every interval :
+ *
+ *	QDISC	device and handle (parent for mq children)
+ *	PPS	packets dequeued per second, all flows
+ *	CF-Mb/s	co-flow (class :1) dequeue rate
+ *	HOLD-us	mean barrier hold of the member packets enqueued
+ *	QLEN	co-flow backlog, packets
+ *	CCT-us	last co-flow completion time
+ *	DONE/PROMO/TMO	completions, promotions, barrier timeouts
+ */
+#include <errno.h>
+#include <inttypes.h>
+#include <linux/types.h>
+#include <net/if.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+
+#include "fq_top.h"
+#include "fq_top.skel.h"
+
+struct fq_top_row {
+  struct fq_top_key key;
+  struct fq_top_val cur;
+  struct fq_top_val prev;
+  int seen;
+};
+
+static volatile sig_atomic_t fq_top_stop;
+
+static void fq_top_sigint(int sig) { fq_top_stop = 1; }
+
+static uint64_t fq_top_now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Sums the per cpu values, gauges come from the cpu that updated last */
+static void fq_top_sum(const struct fq_top_val *pcpu, int ncpus,
+                       struct fq_top_val *out) {
+  int c;
+
+  memset(out, 0, sizeof(*out));
+  for (c = 0; c < ncpus; c++) {
+    const struct fq_top_val *v = &pcpu[c];
+
+    out->enqueues += v->enqueues;
+    out->dequeues += v->dequeues;
+    out->dequeue_bytes += v->dequeue_bytes;
+    out->cf_enqueues += v->cf_enqueues;
+    out->cf_dequeues += v->cf_dequeues;
+    out->cf_dequeue_bytes += v->cf_dequeue_bytes;
+    out->hold_ns += v->hold_ns;
+    out->admits += v->admits;
+    out->promotions += v->promotions;
+    out->timeouts += v->timeouts;
+    out->completions += v->completions;
+    if (v->qlen_ts > out->qlen_ts) {
+      out->qlen = v->qlen;
+      out->qlen_ts = v->qlen_ts;
+    }
+    if (v->cct_ts > out->cct_ts) {
+      out->cct_ns = v->cct_ns;
+      out->cct_ts = v->cct_ts;
+    }
+  }
+}
+
+static struct fq_top_row *fq_top_find(struct fq_top_row *rows, int *nrows,
+                                      const struct fq_top_key *key) {
+  int i;
+
+  for (i = 0; i < *nrows; i++)
+    if (!memcmp(&rows[i].key, key, sizeof(*key))) return &rows[i];
+  if (*nrows == FQ_TOP_MAX_QDISCS) return NULL;
+
+  memset(&rows[*nrows], 0, sizeof(rows[*nrows]));
+  rows[*nrows].key = *key;
+  return &rows[(*nrows)++];
+}
+
+static double fq_top_rate_cf(const struct fq_top_row *r) {
+  return (double)(r->cur.cf_dequeue_bytes - r->prev.cf_dequeue_bytes);
+}
+
+static int fq_top_cmp(const void *a, const void *b) {
+  double ra = fq_top_rate_cf(a), rb = fq_top_rate_cf(b);
+
+  return ra < rb ? 1 : ra > rb ? -1 : 0;
+}
+
+static void fq_top_name(const struct fq_top_key *k, char *buf, size_t len) {
+  char dev[IF_NAMESIZE] = "?";
+  __u32 id = k->handle ? k->handle : k->parent;
+
+  if_indextoname(k->ifindex, dev);
+  snprintf(buf, len, "%s %s%x:%x", dev, k->handle ? "" : "parent ",
+           id >> 16, id & 0xffff);
+}
+
+int main(int argc, char **argv) {
+  static struct fq_top_row rows[FQ_TOP_MAX_QDISCS];
+  int interval_ms = 1000, iterations = 0, nrows = 0, ncpus, c, err;
+  struct fq_top_val *pcpu;
+  struct fq_top_bpf *skel;
+  uint64_t last;
+
+  while ((c = getopt(argc, argv, "i:n:h")) != -1) {
+    switch (c) {
+      case 'i': interval_ms = atoi(optarg) > 0 ? atoi(optarg) : 1000; break;
+      case 'n': iterations = atoi(optarg); break;
+      default:
+        fprintf(stderr, "usage: fq_top [-i interval_ms] [-n iterations]\n");
+        return 1;
+    }
+  }
+
+  ncpus = libbpf_num_possible_cpus();
+  if (ncpus <= 0) {
+    fprintf(stderr, "fq_top: cannot count cpus\n");
+    return 1;
+  }
+  pcpu = calloc(ncpus, sizeof(*pcpu));
+  if (!pcpu) return 1;
+
+  skel = fq_top_bpf__open_and_load();
+  if (!skel) {
+    fprintf(stderr, "fq_top: cannot load BPF program (is sch_fq loaded?)\n");
+    return 1;
+  }
+  err = fq_top_bpf__attach(skel);
+  if (err) {
+    fprintf(stderr, "fq_top: attach: %s\n", strerror(-err));
+    fq_top_bpf__destroy(skel);
+    return 1;
+  }
+
+  signal(SIGINT, fq_top_sigint);
+  signal(SIGTERM, fq_top_sigint);
+  last = fq_top_now();
+
+  while (!fq_top_stop) {
+    struct fq_top_key key, next, *prev_key = NULL;
+    int map = bpf_map__fd(skel->maps.stats);
+    uint64_t now;
+    double secs;
+    int i;
+
+    usleep(interval_ms * 1000);
+    now = fq_top_now();
+    secs = (now - last) / 1e9;
+    last = now;
+
+    for (i = 0; i < nrows; i++) {
+      rows[i].prev = rows[i].cur;
+      rows[i].seen = 0;
+    }
+    while (!bpf_map_get_next_key(map, prev_key, &next)) {
+      struct fq_top_row *r;
+
+      key = next;
+      prev_key = &key;
+      if (bpf_map_lookup_elem(map, &key, pcpu)) continue;
+      r = fq_top_find(rows, &nrows, &key);
+      if (!r) continue;
+      if (!r->seen && !r->cur.enqueues && !r->cur.cf_enqueues)
+        fq_top_sum(pcpu, ncpus, &r->prev); /* first sample, no rate yet */
+      fq_top_sum(pcpu, ncpus, &r->cur);
+      r->seen = 1;
+    }
+
+    qsort(rows, nrows, sizeof(rows[0]), fq_top_cmp);
+
+    printf("\033[H\033[J");
+    printf("%-24s %10s %10s %9s %8s %10s %8s %8s %8s\n", "QDISC", "PPS",
+           "CF-Mb/s", "HOLD-us", "QLEN", "CCT-us", "DONE", "PROMO", "TMO");
+    for (i = 0; i < nrows; i++) {
+      const struct fq_top_row *r = &rows[i];
+      uint64_t held = r->cur.cf_enqueues - r->prev.cf_enqueues;
+      char name[64];
+
+      if (!r->seen) continue;
+      fq_top_name(&r->key, name, sizeof(name));
+      printf("%-24s %10.0f %10.2f %9.1f %8" PRIu64 " %10.1f %8" PRIu64
+             " %8" PRIu64 " %8" PRIu64 "\n",
+             name, (r->cur.dequeues - r->prev.dequeues) / secs,
+             fq_top_rate_cf(r) * 8 / secs / 1e6,
+             held ? (r->cur.hold_ns - r->prev.hold_ns) / 1e3 / held : 0.0,
+             (uint64_t)r->cur.qlen, r->cur.cct_ns / 1e3,
+             (uint64_t)r->cur.completions, (uint64_t)r->cur.promotions,
+             (uint64_t)r->cur.timeouts);
+    }
+    fflush(stdout);
+
+    if (iterations && !--iterations) break;
+  }
+
+  fq_top_bpf__destroy(skel);
+  free(pcpu);
+  return 0;
+}
@@ -0,0 +1,38 @@
+/*
+ * tools/fq_top.h Map layout shared by fq_top.bpf.c and fq_top.c
+ */
+#ifndef FQ_TOP_H
+#define FQ_TOP_H
+
+#define FQ_TOP_MAX_QDISCS 1024
+
+/* One fq instance, its co-flow is class handle:1 */
+struct fq_top_key {
+  __u32 ifindex;
+  __u32 handle;
+  __u32 parent; /* mq children have no handle */
+};
+
+/* Per cpu, summed by fq_top */
+struct fq_top_val {
+  /* fentry/fq_enqueue, fexit/fq_dequeue */
+  __u64 enqueues;
+  __u64 dequeues;
+  __u64 dequeue_bytes;
+
+  /* co-flow tracepoints */
+  __u64 cf_enqueues;
+  __u64 cf_dequeues;
+  __u64 cf_dequeue_bytes;
+  __u64 hold_ns;     /* sum of member packet holds */
+  __u64 qlen;        /* co-flow backlog at ... */
+  __u64 qlen_ts;     /* ... this time, the latest cpu wins */
+  __u64 cct_ns;      /* last completion time, at ... */
+  __u64 cct_ts;
+  __u64 admits;
+  __u64 promotions;
+  __u64 timeouts;
+  __u64 completions;
+};
+
+#endif /* FQ_TOP_H */